@@ -28,6 +28,7 @@
 #include <zlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -48,16 +49,24 @@ void *kopen(const char *fn, int *_fd);
 int kclose(void *a);
 void kt_pipeline(int n_threads, void *(*func)(void*, int, void*), void *shared_data, int n_steps);
 
+#define OPT_ISIZE 0x100 // long options only, above any short option character
+
 typedef struct {
   kseq_t *ks, *ks2;
   mem_opt_t *opt;
   mem_pestat_t *pes0;
+  int pes_first;  // take pes0 from the first PE chunk, see -I first
+  mem_isize_t *isize; // insert sizes of the PE chunks so far
   int64_t n_processed;
   int copy_comment, actual_chunk_size;
   // for debug
   char *_seq1, *_seq2;
   int __processed;
   bwaidx_t *idx;
+  bwa_numa_t *numa;
+  bwa_addon_t *addon;
+  mem_hash_t *hash;
+  mem_seedbuf_t *sbuf;
 } ktp_aux_t;
 
 typedef struct {
@@ -104,6 +113,9 @@ static void *process(void *shared, int step, void *_data) {
   } else if (step == 1) {
     const mem_opt_t *opt = aux->opt;
     const bwaidx_t *idx = aux->idx;
+    const bntseq_t *bns = aux->addon? aux->addon->bns : idx->bns;
+    const uint8_t *pac = aux->addon? aux->addon->pac : idx->pac;
+    mem_pestat_t pes1 = {0};
 
     /* interleaved input */
     if (opt->flag & MEM_F_SMARTPE) {
@@ -115,14 +127,14 @@ static void *process(void *shared, int step, void *_data) {
 
       if (n_sep[0]) {           // single-end
         tmp_opt.flag &= ~MEM_F_PE;
-        mem_process_seqs(&tmp_opt, idx->bwt, idx->bns, idx->pac, aux->n_processed, n_sep[0], sep[0], 0);
+        mem_process_seqs(&tmp_opt, idx->bwt, bns, pac, aux->n_processed, n_sep[0], sep[0], 0, 0, 0, aux->numa, aux->addon, aux->hash, aux->sbuf);
         for (i = 0; i < n_sep[0]; ++i)
           data->seqs[sep[0][i].id].sam = sep[0][i].sam;
       }
 
       if (n_sep[1]) {           // paired-end
         tmp_opt.flag |= MEM_F_PE;
-        mem_process_seqs(&tmp_opt, idx->bwt, idx->bns, idx->pac, aux->n_processed + n_sep[0], n_sep[1], sep[1], aux->pes0);
+        mem_process_seqs(&tmp_opt, idx->bwt, bns, pac, aux->n_processed + n_sep[0], n_sep[1], sep[1], aux->pes0, &pes1, aux->isize, aux->numa, aux->addon, aux->hash, aux->sbuf);
         for (i = 0; i < n_sep[1]; ++i)
           data->seqs[sep[1][i].id].sam = sep[1][i].sam;
       }
@@ -144,7 +156,16 @@ static void *process(void *shared, int step, void *_data) {
       }
       free(sep[0]); free(sep[1]);
     } else {
-      mem_process_seqs(opt, idx->bwt, idx->bns, idx->pac, aux->n_processed, data->n_seqs, data->seqs, aux->pes0);
+      mem_process_seqs(opt, idx->bwt, bns, pac, aux->n_processed, data->n_seqs, data->seqs, aux->pes0, &pes1, aux->isize, aux->numa, aux->addon, aux->hash, aux->sbuf);
+    }
+
+    /* later chunks stream with the insert sizes of the first */
+    if (aux->pes_first && !aux->pes0 && pes1.set && !pes1.failed) {
+      aux->pes0 = malloc(sizeof(mem_pestat_t));
+      *aux->pes0 = pes1;
+      if (bwa_verbose >= 3)
+        fprintf(stderr, "[M::%s] insert sizes of the first chunk kept for the rest: mean %.3f, stddev: %.3f, max: %d, min: %d\n",
+                __func__, pes1.avg, pes1.std, pes1.high, pes1.low);
     }
 
     aux->n_processed += data->n_seqs;
@@ -234,6 +255,10 @@ int usage(mem_opt_t *opt) {
     fprintf(stderr, "                        (1), daughter (3), or both (0 [default]). Note, parent\n");
     fprintf(stderr, "                        is the bisulfite treated strand and the daughter is\n");
     fprintf(stderr, "                        the complement strand.\n");
+    fprintf(stderr, "    -o INT          With -b 0, align a read to the strand its C/G content\n");
+    fprintf(stderr, "                        favors first and skip the other strand if that gives\n");
+    fprintf(stderr, "                        a unique full-length hit within INT of a perfect score\n");
+    fprintf(stderr, "                        (-1: align to both strands) [%d]\n", opt->prune);
     fprintf(stderr, "    -f INT          1: BSW strand; 3: BSC strand; 0: both. Note, libraries\n");
     fprintf(stderr, "                        targeting either BSW or BSC are unseen so far! [0]\n");
     fprintf(stderr, "    -k INT          Minimum seed length [%d]\n", opt->min_seed_len);
@@ -242,6 +267,12 @@ int usage(mem_opt_t *opt) {
     fprintf(stderr, "    -r FLOAT        Look for internal seeds inside a seed longer than\n");
     fprintf(stderr, "                        {-k}*FLOAT [%g]\n", opt->split_factor);
     fprintf(stderr, "    -y INT          Seed occurrence for the 3rd round of seeding [%ld]\n", (long)opt->max_mem_intv);
+    fprintf(stderr, "    -u INT          Seed from a k-mer hash instead of the FM-index if the\n");
+    fprintf(stderr, "                        reference is at most INT bp, e.g. 2000000 for a panel\n");
+    fprintf(stderr, "                        or a plasmid [0, off]. Hits of repeats are taken in\n");
+    fprintf(stderr, "                        reference order, so ties among them may resolve\n");
+    fprintf(stderr, "                        differently; drops seeds whose k-mers all occur more\n");
+    fprintf(stderr, "                        than -c and %d times\n", MEM_HASH_MAX_HIT);
     /* fprintf(stderr, "    -s INT          Look for internal seeds inside a seed with less than\n"); *
      * fprintf(stderr, "                        INT occ [%d]\n", opt->split_width); */
     fprintf(stderr, "    -J STR          Adaptor of read 1 (fastq direction)\n");
@@ -304,6 +335,18 @@ int usage(mem_opt_t *opt) {
     fprintf(stderr, "                        if absent), maximum (4 sigma from the mean if absent)\n");
     fprintf(stderr, "                        and minimum of insert size distribution. FR orientation\n");
     fprintf(stderr, "                        only [inferred]\n");
+    fprintf(stderr, "    -I first        Infer the insert size distribution from the first chunk\n");
+    fprintf(stderr, "                        only and stream the rest with it\n");
+    fprintf(stderr, "    --isize FILE    Insert size model of the library. If FILE exists, take the\n");
+    fprintf(stderr, "                        insert size distribution from it; else infer it and\n");
+    fprintf(stderr, "                        save it to FILE for reruns and other lanes\n");
+    fprintf(stderr, "    -Z              Prefault <fai-index base>.bis.idx (from 'biscuit index -M')\n");
+    fprintf(stderr, "                        into memory before aligning\n");
+    fprintf(stderr, "    -n STR          NUMA placement of the index on multi-socket machines: 'rep'\n");
+    fprintf(stderr, "                        keeps a copy per node and pins each thread to a node,\n");
+    fprintf(stderr, "                        'int' interleaves one copy across nodes [none]\n");
+    fprintf(stderr, "    -l STR          Also align to this add-on index of spike-in or decoy contigs\n");
+    fprintf(stderr, "                        (e.g. lambda), built separately by 'biscuit index'\n");
     fprintf(stderr, "    -v INT          Verbosity level: \n");
     fprintf(stderr, "                        1: error, 2: warning, 3: message, 4+: debugging [%d]\n", bwa_verbose);
     fprintf(stderr, "    -h              This help\n");
@@ -316,10 +359,11 @@ int usage(mem_opt_t *opt) {
 /* the old main_mem */
 int main_align(int argc, char *argv[]) {
   mem_opt_t *opt, opt0;
-  int fd, fd2, i, c, ignore_alt = 0, no_mt_io = 0;
+  int fd, fd2, i, c, ignore_alt = 0, no_mt_io = 0, idx_flag = BWA_IDX_ALL, numa_mode = 0;
   int fixed_chunk_size = -1;
+  int64_t hash_max_pac = 0; // hash seeding is opt-in, see -u
   char *p, *rg_line = 0, *hdr_line = 0;
-  const char *mode = 0;
+  const char *mode = 0, *addon_hint = 0, *isize_fn = 0;
   //mem_pestat_t pes[4];
   ktp_aux_t aux;
 
@@ -334,13 +378,19 @@ int main_align(int argc, char *argv[]) {
   memset(&opt0, 0, sizeof(mem_opt_t));
   int auto_infer_alt_chrom = 1;
   if (argc < 2) return usage(opt);
-  while ((c = getopt(argc, argv, ":@:1:2:3:5:ab:c:d:ef:g:hijk:m:pqr:s:v:w:x:y:z:A:B:CD:E:FG:H:I:J:K:L:MN:O:PQ:R:ST:U:VW:X:Y")) >= 0) {
+  /* every letter is taken; the few options added since go long */
+  static const struct option long_opts[] = {
+    { "isize", required_argument, 0, OPT_ISIZE },
+    { 0, 0, 0, 0 }
+  };
+  while ((c = getopt_long(argc, argv, ":@:1:2:3:5:ab:c:d:ef:g:hijk:l:m:n:o:pqr:s:u:v:w:x:y:z:A:B:CD:E:FG:H:I:J:K:L:MN:O:PQ:R:ST:U:VW:X:YZ", long_opts, 0)) >= 0) {
       if (c == 'k') opt->min_seed_len = atoi(optarg), opt0.min_seed_len = 1;
       else if (c == '1') aux._seq1 = strdup(optarg);
       else if (c == '2') aux._seq2 = strdup(optarg);
       else if (c == 'x') mode = optarg;
       else if (c == 'b') opt->parent = atoi(optarg);   /* targeting parent or daughter */
       else if (c == 'f') opt->bsstrand = atoi(optarg); /* targeting BSW or BSC */
+      else if (c == 'o') opt->prune = atoi(optarg);    /* skip the unlikely strand */
       else if (c == 'i') auto_infer_alt_chrom = 0; // turn off auto-inference of alt-chromosomes
       else if (c == 'w') opt->w = atoi(optarg), opt0.w = 1;
       else if (c == 'A') opt->a = atoi(optarg), opt0.a = 1;
@@ -371,6 +421,14 @@ int main_align(int argc, char *argv[]) {
       else if (c == 'W') opt->min_chain_weight = atoi(optarg), opt0.min_chain_weight = 1;
       else if (c == 'y') opt->max_mem_intv = atol(optarg), opt0.max_mem_intv = 1;
       else if (c == 'C') aux.copy_comment = 1;
+      else if (c == 'Z') idx_flag |= BWA_IDX_PREFAULT;
+      else if (c == 'l') addon_hint = optarg;
+      else if (c == 'u') hash_max_pac = atol(optarg);
+      else if (c == 'n') {
+        if (strcmp(optarg, "rep") == 0) numa_mode = BWA_NUMA_REPLICATE;
+        else if (strcmp(optarg, "int") == 0) numa_mode = BWA_NUMA_INTERLEAVE;
+        else wzfatal("Unknown NUMA placement: %s\n", optarg);
+      }
       /* else if (c == 'K') fixed_chunk_size = atoi(optarg); -K now reads adapter sequences for read 2*/
       else if (c == 'J') {
           opt->l_adaptor1 = strlen(optarg);
@@ -429,6 +487,10 @@ int main_align(int argc, char *argv[]) {
                   fclose(fp);
               }
           } else hdr_line = bwa_insert_header(optarg, hdr_line);
+      } else if (c == OPT_ISIZE) {
+          isize_fn = optarg;
+      } else if (c == 'I' && strcmp(optarg, "first") == 0) {
+          aux.pes_first = 1;
       } else if (c == 'I') { // specify the insert size distribution
           mem_pestat_t *pes = calloc(1, sizeof(mem_pestat_t));
           pes->avg = strtod(optarg, &p);
@@ -450,9 +512,13 @@ int main_align(int argc, char *argv[]) {
       } else if (c == 'h') {
           return usage(opt);
       } else if (c == ':') {
-          usage(opt); wzfatal("Option needs an argument: -%c\n", optopt);
+          usage(opt);
+          if (optopt < OPT_ISIZE) wzfatal("Option needs an argument: -%c\n", optopt);
+          else wzfatal("Option needs an argument: %s\n", argv[optind-1]);
       } else if (c == '?') {
-          usage(opt); wzfatal("Unrecognized option: -%c\n", optopt);
+          usage(opt);
+          if (optopt) wzfatal("Unrecognized option: -%c\n", optopt);
+          else wzfatal("Unrecognized option: %s\n", argv[optind-1]);
       } else {
           return usage(opt);
       }
@@ -520,9 +586,12 @@ int main_align(int argc, char *argv[]) {
   }
   aux.idx = bwa_idx_load_from_shm(argv[optind]);
   if (aux.idx == 0) {
-    if ((aux.idx = bwa_idx_load(argv[optind], BWA_IDX_ALL)) == 0) return 1; // FIXME: memory leak
+    if ((aux.idx = bwa_idx_load(argv[optind], idx_flag)) == 0) return 1; // FIXME: memory leak
   } else if (bwa_verbose >= 3)
-    fprintf(stderr, "[M::%s] load the bwa index from shared memory\n", __func__);
+    fprintf(stderr, "[M::%s] load the BISCUIT index (both strands) from shared memory\n", __func__);
+
+  if (bwa_verbose >= 3)
+    fprintf(stderr, "[M::%s] occurrence counting: %s\n", __func__, bwt_occ_impl());
 
   // infer alternative chromosomes from name
   if (auto_infer_alt_chrom) infer_alt_chromosomes(aux.idx->bns);
@@ -531,6 +600,16 @@ int main_align(int argc, char *argv[]) {
     for (i = 0; i < aux.idx->bns->n_seqs; ++i)
       aux.idx->bns->anns[i].is_alt = 0;
 
+  if (numa_mode) aux.numa = bwa_numa_init(aux.idx, numa_mode);
+
+  // after the NUMA placement, which may move the names the merged bns shares
+  if (addon_hint && (aux.addon = bwa_addon_init(aux.idx, addon_hint)) == 0)
+    wzfatal("Failed to add the index %s\n", addon_hint);
+  if (aux.numa && aux.addon) bwa_numa_add_pac(aux.numa, aux.addon->pac, aux.addon->bns->l_pac/4+1);
+  if (aux.idx->bns->l_pac <= hash_max_pac && opt->min_seed_len >= MEM_HASH_K && !(opt->flag & MEM_F_SELF_OVLP))
+    aux.hash = mem_hash_init(aux.idx->bns, aux.idx->pac);
+  if (bwa_verbose >= 3) bwa_idx_report_huge(aux.idx);
+
   gzFile fp, fp2 = 0;
   void *ko = 0, *ko2 = 0;
   if  (!aux._seq1) {
@@ -561,12 +640,34 @@ int main_align(int argc, char *argv[]) {
 
   /* print header */
   if (!(opt->flag & MEM_F_ALN_REG))
-    bwa_print_sam_hdr(aux.idx->bns, hdr_line);
+    bwa_print_sam_hdr(aux.addon? aux.addon->bns : aux.idx->bns, hdr_line);
   aux.actual_chunk_size = fixed_chunk_size > 0? fixed_chunk_size : opt->chunk_size * opt->n_threads;
+
+  /* insert sizes of an earlier run of the library, kept fixed; if they do
+   * not settle the distribution, they seed the inference instead */
+  if (isize_fn && (aux.isize = mem_isize_load(isize_fn, opt->max_ins))) {
+    mem_pestat_t pes;
+    if (bwa_verbose >= 3)
+      fprintf(stderr, "[M::%s] loaded %ld insert sizes from %s\n", __func__, (long)aux.isize->n, isize_fn);
+    pes = mem_isize_pestat(aux.isize);
+    if (!pes.failed && !aux.pes0) {
+      aux.pes0 = malloc(sizeof(mem_pestat_t));
+      *aux.pes0 = pes;
+    }
+    if (!pes.failed) isize_fn = 0; // nothing new to save
+  }
+  if (!aux.isize) aux.isize = mem_isize_init(opt->max_ins);
+  aux.sbuf = mem_seedbuf_init(opt->n_threads);
   kt_pipeline(no_mt_io? 1 : 2, process, &aux, 3);
+  mem_seedbuf_destroy(aux.sbuf);
+  if (isize_fn && aux.isize->n) mem_isize_save(aux.isize, isize_fn);
+  mem_isize_destroy(aux.isize);
   free(hdr_line);
   free(opt->adaptor1); free(opt->adaptor2);
   free(opt);
+  bwa_numa_destroy(aux.numa);
+  mem_hash_destroy(aux.hash);
+  bwa_addon_destroy(aux.addon);
   bwa_idx_destroy(aux.idx);
   kseq_destroy(aux.ks);
   if (fp) {
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include "bntseq.h"
 #include "utils.h"
 #include "encode.h"
@@ -399,24 +400,97 @@ int bns_cnt_ambi(const bntseq_t *bns, int64_t pos_f, int len, int *ref_id) {
   return nn;
 }
 
+/* the 4 bases of a pac byte in order, and reverse complemented, one per
+ * byte of a little-endian word */
+static uint32_t bns_dec4[256], bns_rc4[256];
+
+__attribute__((constructor)) static void bns_dec4_init(void) {
+  int x, j;
+  for (x = 0; x < 256; ++x)
+    for (j = 0, bns_dec4[x] = bns_rc4[x] = 0; j < 4; ++j) {
+      uint32_t c = x>>((3-j)<<1)&3;
+      bns_dec4[x] |= c<<(j<<3);
+      bns_rc4[x] |= (3-c)<<((3-j)<<3);
+    }
+}
+
+/* decode [beg, end) of the forward-reverse reference into seq */
+static void bns_unpack(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, uint8_t *seq) {
+  int64_t k, l = 0;
+  if (beg >= l_pac) { // reverse strand, from the last forward base down
+    int64_t beg_f = (l_pac<<1) - 1 - end;
+    int64_t end_f = (l_pac<<1) - 1 - beg;
+    for (k = end_f; k > beg_f && (k&3) != 3; --k)
+      seq[l++] = 3 - _get_pac(pac, k);
+    for (; k - 4 >= beg_f; k -= 4, l += 4)
+      memcpy(seq + l, &bns_rc4[pac[k>>2]], 4);
+    for (; k > beg_f; --k)
+      seq[l++] = 3 - _get_pac(pac, k);
+  } else { // forward strand
+    for (k = beg; k < end && (k&3); ++k)
+      seq[l++] = _get_pac(pac, k);
+    for (; k + 4 <= end; k += 4, l += 4)
+      memcpy(seq + l, &bns_dec4[pac[k>>2]], 4);
+    for (; k < end; ++k)
+      seq[l++] = _get_pac(pac, k);
+  }
+}
+
+/* Windows of the forward-reverse reference decoded by bns_get_seq(), so
+ * that the extensions of a chain, the seeds tested by mem_seed_sw(), the
+ * CIGAR of the resulting regions and the mate rescue around them decode the
+ * same few hundred bases once. A window covers BNS_WIN_LEN bases from a
+ * multiple of BNS_WIN_STEP and is direct-mapped by that start; only the
+ * span [beg, end) requested so far is decoded. */
+#define BNS_WIN_STEP 1024
+#define BNS_WIN_LEN (BNS_WIN_STEP<<1) // holds any request of up to BNS_WIN_STEP bases
+#define BNS_N_WIN 256
+
+struct bns_cache_s {
+  const uint8_t *pac[BNS_N_WIN];
+  int64_t wb[BNS_N_WIN], beg[BNS_N_WIN], end[BNS_N_WIN];
+  uint8_t seq[BNS_N_WIN][BNS_WIN_LEN]; // base wb+j at j
+};
+
+static __thread bns_cache_t *bns_cache_cur; // bound by each worker thread
+
+bns_cache_t *bns_cache_init(void) {
+  return calloc(1, sizeof(bns_cache_t));
+}
+
+void bns_cache_destroy(bns_cache_t *c) {
+  free(c);
+}
+
+void bns_cache_bind(bns_cache_t *c) {
+  bns_cache_cur = c;
+}
+
+/* [beg, end) decoded in a window of c, which does not bridge the strands */
+static const uint8_t *bns_cache_get(bns_cache_t *c, int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end) {
+  int64_t wb = beg / BNS_WIN_STEP * BNS_WIN_STEP;
+  int i = (wb / BNS_WIN_STEP) & (BNS_N_WIN - 1);
+  uint8_t *seq = c->seq[i] - wb;
+  if (c->pac[i] != pac || c->wb[i] != wb || (c->beg[i] < l_pac) != (beg < l_pac) || end < c->beg[i] || beg > c->end[i]) {
+    c->pac[i] = pac, c->wb[i] = wb; // not touching the decoded span; start over
+    c->beg[i] = c->end[i] = beg;
+  }
+  if (beg < c->beg[i]) bns_unpack(l_pac, pac, beg, c->beg[i], seq + beg), c->beg[i] = beg;
+  if (end > c->end[i]) bns_unpack(l_pac, pac, c->end[i], end, seq + c->end[i]), c->end[i] = end;
+  return seq + beg;
+}
+
 uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, int64_t *len) {
   uint8_t *seq = 0;
   if (end < beg) end ^= beg, beg ^= end, end ^= beg; // if end is smaller, swap
   if (end > l_pac<<1) end = l_pac<<1;
   if (beg < 0) beg = 0;
   if (beg >= l_pac || end <= l_pac) {
-    int64_t k, l = 0;
     *len = end - beg;
-    seq = malloc(end - beg);
-    if (beg >= l_pac) { // reverse strand
-      int64_t beg_f = (l_pac<<1) - 1 - end;
-      int64_t end_f = (l_pac<<1) - 1 - beg;
-      for (k = end_f; k > beg_f; --k)
-        seq[l++] = 3 - _get_pac(pac, k);
-    } else { // forward strand
-      for (k = beg; k < end; ++k)
-        seq[l++] = _get_pac(pac, k);
-    }
+    seq = arena_malloc(end - beg);
+    if (bns_cache_cur && end - beg <= BNS_WIN_STEP)
+      memcpy(seq, bns_cache_get(bns_cache_cur, l_pac, pac, beg, end), end - beg);
+    else bns_unpack(l_pac, pac, beg, end, seq);
   } else *len = 0; // if bridging the forward-reverse boundary, return nothing
   return seq;
 }
@@ -539,113 +613,100 @@ static void bis_bns_dump(const bntseq_t *bns, const char *prefix){
   }
 }
 
-int64_t bis_bns_fasta2bntseq(gzFile fp_fa, const char *prefix, uint8_t parent) {
- 
-  extern void seq_reverse(int len, ubyte_t *seq, int is_comp); // in bwaseqio.c
-  kseq_t *seq;
-  char name[1024];
-  bntseq_t *bns;
-  uint8_t *pac = 0, *_pac = 0;
-  int32_t m_seqs, m_holes;
-  int64_t m_pac;
-  bntamb1_t *q;
-  FILE *fp;
-
-  // initialization
-  gzseek(fp_fa, 0, SEEK_SET);
-  seq = kseq_init(fp_fa);
-  bns = (bntseq_t*)calloc(1, sizeof(bntseq_t));
-  bns->seed = 11; // fixed seed for random generator
-  srand48(bns->seed);
-  m_seqs = m_holes = 8; m_pac = 0x10000;
-  bns->anns = (bntann1_t*)calloc(m_seqs, sizeof(bntann1_t));
-  bns->ambs = (bntamb1_t*)calloc(m_holes, sizeof(bntamb1_t));
-  _pac = calloc(m_pac/4, 1);
-  q = bns->ambs;
-  if (parent) {
-    strcpy(name, prefix); strcat(name, ".par.pac");
-  } else {
-    strcpy(name, prefix); strcat(name, ".dau.pac");
+/* write a 2-bit text with the trailer that makes the file size l/4+1+1 */
+static void bis_pac_dump(const char *fn, const uint8_t *pac, int64_t l) {
+  FILE *fp = xopen(fn, "wb");
+  ubyte_t ct;
+  err_fwrite(pac, 1, (l>>2) + ((l&3) == 0? 0 : 1), fp);
+  if (l % 4 == 0) {
+    ct = 0;
+    err_fwrite(&ct, 1, 1, fp);
   }
-  fp = xopen(name, "wb");
-  // read sequences
+  ct = l % 4;
+  err_fwrite(&ct, 1, 1, fp);
+  err_fflush(fp);
+  err_fclose(fp);
+}
 
-  while (kseq_read(seq) >= 0) {
-    _pac = bis_add1(seq, bns, _pac, &m_pac, &m_seqs, &m_holes, &q);
-  }
-  /* kseq_rewind(seq); */
-  /* gzseek(seq->f->f, 0, SEEK_SET); */
-  /* fprintf(stderr, "foward end\n"); */
-  /* fflush(stderr); */
-  /* while (kseq_read(seq) >= 0) { */
-  /* if (parent) nt256char_rev_ip(seq->seq.s, seq->seq.l); */
-  /* pac = bis_add1(seq, bns, pac, &m_pac, &m_seqs, &m_holes, &q, parent, 1); */
-  /* } */
-
-  int64_t l,k;
-  m_pac = (bns->l_pac*2+3)/4*4; /* in bit */
-  pac = calloc(m_pac/4,sizeof(uint8_t));
-  for (l=0; l<bns->l_pac; ++l) {
-    uint8_t c = _get_pac(_pac,l);
-    if (parent && c == 1) c = 3;
-    if (!parent && c == 2) c = 0;
-    _set_pac(pac, l, c);
-  }
+/* converted strand of a forward pac: the forward sequence followed by its
+ * reverse complement, with C->T (parent) or G->A (daughter) */
+static void bis_pac_strand(const uint8_t *fwd, int64_t l_pac, uint8_t parent, const char *fn) {
+  uint8_t *pac;
+  int64_t l, k;
 
-  for (k=bns->l_pac-1; k>=0; --k,++l) {
-    uint8_t c = 3-_get_pac(_pac,k);
-    if (parent && c == 1) c = 3;
-    if (!parent && c == 2) c = 0;
-    _set_pac(pac, l, c);
+  pac = calloc((l_pac*2+3)/4, 1);
+  for (l = 0; l < l_pac; ++l) {
+    uint8_t c = _get_pac(fwd, l);
+    _set_pac(pac, l, parent? bsC2T(c) : bsG2A(c));
   }
-  free(_pac);
-  /* int64_t l; */
-  /* fprintf(stderr, "reverse end\n"); */
-  /* fflush(stderr); */
-  /* if (!for_only) { // add the reverse complemented sequence */
-  /*   m_pac = (bns->l_pac * 2 + 3) / 4 * 4; */
-  /*   pac = realloc(pac, m_pac/4); */
-  /*   memset(pac + (bns->l_pac+3)/4, 0, (m_pac - (bns->l_pac+3)/4*4) / 4); */
-  /*   for (l = bns->l_pac - 1; l >= 0; --l, ++bns->l_pac) */
-  /*     _set_pac(pac, bns->l_pac, 3-_get_pac(pac, l)); */
-  /* } */
-
-  assert(bns->l_pac<<1 == l);
-  { // finalize .pac file
-    ubyte_t ct;
-    err_fwrite(pac, 1, (l>>2) + ((l&3) == 0? 0 : 1), fp);
-    // the following codes make the pac file size always (l_pac/4+1+1)
-    if (l % 4 == 0) {
-      ct = 0;
-      err_fwrite(&ct, 1, 1, fp);
-    }
-    ct = l % 4;
-    err_fwrite(&ct, 1, 1, fp);
-    // close .pac file
-    err_fflush(fp);
-    err_fclose(fp);
+  for (k = l_pac-1; k >= 0; --k, ++l) {
+    uint8_t c = 3-_get_pac(fwd, k);
+    _set_pac(pac, l, parent? bsC2T(c) : bsG2A(c));
   }
-  if (parent) bis_bns_dump(bns, prefix);
-  bns_destroy(bns);
-  kseq_destroy(seq);
+  bis_pac_dump(fn, pac, l);
   free(pac);
-  return l;
 }
 
-int64_t dump_forward_pac(gzFile fp_fa, const char *prefix) {
+#define BNS_INFLATE_BUF 0x100000
 
-  extern void seq_reverse(int len, ubyte_t *seq, int is_comp); // in bwaseqio.c
+typedef struct {
+  gzFile fp;
+  int fd;
+} bns_inflate_t;
+
+/* decompress the FASTA into a pipe so that parsing runs in another thread */
+static void *bns_inflate_worker(void *data) {
+  bns_inflate_t *w = (bns_inflate_t*)data;
+  uint8_t *buf = malloc(BNS_INFLATE_BUF), *p;
+  int l;
+  while ((l = err_gzread(w->fp, buf, BNS_INFLATE_BUF)) > 0) {
+    for (p = buf; l > 0; ) {
+      ssize_t r = write(w->fd, p, l);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) err_fatal(__func__, "fail to pass on the FASTA: %s", strerror(errno));
+      p += r; l -= r;
+    }
+  }
+  close(w->fd);
+  free(buf);
+  return 0;
+}
+
+/**
+ * Pack a FASTA for the bisulfite index in one read: writes the forward
+ * <prefix>.bis.pac with its .bis.ann and .bis.amb, and the converted
+ * strands <prefix>.par.pac and <prefix>.dau.pac. Ns are filled with the
+ * same random bases in all three.
+ * @return  length of a converted strand, twice the forward length
+ */
+int64_t bis_bns_fasta2pac(const char *fn_fa, const char *prefix) {
   kseq_t *seq;
   char name[1024];
   bntseq_t *bns;
   uint8_t *pac = 0;
   int32_t m_seqs, m_holes;
-  int64_t ret = -1, m_pac;
+  int64_t m_pac, ret;
   bntamb1_t *q;
-  FILE *fp;
+  bns_inflate_t w;
+  pthread_t tid;
+  gzFile fp;
+  int fd[2], piped;
+
+  // the calling thread parses while a worker decompresses
+  w.fp = xzopen(fn_fa, "r");
+  piped = pipe(fd) == 0;
+  if (piped) {
+    w.fd = fd[1];
+    if (pthread_create(&tid, 0, bns_inflate_worker, &w) != 0) { // parse w.fp here instead
+      close(fd[0]); close(fd[1]);
+      piped = 0;
+    }
+  }
+  if (piped) {
+    if ((fp = gzdopen(fd[0], "r")) == 0) err_fatal(__func__, "fail to read from the inflating thread");
+  } else fp = w.fp;
 
-  // initialization
-  seq = kseq_init(fp_fa);
+  seq = kseq_init(fp);
   bns = (bntseq_t*)calloc(1, sizeof(bntseq_t));
   bns->seed = 11; // fixed seed for random generator
   srand48(bns->seed);
@@ -654,32 +715,23 @@ int64_t dump_forward_pac(gzFile fp_fa, const char *prefix) {
   bns->ambs = (bntamb1_t*)calloc(m_holes, sizeof(bntamb1_t));
   pac = calloc(m_pac/4, 1);
   q = bns->ambs;
-  strcpy(name, prefix); strcat(name, ".bis.pac");
-  fp = xopen(name, "wb");
-  // read sequences
-  while (kseq_read(seq) >= 0) pac = add1(seq, bns, pac, &m_pac, &m_seqs, &m_holes, &q);
-
-  ret = bns->l_pac;
-  { // finalize .pac file
-    ubyte_t ct;
-    err_fwrite(pac, 1, (bns->l_pac>>2) + ((bns->l_pac&3) == 0? 0 : 1), fp);
-    // the following codes make the pac file size always (l_pac/4+1+1)
-    if (bns->l_pac % 4 == 0) {
-      ct = 0;
-      err_fwrite(&ct, 1, 1, fp);
-    }
-    ct = bns->l_pac % 4;
-    err_fwrite(&ct, 1, 1, fp);
-    // close .pac file
-    err_fflush(fp);
-    err_fclose(fp);
+  while (kseq_read(seq) >= 0) pac = bis_add1(seq, bns, pac, &m_pac, &m_seqs, &m_holes, &q);
+  kseq_destroy(seq);
+  if (piped) {
+    err_gzclose(fp);
+    pthread_join(tid, 0);
   }
-  /* re-dump forward bis bns, otherwise the .bis.ann and .bis.amb have twice as long pac  */
-  /* strcpy(name, prefix); strcat(name, ".bis"); */
-  /* bis_bns_dump(bns, prefix); */
+  err_gzclose(w.fp);
 
+  strcpy(name, prefix); strcat(name, ".bis.pac");
+  bis_pac_dump(name, pac, bns->l_pac);
+  strcpy(name, prefix); strcat(name, ".par.pac");
+  bis_pac_strand(pac, bns->l_pac, 1, name);
+  strcpy(name, prefix); strcat(name, ".dau.pac");
+  bis_pac_strand(pac, bns->l_pac, 0, name);
+  bis_bns_dump(bns, prefix);
+  ret = bns->l_pac<<1;
   bns_destroy(bns);
-  kseq_destroy(seq);
   free(pac);
   return ret;
 }
@@ -64,6 +64,9 @@ typedef struct {
 	FILE *fp_pac;
 } bntseq_t;
 
+// decoded reference windows of a thread, see bns_get_seq()
+typedef struct bns_cache_s bns_cache_t;
+
 extern unsigned char nst_nt4_table[256];
 
 #ifdef __cplusplus
@@ -77,13 +80,17 @@ extern "C" {
 	int64_t bns_fasta2bntseq(gzFile fp_fa, const char *prefix, int for_only);
 	int bns_pos2rid(const bntseq_t *bns, int64_t pos_f);
 	int bns_cnt_ambi(const bntseq_t *bns, int64_t pos_f, int len, int *ref_id);
+	bns_cache_t *bns_cache_init(void);
+	void bns_cache_destroy(bns_cache_t *c);
+	void bns_cache_bind(bns_cache_t *c);
+	// from the arena bound to the thread, if any; release with arena_free()
+	// short slices are copied from the windows of the bound cache, if any
 	uint8_t *bns_get_seq(int64_t l_pac, const uint8_t *pac, int64_t beg, int64_t end, int64_t *len);
 	uint8_t *bns_fetch_seq(const bntseq_t *bns, const uint8_t *pac, int64_t *beg, int64_t mid, int64_t *end, int *rid);
 	int bns_intv2rid(const bntseq_t *bns, int64_t rb, int64_t re);
 
   /* WZBS */
-  int64_t dump_forward_pac(gzFile fp_fa, const char *prefix);
-  int64_t bis_bns_fasta2bntseq(gzFile fp_fa, const char *prefix, uint8_t parent);
+  int64_t bis_bns_fasta2pac(const char *fn_fa, const char *prefix);
 
 #ifdef __cplusplus
 }
@@ -29,6 +29,8 @@
 #include <stdio.h>
 #include <zlib.h>
 #include <assert.h>
+#include <sys/mman.h>
+#include <emmintrin.h>
 #include "bntseq.h"
 #include "bwa.h"
 #include "ksw.h"
@@ -266,10 +268,169 @@ uint32_t *bwa_gen_cigar2(const int8_t mat[25], int o_del, int e_del, int o_ins,
       tmp = query[i], query[i] = query[l_query - 1 - i], query[l_query - 1 - i] = tmp;
 
 ret_gen_cigar:
-  free(rseq);
+  arena_free(rseq);
   return cigar;
 }
 
+/**
+ * CIGAR from the alignment path, in the same sweep MD (appended to the
+ * CIGAR), NM, conversion and retention counts if NM is given
+ *
+ * @param n_path, path  one op per column, see ksw_global2_path()
+ * @param query, rseq   the aligned query and reference
+ * @param int2base      how reference bases are spelled in MD
+ * @param n_cigar       (out) number of cigars
+ * @param NM,ZC,ZR,bss_u  (out) see bis_bwa_gen_cigar2()
+ *
+ * @return cigar    uint32_t
+ */
+static uint32_t *bis_path2cigar(int n_path, const uint8_t *path, const uint8_t *query, const uint8_t *rseq, const char *int2base, uint8_t parent, int *n_cigar, int *NM, uint32_t *ZC, uint32_t *ZR, int *bss_u) {
+
+  int i, k, l, x, y, u, m_cigar = 0, n_mm = 0, n_gap = 0;
+  int n_conv_ct = 0, n_ret_c = 0;
+  int n_conv_ga = 0, n_ret_g = 0;
+  uint32_t *cigar = 0;
+  kstring_t str = {0, 0, 0};
+
+  *n_cigar = 0;
+  for (k = x = y = u = 0; k < n_path; k = l) {
+    int op = path[k], len;
+    for (l = k + 1; l < n_path && path[l] == op; ++l);
+    len = l - k;
+    if (*n_cigar == m_cigar) {
+      m_cigar = m_cigar? m_cigar<<1 : 4;
+      cigar = realloc(cigar, m_cigar * 4);
+    }
+    cigar[(*n_cigar)++] = len<<4 | op;
+    if (!NM) continue;
+
+    if (op == 0) { // match
+      for (i = 0; i < len; ++i) {
+
+        /* to allow assymmetric CT and GA */
+        unsigned char _q = query[x+i];
+        unsigned char _r = rseq[y+i];
+        if (_q == _r) {
+          if (_q == 1) ++n_ret_c;
+          if (_q == 2) ++n_ret_g;
+          ++u;
+        } else if (_q == 3 && _r == 1) {
+          ++n_conv_ct; ++u;
+        } else if (!parent && _q == 0 && _r == 2) {
+          ++n_conv_ga; ++u;
+        } else {
+          kputw(u, &str);
+          kputc(int2base[_r], &str);
+          ++n_mm; u = 0;
+        }
+      }
+      x += len; y += len;
+    } else if (op == 2) { // deletion
+      if (k > 0 && l < n_path) { // don't do the following if D is the first or the last CIGAR
+        kputw(u, &str); kputc('^', &str);
+        for (i = 0; i < len; ++i)
+          kputc(int2base[rseq[y+i]], &str);
+        u = 0; n_gap += len;
+      }
+      y += len;
+    } else if (op == 1) { // insertion does not contribute to MD
+      x += len, n_gap += len;
+    }
+  }
+
+  if (NM) {
+    kputw(u, &str);
+    /* NM contains both gap and mismatches, and every base in a gap counts */
+    *NM = n_mm + n_gap;
+    *ZC = parent ? n_conv_ct : n_conv_ga;		/* conversion counts */
+    *ZR = parent ? n_ret_c : n_ret_g;       /* retention counts */
+    if (n_conv_ct == 0 && n_conv_ga == 0) *bss_u = 1;
+    else *bss_u = 0;
+    cigar = realloc(cigar, *n_cigar * 4 + str.l + 1); // append MD to CIGAR
+    memcpy(cigar + *n_cigar, str.s, str.l + 1);
+    free(str.s);
+  }
+  return cigar;
+}
+
+/**
+ * Score, CIGAR (a single M with MD appended), NM, conversion and retention
+ * counts of the gap-free alignment of query to rseq, comparing 16 bases
+ * at a time with the asymmetric C/T and G/A rules of bis_path2cigar()
+ *
+ * The result is what the DP would give only if no alignment with gaps can
+ * score as high; one needs an insertion and a deletion, so it scores at
+ * most (l_query-1)*max(mat) minus two gap opens.
+ *
+ * @param n_cigar, cigar  (out) set if n_cigar is given
+ * @param NM, ZC, ZR, bss_u  (out) set if both n_cigar and NM are given
+ *
+ * @return 1, or 0 (with nothing set) if the DP is needed
+ */
+static int bis_ungapped(const int8_t mat[25], int o_del, int e_del, int o_ins, int e_ins, int l_query, const uint8_t *query, const uint8_t *rseq, const char *int2base, uint8_t parent, int *score, int *n_cigar, uint32_t **cigar, int *NM, uint32_t *ZC, uint32_t *ZR, int *bss_u) {
+
+  int i, k, last = 0, n_mm = 0, sc = 0, max = 0;
+  int n_eq[5] = {0, 0, 0, 0, 0}, n_conv_ct = 0, n_conv_ga = 0;
+  kstring_t str = {0, 0, 0};
+  uint8_t qb[16], rb[16];
+
+  for (i = 0; i < l_query; i += 16) {
+    int n = l_query - i < 16? l_query - i : 16;
+    const uint8_t *q8 = query + i, *r8 = rseq + i;
+    uint32_t e, ct, ga, mm;
+    __m128i q, r;
+    if (n < 16) { // pad with bases that never pair
+      memset(qb, 5, 16); memset(rb, 6, 16);
+      memcpy(qb, q8, n); memcpy(rb, r8, n);
+      q8 = qb, r8 = rb;
+    }
+    q = _mm_loadu_si128((const __m128i*)q8);
+    r = _mm_loadu_si128((const __m128i*)r8);
+    e = _mm_movemask_epi8(_mm_cmpeq_epi8(q, r));
+    ct = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(q, _mm_set1_epi8(3)), _mm_cmpeq_epi8(r, _mm_set1_epi8(1))));
+    ga = parent? 0 : _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(q, _mm_set1_epi8(0)), _mm_cmpeq_epi8(r, _mm_set1_epi8(2))));
+    for (k = 0; k < 5; ++k)
+      n_eq[k] += __builtin_popcount(e & _mm_movemask_epi8(_mm_cmpeq_epi8(q, _mm_set1_epi8(k))));
+    n_conv_ct += __builtin_popcount(ct);
+    n_conv_ga += __builtin_popcount(ga);
+    mm = ~(e | ct | ga) & ((1u << n) - 1);
+    for (; mm; mm &= mm - 1) { // mismatches, left to right
+      int p = i + __builtin_ctz(mm);
+      sc += mat[rseq[p]*5 + query[p]];
+      if (n_cigar) {
+        kputw(p - last, &str);
+        kputc(int2base[rseq[p]], &str);
+      }
+      last = p + 1; ++n_mm;
+    }
+  }
+  for (k = 0; k < 5; ++k) sc += n_eq[k] * mat[k*6];
+  sc += n_conv_ct * mat[1*5+3] + n_conv_ga * mat[2*5+0];
+
+  for (i = 0; i < 25; ++i) max = max > mat[i]? max : mat[i];
+  if (sc <= (l_query - 1) * max - (o_del + e_del) - (o_ins + e_ins)) {
+    free(str.s);
+    return 0;
+  }
+
+  *score = sc;
+  if (n_cigar) {
+    kputw(l_query - last, &str);
+    *cigar = malloc(4 + (NM? str.l + 1 : 0));
+    (*cigar)[0] = l_query<<4 | 0;
+    *n_cigar = 1;
+    if (NM) memcpy(*cigar + 1, str.s, str.l + 1); // append MD to CIGAR
+  }
+  free(str.s);
+  if (n_cigar && NM) { // as the DP path, which only counts them along a cigar
+    *NM = n_mm;
+    *ZC = parent ? n_conv_ct : n_conv_ga;		/* conversion counts */
+    *ZR = parent ? n_eq[1] : n_eq[2];       /* retention counts */
+    *bss_u = n_conv_ct == 0 && n_conv_ga == 0;
+  }
+  return 1;
+}
+
 /**
  * Generate cigar from rb and re
  *
@@ -290,10 +451,9 @@ ret_gen_cigar:
 uint32_t *bis_bwa_gen_cigar2(const int8_t mat[25], int o_del, int e_del, int o_ins, int e_ins, int w_, int64_t l_pac, const uint8_t *pac, int l_query, uint8_t *query, int64_t rb, int64_t re, int *score, int *n_cigar, int *NM, uint32_t *ZC, uint32_t *ZR, int *bss_u, uint8_t parent) {
 
   uint32_t *cigar = 0;
-  uint8_t tmp, *rseq;
-  int i;
+  uint8_t tmp, *rseq, *path = 0;
+  int i, n_path = 0;
   int64_t rlen;
-  kstring_t str;
   const char *int2base;
 
   if (n_cigar) *n_cigar = 0;
@@ -311,16 +471,9 @@ uint32_t *bis_bwa_gen_cigar2(const int8_t mat[25], int o_del, int e_del, int o_i
       tmp = rseq[i], rseq[i] = rseq[rlen - 1 - i], rseq[rlen - 1 - i] = tmp;
   }
 
-  if (l_query == re - rb && w_ == 0) { // no gap; no need to do DP
-    // UPDATE: we come to this block now... FIXME: due to an issue in mem_reg2aln(), we never come to this block. This does not affect accuracy, but it hurts performance.
-    if (n_cigar) {
-      cigar = malloc(4);
-      cigar[0] = l_query<<4 | 0;
-      *n_cigar = 1;
-    }
-    for (i = 0, *score = 0; i < l_query; ++i)
-      *score += mat[rseq[i]*5 + query[i]];
-
+  int2base = rb < l_pac? "ACGTN" : "TGCAN";
+  if (l_query == rlen && bis_ungapped(mat, o_del, e_del, o_ins, e_ins, l_query, query, rseq, int2base, parent, score, n_cigar, &cigar, NM, ZC, ZR, bss_u)) {
+    // no gap and no gapped alignment could do better; no need to do DP
   } else {
 
     int w, max_gap, max_ins, max_del, min_w;
@@ -340,80 +493,22 @@ uint32_t *bis_bwa_gen_cigar2(const int8_t mat[25], int o_del, int e_del, int o_i
       printf("* Global ref:   "); for (i = 0; i < rlen; ++i) putchar("ACGTN"[(int)rseq[i]]); putchar('\n');
       printf("* Global query: "); for (i = 0; i < l_query; ++i) putchar("ACGTN"[(int)query[i]]); putchar('\n');
     }
-    *score = ksw_global2(l_query, query, rlen, rseq, 5, mat, o_del, e_del, o_ins, e_ins, w, n_cigar, &cigar);
+    if (n_cigar) *score = ksw_global2_path(l_query, query, rlen, rseq, 5, mat, o_del, e_del, o_ins, e_ins, w, &n_path, &path);
+    else *score = ksw_global2(l_query, query, rlen, rseq, 5, mat, o_del, e_del, o_ins, e_ins, w, 0, 0);
 
+    /* CIGAR, NM, MD, ZC and ZR in one pass over the alignment */
+    if (n_cigar)
+      cigar = bis_path2cigar(n_path, path, query, rseq, int2base, parent, n_cigar, NM, ZC, ZR, bss_u);
+    free(path);
   }
 
-  /* loop over cigars and compute NM and MD*/
-  if (NM && n_cigar) {
-    /* n_mm: number of mismatches, 
-     * n_conv, n_ret: number of conversion and retention */
-     int k, x, y, u, n_mm = 0, n_gap = 0;
-     int n_conv_ct = 0, n_ret_c = 0;
-     int n_conv_ga = 0, n_ret_g = 0;
-    
-     str.l = str.m = *n_cigar * 4; str.s = (char*)cigar; // append MD to CIGAR
-     int2base = rb < l_pac? "ACGTN" : "TGCAN";
-     for (k = 0, x = y = u = 0; k < *n_cigar; ++k) {
-        int op, len;
-        cigar = (uint32_t*)str.s;
-        op  = cigar[k]&0xf, len = cigar[k]>>4;
-        if (op == 0) { // match
-           for (i = 0; i < len; ++i) {
-
-              /* to allow assymmetric CT and GA */
-              unsigned char _q = query[x+i];
-              unsigned char _r = rseq[y+i];
-              if (_q == _r) {
-                 if (_q == 1) ++n_ret_c;
-                 if (_q == 2) ++n_ret_g;
-                 ++u;
-              } else if (_q == 3 && _r == 1) {
-                 ++n_conv_ct; ++u;
-              } else if (!parent && _q == 0 && _r == 2) {
-                 ++n_conv_ga; ++u;
-              } else {
-                 kputw(u, &str);
-                 kputc(int2base[_r], &str);
-                 ++n_mm; u = 0;
-              }
-
-              /* if (query[x + i] != rseq[y + i]) { */
-              /* 	kputw(u, &str); */
-              /* 	kputc(int2base[rseq[y+i]], &str); */
-              /* 	++n_mm; u = 0; */
-              /* } else ++u; */
-           }
-           x += len; y += len;
-        } else if (op == 2) { // deletion
-           if (k > 0 && k < *n_cigar - 1) { // don't do the following if D is the first or the last CIGAR
-              kputw(u, &str); kputc('^', &str);
-              for (i = 0; i < len; ++i)
-                 kputc(int2base[rseq[y+i]], &str);
-              u = 0; n_gap += len;
-           }
-           y += len;
-        } else if (op == 1) {	// insertion does not contribute to MD
-           x += len, n_gap += len;
-        }
-    }
-    kputw(u, &str); kputc(0, &str);
-    /* NM contains both gap and mismatches, and every base in a gap counts */
-    *NM = n_mm + n_gap;
-    *ZC = parent ? n_conv_ct : n_conv_ga;		/* conversion counts */
-    *ZR = parent ? n_ret_c : n_ret_g;       /* retention counts */
-    if (n_conv_ct == 0 && n_conv_ga == 0) *bss_u = 1;
-    else *bss_u = 0;
-    cigar = (uint32_t*)str.s;
-  } // compute NM and MD
-
   /* reverse back query */
   if (rb >= l_pac)
     for (i = 0; i < l_query>>1; ++i)
       tmp = query[i], query[i] = query[l_query - 1 - i], query[l_query - 1 - i] = tmp;
 
 ret_gen_cigar:
-  free(rseq);
+  arena_free(rseq);
   return cigar;
 }
 
@@ -496,11 +591,15 @@ void bwa_idx_load_bwt(const char *hint, uint8_t parent, bwt_t *bwt)
     bwt_restore_bwt2(tmp, bwt);
     strcat(strcpy(tmp, prefix), ".par.sa");  // partial suffix array (SA)
     bwt_restore_sa(tmp, bwt);
+    strcat(strcpy(tmp, prefix), ".par.kmer"); // optional k-mer table
+    bwt_restore_kmer(tmp, bwt);
   } else {
     strcat(strcpy(tmp, prefix), ".dau.bwt"); // FM-index
     bwt_restore_bwt2(tmp, bwt);
     strcat(strcpy(tmp, prefix), ".dau.sa");  // partial suffix array (SA)
     bwt_restore_sa(tmp, bwt);
+    strcat(strcpy(tmp, prefix), ".dau.kmer"); // optional k-mer table
+    bwt_restore_kmer(tmp, bwt);
   }
   bwt->parent = parent;
 
@@ -533,7 +632,7 @@ bwaidx_t *bwa_idx_load_from_disk(const char *hint, int which) {
     if (bwa_verbose >= 3)
       fprintf(stderr, "[M::%s] read %d ALT contigs\n", __func__, c);
     if (which & BWA_IDX_PAC) {
-      idx->pac = calloc(idx->bns->l_pac/4+1, 1);
+      idx->pac = huge_malloc(idx->bns->l_pac/4+1);
       err_fread_noeof(idx->pac, 1, idx->bns->l_pac/4+1, idx->bns->fp_pac); // concatenated 2-bit encoded sequence
       err_fclose(idx->bns->fp_pac);
       idx->bns->fp_pac = 0;
@@ -543,15 +642,41 @@ bwaidx_t *bwa_idx_load_from_disk(const char *hint, int which) {
   return idx;
 }
 
+/**
+ * load the index, preferring the single-file container <hint>.bis.idx
+ * (see bwammap.c) when all components are requested
+ */
 bwaidx_t *bwa_idx_load(const char *hint, int which) {
-  return bwa_idx_load_from_disk(hint, which);
+  bwaidx_t *idx = 0;
+  if ((which & BWA_IDX_ALL) == BWA_IDX_ALL)
+    idx = bwa_idx_load_from_mmap(hint, which);
+  return idx? idx : bwa_idx_load_from_disk(hint, which);
+}
+
+/**
+ * Log how much of the index is backed by huge pages. Pages of a mapped
+ * container that were not touched yet (no -Z) are not counted.
+ */
+void bwa_idx_report_huge(const bwaidx_t *idx) {
+  int64_t l = idx->l_mem, h = huge_page_bytes();
+  int j;
+  if (idx->mem == 0) {
+    for (j = 0, l = 0; j < 2; ++j)
+      l += idx->bwt[j].bwt_size * 4 + (bwt_sa_words(idx->bwt+j) + bwt_kmer_len(idx->bwt+j)) * sizeof(bwtint_t);
+    if (idx->pac) l += idx->bns->l_pac/4+1;
+  }
+  if (h < 0)
+    fprintf(stderr, "[M::%s] huge page usage of the index is unknown\n", __func__);
+  else
+    fprintf(stderr, "[M::%s] %.1f of %.1f MB of the index on huge pages (transparent huge pages: %s)\n", __func__,
+            (h < l? h : l) / 1048576., l / 1048576., huge_page_mode(idx->is_shm));
 }
 
 void bwa_idx_destroy(bwaidx_t *idx) {
   if (idx == 0) return;
   if (idx->mem == 0) {
-    free(idx->bwt[0].sa); free(idx->bwt[0].bwt);
-    free(idx->bwt[1].sa); free(idx->bwt[1].bwt);
+    free(idx->bwt[0].sa); free(idx->bwt[0].bwt); free(idx->bwt[0].kmer);
+    free(idx->bwt[1].sa); free(idx->bwt[1].bwt); free(idx->bwt[1].kmer);
     /* if (idx->bwt_par) bwt_destroy(idx->bwt_par); */
     /* if (idx->bwt_dau) bwt_destroy(idx->bwt_dau); */
     if (idx->bns) bns_destroy(idx->bns);
@@ -559,81 +684,144 @@ void bwa_idx_destroy(bwaidx_t *idx) {
   } else {
     /* free(idx->bwt_par); free(idx->bwt_dau); */
     free(idx->bns->anns); free(idx->bns);
-    if (!idx->is_shm) free(idx->mem);
+    if (idx->is_mmap) munmap(idx->mem, idx->l_mem);
+    else if (!idx->is_shm) free(idx->mem);
   }
   free(idx);
 }
 
+/* keep every section of the flat index image 8-byte aligned so that
+ * bwtint_t arrays can be accessed in place from shared memory */
+#define BWA_MEM_ALIGN(x) (((x) + 7) & ~(int64_t)7)
+
+/**
+ * Point idx at a flat index image produced by bwa_idx2mem()
+ * Layout: bwt_t[0], bwt[0].bwt, bwt[0].sa, bwt[0].kmer, bwt_t[1], bwt[1].bwt,
+ *         bwt[1].sa, bwt[1].kmer, bntseq_t, ambs, anns, names/annos, pac
+ * bwt, sa and kmer arrays and pac are used in place; bns and anns are copied.
+ */
 int bwa_mem2idx(int64_t l_mem, uint8_t *mem, bwaidx_t *idx) {
 
   int64_t k = 0, x;
-  int i;
-
-  // generate idx->bwt
-  /* biscuit shared memory might not work */
-  x = sizeof(bwt_t); memcpy(idx->bwt, mem + k, x); k += x;
-  x = idx->bwt[0].bwt_size * 4; idx->bwt[0].bwt = (uint32_t*)(mem + k); k += x;
-  x = idx->bwt[0].n_sa * sizeof(bwtint_t); idx->bwt[0].sa = (bwtint_t*)(mem + k); k += x;
-  x = sizeof(bwt_t); memcpy(idx->bwt, mem + k, x); k += x;
-  x = idx->bwt[1].bwt_size * 4; idx->bwt[1].bwt = (uint32_t*)(mem + k); k += x;
-  x = idx->bwt[1].n_sa * sizeof(bwtint_t); idx->bwt[1].sa = (bwtint_t*)(mem + k); k += x;
+  int i, j;
+
+  // generate idx->bwt[0] (daughter) and idx->bwt[1] (parent)
+  for (j = 0; j < 2; ++j) {
+    x = sizeof(bwt_t); memcpy(idx->bwt+j, mem + k, x); k += BWA_MEM_ALIGN(x);
+    bwt_set_layout(idx->bwt+j);
+    x = idx->bwt[j].bwt_size * 4; idx->bwt[j].bwt = (uint32_t*)(mem + k); k += BWA_MEM_ALIGN(x);
+    x = bwt_sa_words(idx->bwt+j) * sizeof(bwtint_t); idx->bwt[j].sa = (bwtint_t*)(mem + k); k += BWA_MEM_ALIGN(x);
+    x = bwt_kmer_len(idx->bwt+j) * sizeof(bwtint_t); idx->bwt[j].kmer = x? (bwtint_t*)(mem + k) : 0; k += x;
+  }
 
   // generate idx->bns and idx->pac
-  x = sizeof(bntseq_t); idx->bns = malloc(x); memcpy(idx->bns, mem + k, x); k += x;
-  x = idx->bns->n_holes * sizeof(bntamb1_t); idx->bns->ambs = (bntamb1_t*)(mem + k); k += x;
-  x = idx->bns->n_seqs  * sizeof(bntann1_t); idx->bns->anns = malloc(x); memcpy(idx->bns->anns, mem + k, x); k += x;
+  x = sizeof(bntseq_t); idx->bns = malloc(x); memcpy(idx->bns, mem + k, x); k += BWA_MEM_ALIGN(x);
+  x = idx->bns->n_holes * sizeof(bntamb1_t); idx->bns->ambs = (bntamb1_t*)(mem + k); k += BWA_MEM_ALIGN(x);
+  x = idx->bns->n_seqs  * sizeof(bntann1_t); idx->bns->anns = malloc(x); memcpy(idx->bns->anns, mem + k, x); k += BWA_MEM_ALIGN(x);
   for (i = 0; i < idx->bns->n_seqs; ++i) {
     idx->bns->anns[i].name = (char*)(mem + k); k += strlen(idx->bns->anns[i].name) + 1;
     idx->bns->anns[i].anno = (char*)(mem + k); k += strlen(idx->bns->anns[i].anno) + 1;
   }
+  k = BWA_MEM_ALIGN(k);
+  idx->bns->fp_pac = 0;
   idx->pac = (uint8_t*)(mem + k); k += idx->bns->l_pac/4+1;
-  assert(k == l_mem);
-  
+  xassert(k == l_mem, "Corrupted index image in memory.");
+
   idx->l_mem = k; idx->mem = mem;
   return 0;
 }
 
-int bwa_idx2mem(bwaidx_t *idx) {
-  int i;
-  int64_t k, x, tmp;
-  uint8_t *mem;
-
-  /* TODO: not quite sure how this should adapt for biscuit */
-  // copy idx->bwt
-  x = idx->bwt->bwt_size * 4;
-  mem = realloc(idx->bwt->bwt, sizeof(bwt_t) + x); idx->bwt->bwt = 0;
-  memmove(mem + sizeof(bwt_t), mem, x);
-  memcpy(mem, idx->bwt, sizeof(bwt_t)); k = sizeof(bwt_t) + x;
-  x = idx->bwt->n_sa * sizeof(bwtint_t); mem = realloc(mem, k + x); memcpy(mem + k, idx->bwt->sa, x); k += x;
-  free(idx->bwt->sa);
-  /* free(idx->bwt); idx->bwt = 0; */
+/* size of the flat image of a loaded index, see bwa_mem2idx() */
+int64_t bwa_idx_mem_len(const bwaidx_t *idx) {
+  int i, j;
+  int64_t x, l_mem;
+  for (j = 0, l_mem = 0; j < 2; ++j) {
+    l_mem += BWA_MEM_ALIGN(sizeof(bwt_t));
+    l_mem += BWA_MEM_ALIGN(idx->bwt[j].bwt_size * 4);
+    l_mem += BWA_MEM_ALIGN(bwt_sa_words(idx->bwt+j) * sizeof(bwtint_t));
+    l_mem += bwt_kmer_len(idx->bwt+j) * sizeof(bwtint_t);
+  }
+  l_mem += BWA_MEM_ALIGN(sizeof(bntseq_t));
+  l_mem += BWA_MEM_ALIGN(idx->bns->n_holes * sizeof(bntamb1_t));
+  l_mem += BWA_MEM_ALIGN(idx->bns->n_seqs * sizeof(bntann1_t));
+  for (i = 0, x = 0; i < idx->bns->n_seqs; ++i)
+    x += strlen(idx->bns->anns[i].name) + strlen(idx->bns->anns[i].anno) + 2;
+  l_mem += BWA_MEM_ALIGN(x);
+  l_mem += idx->bns->l_pac/4+1;
+  return l_mem;
+}
+
+/* copy x bytes to mem + *k and zero the padding up to the next section */
+static inline void mem_put(uint8_t *mem, int64_t *k, const void *src, int64_t x, int align) {
+  if (x) memcpy(mem + *k, src, x);
+  *k += x;
+  if (align) {
+    memset(mem + *k, 0, BWA_MEM_ALIGN(*k) - *k);
+    *k = BWA_MEM_ALIGN(*k);
+  }
+}
+
+/**
+ * Move a loaded index into mem, a block of bwa_idx_mem_len() bytes. Every
+ * heap copy is freed as soon as it is moved and mem is written in order,
+ * so pages of mem not yet reached need not be resident: the peak is about
+ * one index plus its largest section, not two indexes.
+ */
+int bwa_idx2mem_at(bwaidx_t *idx, int64_t l_mem, uint8_t *mem) {
+  int i, j;
+  int64_t k = 0;
+
+  // copy idx->bwt[0] and idx->bwt[1]
+  for (j = 0; j < 2; ++j) {
+    bwt_t *bwt = idx->bwt+j;
+    mem_put(mem, &k, bwt, sizeof(bwt_t), 1);
+    mem_put(mem, &k, bwt->bwt, bwt->bwt_size * 4, 1);
+    free(bwt->bwt); bwt->bwt = 0;
+    mem_put(mem, &k, bwt->sa, bwt_sa_words(bwt) * sizeof(bwtint_t), 1);
+    free(bwt->sa); bwt->sa = 0;
+    mem_put(mem, &k, bwt->kmer, bwt_kmer_len(bwt) * sizeof(bwtint_t), 0);
+    free(bwt->kmer); bwt->kmer = 0;
+  }
 
   // copy idx->bns
-  tmp = idx->bns->n_seqs * sizeof(bntann1_t) + idx->bns->n_holes * sizeof(bntamb1_t);
-  for (i = 0; i < idx->bns->n_seqs; ++i) // compute the size of heap-allocated memory
-    tmp += strlen(idx->bns->anns[i].name) + strlen(idx->bns->anns[i].anno) + 2;
-  mem = realloc(mem, k + sizeof(bntseq_t) + tmp);
-  x = sizeof(bntseq_t); memcpy(mem + k, idx->bns, x); k += x;
-  x = idx->bns->n_holes * sizeof(bntamb1_t); memcpy(mem + k, idx->bns->ambs, x); k += x;
+  mem_put(mem, &k, idx->bns, sizeof(bntseq_t), 1);
+  mem_put(mem, &k, idx->bns->ambs, idx->bns->n_holes * sizeof(bntamb1_t), 1);
   free(idx->bns->ambs);
-  x = idx->bns->n_seqs * sizeof(bntann1_t); memcpy(mem + k, idx->bns->anns, x); k += x;
+  mem_put(mem, &k, idx->bns->anns, idx->bns->n_seqs * sizeof(bntann1_t), 1);
   for (i = 0; i < idx->bns->n_seqs; ++i) {
-    x = strlen(idx->bns->anns[i].name) + 1; memcpy(mem + k, idx->bns->anns[i].name, x); k += x;
-    x = strlen(idx->bns->anns[i].anno) + 1; memcpy(mem + k, idx->bns->anns[i].anno, x); k += x;
+    mem_put(mem, &k, idx->bns->anns[i].name, strlen(idx->bns->anns[i].name) + 1, 0);
+    mem_put(mem, &k, idx->bns->anns[i].anno, strlen(idx->bns->anns[i].anno) + 1, 0);
     free(idx->bns->anns[i].name); free(idx->bns->anns[i].anno);
   }
+  mem_put(mem, &k, 0, 0, 1);
   free(idx->bns->anns);
 
   // copy idx->pac
-  x = idx->bns->l_pac/4+1;
-  mem = realloc(mem, k + x);
-  memcpy(mem + k, idx->pac, x); k += x;
+  mem_put(mem, &k, idx->pac, idx->bns->l_pac/4+1, 0);
+  if (idx->bns->fp_pac) err_fclose(idx->bns->fp_pac);
   free(idx->bns); idx->bns = 0;
   free(idx->pac); idx->pac = 0;
+  xassert(k == l_mem, "Index image size mismatch.");
 
   return bwa_mem2idx(k, mem, idx);
 }
 
+/**
+ * Serialize both strands of the FM-index, bns and pac into one
+ * contiguous block (idx->mem). The heap copies are freed along the way,
+ * after which idx points into the new block.
+ */
+int bwa_idx2mem(bwaidx_t *idx) {
+  int64_t l_mem = bwa_idx_mem_len(idx);
+  uint8_t *mem = huge_malloc(l_mem);
+  if (mem == 0) {
+    if (bwa_verbose >= 1)
+      fprintf(stderr, "[E::%s] fail to allocate %ld bytes for the index image\n", __func__, (long) l_mem);
+    return -1;
+  }
+  return bwa_idx2mem_at(idx, l_mem, mem);
+}
+
 /***********************
  * SAM header routines *
  ***********************/
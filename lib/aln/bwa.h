@@ -36,6 +36,7 @@
 #define BWA_IDX_BNS 0x2
 #define BWA_IDX_PAC 0x4
 #define BWA_IDX_ALL 0x7
+#define BWA_IDX_PREFAULT 0x8 // prefault the <prefix>.bis.idx mapping, if used
 
 #define BWA_CTL_SIZE 0x10000
 
@@ -45,10 +46,25 @@ typedef struct {
   uint8_t  *pac; // the actual 2-bit encoded reference sequences with 'N' converted to a random base
 
   int    is_shm;
+  int    is_mmap; // mem is an mmap()ed block (the <prefix>.bis.idx mapping or a NUMA image), freed with munmap()
   int64_t l_mem;
   uint8_t  *mem;
 } bwaidx_t;
 
+/* NUMA placement of the index (bwanuma.c) */
+#define BWA_NUMA_INTERLEAVE 1
+#define BWA_NUMA_REPLICATE  2
+typedef struct bwa_numa_s bwa_numa_t;
+
+/* add-on index of spike-in or decoy contigs (bwaaddon.c); its contigs
+ * follow those of the main index in bns and pac */
+typedef struct {
+  bwaidx_t *idx;  // the add-on index as loaded
+  bntseq_t *bns;  // contigs of the main index, then of the add-on
+  uint8_t  *pac;  // forward sequence of both
+  int64_t  off;   // l_pac of the main index, where the add-on starts
+} bwa_addon_t;
+
 typedef struct {
    int l_seq, id;                /* check if l_seq can be unsigned? */
    char *name, *comment, *qual, *sam; /* sam stored the end output of sam record */
@@ -88,11 +104,32 @@ extern "C" {
 
   bwaidx_t *bwa_idx_load_from_shm(const char *hint);
   bwaidx_t *bwa_idx_load_from_disk(const char *hint, int which);
+  bwaidx_t *bwa_idx_load_from_mmap(const char *hint, int which);
+  char *bwa_idx_mmap_fn(const char *hint);
+  int bwa_idx_dump_mmap(const char *fn, const bwaidx_t *idx);
   bwaidx_t *bwa_idx_load(const char *hint, int which);
   void bwa_idx_destroy(bwaidx_t *idx);
+  void bwa_idx_report_huge(const bwaidx_t *idx);
   int bwa_idx2mem(bwaidx_t *idx);
+  int64_t bwa_idx_mem_len(const bwaidx_t *idx);
+  int bwa_idx2mem_at(bwaidx_t *idx, int64_t l_mem, uint8_t *mem);
   int bwa_mem2idx(int64_t l_mem, uint8_t *mem, bwaidx_t *idx);
 
+  /* shared memory staging of both strands, bns and pac (bwashm.c) */
+  int bwa_shm_stage(bwaidx_t *idx, const char *hint, const char *tmpfn);
+  int bwa_shm_test(const char *hint);
+  int bwa_shm_list(void);
+  int bwa_shm_destroy(void);
+
+  bwa_numa_t *bwa_numa_init(bwaidx_t *idx, int mode);
+  const bwaidx_t *bwa_numa_local(const bwa_numa_t *nm, int tid);
+  void bwa_numa_add_pac(bwa_numa_t *nm, uint8_t *pac, int64_t l);
+  const uint8_t *bwa_numa_local_pac(const bwa_numa_t *nm, int tid);
+  void bwa_numa_destroy(bwa_numa_t *nm);
+
+  bwa_addon_t *bwa_addon_init(const bwaidx_t *idx, const char *hint);
+  void bwa_addon_destroy(bwa_addon_t *ad);
+
   void bwa_print_sam_hdr(const bntseq_t *bns, const char *hdr_line);
   char *bwa_set_rg(const char *s);
   char *bwa_insert_header(const char *s, char *hdr);
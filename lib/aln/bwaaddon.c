@@ -0,0 +1,123 @@
+/* Add-on index of spike-in or decoy contigs aligned against together with
+ * the main index
+ *
+ * Copyright (c) 2023 Jacob.Morrison@vai.org
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The add-on is an ordinary index ('biscuit index lambda.fa'). At load
+ * time its contigs are appended to those of the main index, giving the
+ * reference
+ *
+ *   [main forward][add-on forward][add-on reverse][main reverse]
+ *
+ * of l_pac = l_main + l_addon. The text of an add-on strand is a contiguous
+ * piece of it, so an add-on SA value x is x + l_main, while a main SA value
+ * y on the reverse half moves up by 2 * l_addon (see mem_chain()). Chaining,
+ * extension, pairing and SAM output only ever see the merged bns and pac.
+ * The merged pac is a copy, l_pac/4 bytes; under NUMA placement it is
+ * placed by bwa_numa_add_pac(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bwa.h"
+#include "utils.h"
+
+#ifdef USE_MALLOC_WRAPPERS
+#  include "malloc_wrap.h"
+#endif
+
+#define _set_pac(pac, l, c) ((pac)[(l)>>2] |= (c)<<((~(l)&3)<<1))
+#define _get_pac(pac, l) ((pac)[(l)>>2]>>((~(l)&3)<<1)&3)
+
+/**
+ * Load the add-on index and merge its contigs after those of idx
+ * @param idx   main index, with its ALT marks already set and placed by
+ *              bwa_numa_init() if at all: the names are shared, not copied
+ * @param hint  prefix of the add-on index
+ * @return      0 if the add-on cannot be loaded or shares a contig name
+ *              with the main index
+ */
+bwa_addon_t *bwa_addon_init(const bwaidx_t *idx, const char *hint) {
+  bwa_addon_t *ad;
+  const bntseq_t *m, *a;
+  bntseq_t *bns;
+  int64_t l;
+  int i, j;
+
+  ad = calloc(1, sizeof(bwa_addon_t));
+  if ((ad->idx = bwa_idx_load(hint, BWA_IDX_ALL)) == 0) {
+    free(ad);
+    return 0;
+  }
+  m = idx->bns; a = ad->idx->bns;
+  for (i = 0; i < a->n_seqs; ++i)
+    for (j = 0; j < m->n_seqs; ++j)
+      if (strcmp(a->anns[i].name, m->anns[j].name) == 0) {
+        if (bwa_verbose >= 1)
+          fprintf(stderr, "[E::%s] contig '%s' is in both the main and the add-on index\n", __func__, a->anns[i].name);
+        bwa_addon_destroy(ad);
+        return 0;
+      }
+  ad->off = m->l_pac;
+
+  // contigs and holes of the add-on follow those of the main index
+  ad->bns = bns = calloc(1, sizeof(bntseq_t));
+  *bns = *m;
+  bns->fp_pac = 0;
+  bns->l_pac = m->l_pac + a->l_pac;
+  bns->n_seqs = m->n_seqs + a->n_seqs;
+  bns->anns = malloc(bns->n_seqs * sizeof(bntann1_t)); // names are shared with the two indices
+  memcpy(bns->anns, m->anns, m->n_seqs * sizeof(bntann1_t));
+  memcpy(bns->anns + m->n_seqs, a->anns, a->n_seqs * sizeof(bntann1_t));
+  for (i = m->n_seqs; i < bns->n_seqs; ++i) bns->anns[i].offset += ad->off;
+  bns->n_holes = m->n_holes + a->n_holes;
+  bns->ambs = malloc((bns->n_holes + 1) * sizeof(bntamb1_t));
+  memcpy(bns->ambs, m->ambs, m->n_holes * sizeof(bntamb1_t));
+  memcpy(bns->ambs + m->n_holes, a->ambs, a->n_holes * sizeof(bntamb1_t));
+  for (i = m->n_holes; i < bns->n_holes; ++i) bns->ambs[i].offset += ad->off;
+
+  ad->pac = huge_malloc(bns->l_pac/4+1);
+  memset(ad->pac, 0, bns->l_pac/4+1);
+  memcpy(ad->pac, idx->pac, m->l_pac>>2);
+  for (l = m->l_pac & ~3LL; l < m->l_pac; ++l) _set_pac(ad->pac, l, _get_pac(idx->pac, l));
+  for (l = 0; l < a->l_pac; ++l) _set_pac(ad->pac, ad->off + l, _get_pac(ad->idx->pac, l));
+
+  if (bwa_verbose >= 3)
+    fprintf(stderr, "[M::%s] add %d contig(s) (%ld bp) of %s after the %d of the main index\n",
+            __func__, a->n_seqs, (long)a->l_pac, hint, m->n_seqs);
+  return ad;
+}
+
+void bwa_addon_destroy(bwa_addon_t *ad) {
+  if (ad == 0) return;
+  if (ad->bns) {
+    free(ad->bns->anns); free(ad->bns->ambs);
+    free(ad->bns);
+  }
+  free(ad->pac);
+  bwa_idx_destroy(ad->idx);
+  free(ad);
+}
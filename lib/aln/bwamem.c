@@ -42,6 +42,7 @@
 #include "ksw.h"
 #include "kvec.h"
 #include "ksort.h"
+#include "khash.h"
 #include "utils.h"
 
 #ifdef USE_MALLOC_WRAPPERS
@@ -110,6 +111,7 @@ mem_opt_t *mem_opt_init() {
    o->mapQ_coef_len = 50; o->mapQ_coef_fac = log(o->mapQ_coef_len);
    o->bsstrand = 0;
    o->parent = 0;
+   o->prune = -1;
    bwa_fill_scmat(o->a, o->b, o->mat);
    /* WZBS */
    bwa_fill_scmat_ct(o->a, o->b, o->ctmat);
@@ -158,13 +160,13 @@ void bseq_bsconvert(bseq1_t *s, uint8_t parent) {
 
   uint32_t i;
   if (parent) {                 // C>T strand
-    s->bisseq[1] = calloc(s->l_seq, sizeof(uint8_t));
+    s->bisseq[1] = arena_malloc(s->l_seq);
     for (i=0; i< (unsigned) s->l_seq; ++i) {
       if (s->seq[i] == 1) s->bisseq[1][i] = 3;
       else s->bisseq[1][i] = s->seq[i];
     }
   } else {                      // G>A strand
-    s->bisseq[0] = calloc(s->l_seq, sizeof(uint8_t));
+    s->bisseq[0] = arena_malloc(s->l_seq);
     for (i=0; i< (unsigned) s->l_seq; ++i) {
       if (s->seq[i] == 2) s->bisseq[0][i] = 0;
       else s->bisseq[0][i] = s->seq[i];
@@ -172,13 +174,27 @@ void bseq_bsconvert(bseq1_t *s, uint8_t parent) {
   }
 }
 
+/* merge the chains of b into a, both sorted by position as mem_chain()
+ * returns them */
+static void mem_chain_merge(mem_chain_v *a, mem_chain_v *b) {
+   mem_chain_v c;
+   size_t i = 0, j = 0;
+   c.n = c.m = a->n + b->n;
+   c.a = arena_malloc(c.m * sizeof(mem_chain_t));
+   for (c.n = 0; i < a->n || j < b->n; ++c.n)
+      c.a[c.n] = j == b->n || (i < a->n && a->a[i].pos <= b->a[j].pos)? a->a[i++] : b->a[j++];
+   arena_free(b->a); arena_free(a->a);
+   *a = c;
+}
+
 /**
  * @param bseq - read sequence
- * @return mem_alnreg_v* regs */
-static void mem_align1_core(
-   const mem_opt_t *opt, const bwt_t *bwt, const bntseq_t *bns,
-   const uint8_t *pac, bseq1_t *bseq, void *buf, mem_alnreg_v *regs,
-   uint8_t parent) {
+ * @param hash - k-mer hash seeded from instead of bwt, or NULL
+ * @param addon - add-on index seeded after bwt, or NULL
+ * @return filtered chains, extended by mem_chain2region */
+static mem_chain_v mem_chain1_core(
+   const mem_opt_t *opt, const bwt_t *bwt, const mem_hash_t *hash, const bwa_addon_t *addon, const bntseq_t *bns,
+   const uint8_t *pac, bseq1_t *bseq, void *buf, uint8_t parent) {
 
    if (bwa_verbose >= 4) 
       printf("[%s] === Seeding %s against (parent: %u)\n", __func__, bseq->name, parent);
@@ -190,16 +206,17 @@ static void mem_align1_core(
    /* 	seq[i] = seq[i] < 4? seq[i] : nst_nt4_table[(int)seq[i]]; */
 
    /* use both bisseq and unconverted sequence here */
-   mem_chain_v chns = mem_chain(opt, bwt, bns, bseq, buf, parent);
+   mem_chain_v chns = mem_chain(opt, bwt, hash, bns, bseq, buf, parent, 0);
+   if (addon) { /* filtered together, as if the add-on were part of the main index */
+      mem_chain_v achns = mem_chain(opt, addon->idx->bwt, 0, bns, bseq, buf, parent, addon->off);
+      mem_chain_merge(&chns, &achns);
+   }
    /* filter whole chains */
    mem_chain_flt(opt, &chns);
    /* filter seeds in the chain by seed score */
    /* this is not so important for short reads */
    mem_flt_chained_seeds(opt, bns, pac, bseq, &chns, parent);
-
-   // make sure different bisulfite strand does not interfere
-   mem_chain2region(opt, bns, pac, bseq, parent, &chns, regs);
-   free_mem_chain_v(chns);
+   return chns;
 }
 
 static void check_paired_read_names(const char *name1, const char *name2) {
@@ -217,11 +234,70 @@ typedef struct {
   const uint8_t *pac;
   mem_pestat_t pes;
   bwtintv_cache_t **intv_cache;
+  mem_chain_v *chns;      // chains of each read and strand, one per intv_cache
+  mem_ext_v *ext;         // and their extensions by mem_chain_ext_batch
+  arena_t **arena;        // per-thread temporaries of a batch (worker1) or a read (worker2)
+  bns_cache_t **refc;     // per-thread decoded reference windows
+  int64_t *n_pruned;      // per-thread reads not aligned to their unlikely strand, see mem_opt_t::prune
+  int *dup;               // earlier unit with the same clipped sequences, or -1; see bis_dedup
+  int *dup_next;          // next unit with the same clipped sequences as the first, or -1
+  uint64_t *uhash;        // hash of the clipped sequences of each unit, for bis_dedup
   bseq1_t *seqs;
   mem_alnreg_v *regs;
   int64_t n_processed;
+  int n_units;   // number of reads (SE) or pairs (PE)
+  const bwa_numa_t *numa;
+  const bwa_addon_t *addon;
+  const mem_hash_t *hash;
 } worker_t;
 
+/* with NUMA placement, the copy of the worker pointing to the index of the
+ * node that thread tid runs on */
+static inline worker_t *worker_local(worker_t *w, int tid, worker_t *lw) {
+  const bwaidx_t *idx;
+  if (w->numa == 0) return w;
+  idx = bwa_numa_local(w->numa, tid);
+  *lw = *w; lw->bwt = idx->bwt;
+  lw->pac = w->addon? bwa_numa_local_pac(w->numa, tid) : idx->pac;
+  return lw;
+}
+
+/* reads (SE) or pairs (PE) seeded together by bis_worker1, each of them owns
+ * 2 (SE) or 4 (PE) bwtintv_cache_t, mem_chain_v and mem_ext_v, one per read
+ * and strand */
+#define MEM_SEED_BATCH 32
+#define MEM_SEED_CACHES (MEM_SEED_BATCH * 4)
+
+struct mem_seedbuf_s {
+  int n_threads;
+  bwtintv_cache_t **intv_cache; // thread t uses intv_cache[t*MEM_SEED_CACHES...] only
+  mem_chain_v *chns;            // likewise
+  mem_ext_v *ext;
+};
+
+mem_seedbuf_t *mem_seedbuf_init(int n_threads) {
+  int i;
+  mem_seedbuf_t *b = calloc(1, sizeof(mem_seedbuf_t));
+  b->n_threads = n_threads;
+  b->intv_cache = malloc(n_threads * MEM_SEED_CACHES * sizeof(bwtintv_cache_t*));
+  for (i = 0; i < n_threads * MEM_SEED_CACHES; ++i)
+    b->intv_cache[i] = bwtintv_cache_init();
+  b->chns = calloc(n_threads * MEM_SEED_CACHES, sizeof(mem_chain_v));
+  b->ext = calloc(n_threads * MEM_SEED_CACHES, sizeof(mem_ext_v));
+  return b;
+}
+
+void mem_seedbuf_destroy(mem_seedbuf_t *b) {
+  int i;
+  if (b == 0) return;
+  for (i = 0; i < b->n_threads * MEM_SEED_CACHES; ++i) {
+    bwtintv_cache_destroy(b->intv_cache[i]);
+    free(b->ext[i].a);
+  }
+  free(b->intv_cache); free(b->chns); free(b->ext);
+  free(b);
+}
+
 /*
  * The memmem() function finds the start of the first occurrence of the
  * substring 'needle' of length 'nlen' in the memory area 'haystack' of
@@ -298,75 +374,310 @@ static void read_clipping(bseq1_t *seq, uint8_t *adaptor, int l_adaptor, const m
 }
 
 /***** bisulfite adaptation *****/
+
+/* strands read j of a unit (0 for SE and read 1, 1 for read 2) is aligned
+ * to, bit p for parent p; see mem_opt_t::parent */
+static int bis_strands(const mem_opt_t *opt, int j) {
+   if (!(opt->flag&MEM_F_PE)) {	// SE
+      if (!(opt->parent&1)) return 3;	// no restriction
+      return opt->parent>>1? 1 : 2;	// to daughter or to parent
+   }
+   if (opt->parent) return j? 1 : 2;	// read 1 to parent, read 2 to daughter
+   return 3;
+}
+
+/* the strand whose regions of read j come first */
+#define bis_first(opt, j) ((opt)->flag&MEM_F_PE && (j) == 0)
+
 /**
- * @param i i-th read is under consideration
- * @param tid thread id
- * @return w->regs[i] mem_alnreg_v*
+ * For opt->prune, the strand read j of the i-th unit more likely comes
+ * from: the parent strand if bisulfite conversion depleted the read of C,
+ * the daughter if of G; the two reads of a pair come from opposite strands.
+ * @param strands (out) one strand per read of the unit
+ * @return whether the C/G imbalance is large enough to prune on
  */
-static void bis_worker1(void *data, int i, int tid) {
-   
-   worker_t *w = (worker_t*)data;
-   mem_alnreg_v *regs; const mem_opt_t *opt=w->opt;
+static int bis_likely_strands(worker_t *w, int i, uint8_t *strands) {
+   int n = (w->opt->flag&MEM_F_PE)? 2 : 1;
+   int j, k, cnt[2] = {0, 0}; // C and G of read 1 plus G and C of read 2
+   for (j = 0; j < n; ++j) {
+      const bseq1_t *s = &w->seqs[i * n + j];
+      for (k = 0; k < s->l_seq; ++k)
+         if (s->seq[k] == 1 || s->seq[k] == 2) ++cnt[(s->seq[k] == 2) ^ j];
+   }
+   strands[0] = cnt[0] <= cnt[1]? 2 : 1;
+   if (n == 2) strands[1] = 3 ^ strands[0];
+   return (cnt[0] < cnt[1]? cnt[0] : cnt[1]) * 4 < (cnt[0] > cnt[1]? cnt[0] : cnt[1]);
+}
 
-   if (!(opt->flag&MEM_F_PE)) {	// SE
+/* whether the regions of s against its likely strand leave nothing for the
+ * other strand to beat: one full-length hit within opt->prune of a perfect
+ * score and no other hit within a mismatch of it */
+static int bis_prune(const mem_opt_t *opt, const bseq1_t *s, const mem_alnreg_v *regs) {
+   const mem_alnreg_t *b = 0;
+   unsigned u;
+   for (u = 0; u < regs->n; ++u)
+      if (b == 0 || regs->a[u].score > b->score) b = &regs->a[u];
+   if (b == 0 || b->qb != 0 || b->qe != s->l_seq || b->score < s->l_seq * opt->a - opt->prune)
+      return 0;
+   for (u = 0; u < regs->n; ++u) {
+      const mem_alnreg_t *r = &regs->a[u];
+      if (r == b || (r->rid == b->rid && r->rb < b->re && b->rb < r->re)) continue; // the same hit
+      if (r->score >= b->score - (opt->a + opt->b)) return 0;
+   }
+   return 1;
+}
 
+/* regions of one read against one strand from its chains of bis_chain_batch;
+ * different bisulfite strands do not interfere, so those of the strand that
+ * comes first are moved in front of any added before */
+static void bis_chain2region(worker_t *w, bseq1_t *bseq, mem_chain_v *chns, const mem_ext_v *ext, mem_alnreg_v *regs, uint8_t parent, int first) {
+   arena_mark_t m = arena_mark();
+   size_t n0 = regs->n;
+   mem_chain2region(w->opt, w->bns, w->pac, bseq, parent, chns, ext, regs);
+   if (first && n0 > 0 && regs->n > n0) {
+      mem_alnreg_t *tmp = arena_malloc(n0 * sizeof(mem_alnreg_t));
+      memcpy(tmp, regs->a, n0 * sizeof(mem_alnreg_t));
+      memmove(regs->a, regs->a + n0, (regs->n - n0) * sizeof(mem_alnreg_t));
+      memcpy(regs->a + regs->n - n0, tmp, n0 * sizeof(mem_alnreg_t));
+   }
+   arena_release(m);
+   free_mem_chain_v(*chns);
+}
+
+/**
+ * Add the regions of the reads of [beg, end) against the strands of
+ * strands[] after their seeds were chained
+ * @param chns, ext two per read, see bis_chain_batch
+ * @return w->regs[] mem_alnreg_v*
+ */
+static void bis_align_batch(worker_t *w, int beg, int end, const uint8_t *strands, mem_chain_v *chns, const mem_ext_v *ext) {
+
+   const mem_opt_t *opt = w->opt;
+   int n = (opt->flag&MEM_F_PE)? 2 : 1;
+   int r, p, k;
+
+   for (r = 0; r < (end - beg) * n; ++r) {
+      bseq1_t *s = &w->seqs[beg * n + r];
       if (bwa_verbose >= 4)
-         printf("\n=====> [%s] Processing read '%s' <=====\n",
-                __func__, w->seqs[i].name);
+         printf("\n=====> [%s] Processing read '%s'%s <=====\n",
+                __func__, s->name, n == 1? "" : r % n? "/2" : "/1");
+      for (k = 0; k < 2; ++k) {
+         p = k? !bis_first(opt, r % n) : bis_first(opt, r % n);
+         if (strands[r]>>p&1)
+            bis_chain2region(w, s, &chns[r*2+p], &ext[r*2+p], &w->regs[beg * n + r], p, !k);
+      }
+   }
+}
 
-      read_clipping(&w->seqs[i], opt->adaptor1, opt->l_adaptor1, opt);
-    
-      regs = &w->regs[i]; kv_init(*regs); regs->n_pri = 0;
-      if (!(opt->parent&1) || // no restriction
-          opt->parent>>1)     // to daughter
-         mem_align1_core(opt, w->bwt, w->bns, w->pac, &w->seqs[i],
-                         w->intv_cache[tid], regs, 0);
-    
-      if (!(opt->parent&1) || // no restriction
-          !(opt->parent>>1))  // to parent
-         mem_align1_core(opt, w->bwt, w->bns, w->pac, &w->seqs[i],
-                         w->intv_cache[tid], regs, 1);
-    
-      mem_merge_regions(opt, w->bns, w->pac, &w->seqs[i], regs);
+/* queue read s against the given strand for batched seeding */
+static void bis_seed_job(const mem_opt_t *opt, const bwt_t *bwt, bseq1_t *s, uint8_t parent,
+                         bwtintv_cache_t *cache, mem_seed_job_t *jobs, int *n_jobs) {
+   if (s->l_seq < opt->min_seed_len) return; // mem_chain skips these reads
+   bseq_bsconvert(s, parent);
+   mem_seed_job_t *t = &jobs[(*n_jobs)++];
+   t->bwt = &bwt[parent]; t->bwtc = &bwt[!parent];
+   t->seq = s->bisseq[parent]; t->len = s->l_seq;
+   t->intv_cache = cache;
+}
 
-   } else {			// PE
+/* clip the reads of [beg, end), checking the names of pairs */
+static void bis_clip_batch(worker_t *w, int beg, int end) {
 
-      // sanity check the read names
-      check_paired_read_names(
-         w->seqs[i<<1|0].name, w->seqs[i<<1|1].name);
+   const mem_opt_t *opt = w->opt;
+   int i;
 
-      read_clipping(&w->seqs[i<<1|0], opt->adaptor1, opt->l_adaptor1, opt);
-      read_clipping(&w->seqs[i<<1|1], opt->adaptor2, opt->l_adaptor2, opt);
-    
-      if (bwa_verbose >= 4)
-         printf("\n=====> [%s] Processing read '%s'/1 <=====\n",
-                __func__, w->seqs[i<<1|0].name);
-      
-      regs = &w->regs[i<<1|0];
-      kv_init(*regs); regs->n_pri = 0;
-      mem_align1_core(opt, w->bwt, w->bns, w->pac, &w->seqs[i<<1|0],
-                      w->intv_cache[tid], regs, 1);
-      
-      if (!opt->parent)   /* unrestricted: align read 1 to daughter */
-         mem_align1_core(opt, w->bwt, w->bns, w->pac,
-                         &w->seqs[i<<1|0], w->intv_cache[tid], regs, 0);
-      
-      mem_merge_regions(opt, w->bns, w->pac, &w->seqs[i<<1|0], regs);
+   for (i = beg; i < end; ++i) {
+      if (!(opt->flag&MEM_F_PE)) {	// SE
+         read_clipping(&w->seqs[i], opt->adaptor1, opt->l_adaptor1, opt);
+      } else {			// PE
+         bseq1_t *s = &w->seqs[i<<1];
 
-      if (bwa_verbose >= 4)
-         printf("\n=====> [%s] Processing read '%s'/2 <=====\n",
-                __func__, w->seqs[i<<1|1].name);
-      
-      regs = &w->regs[i<<1|1];
+         // sanity check the read names
+         check_paired_read_names(s[0].name, s[1].name);
+
+         read_clipping(&s[0], opt->adaptor1, opt->l_adaptor1, opt);
+         read_clipping(&s[1], opt->adaptor2, opt->l_adaptor2, opt);
+      }
+   }
+}
+
+KHASH_MAP_INIT_INT64(dup, int)
+
+/* hash of the clipped sequences of the i-th read (SE) or pair (PE) */
+static uint64_t bis_unit_hash(const worker_t *w, int i) {
+   int n = (w->opt->flag&MEM_F_PE)? 2 : 1;
+   int j, k;
+   uint64_t h = 0, x;
+   for (j = 0; j < n; ++j) {
+      const bseq1_t *s = &w->seqs[i * n + j];
+      h = hash_64(h ^ (uint64_t)s->l_seq);
+      for (k = 0; k + 8 <= s->l_seq; k += 8) {
+         memcpy(&x, s->seq + k, 8);
+         h = hash_64(h ^ x);
+      }
+      for (x = 0; k < s->l_seq; ++k) x = x<<8 | s->seq[k];
+      h = hash_64(h ^ x);
+   }
+   return h;
+}
+
+/* clip the reads of the ib-th batch of MEM_SEED_BATCH units and hash them */
+static void bis_clip_worker(void *data, int ib, int tid) {
+   worker_t *w = (worker_t*)data;
+   int i, beg = ib * MEM_SEED_BATCH;
+   int end = beg + MEM_SEED_BATCH < w->n_units ? beg + MEM_SEED_BATCH : w->n_units;
+   (void)tid;
+   bis_clip_batch(w, beg, end);
+   for (i = beg; i < end; ++i) w->uhash[i] = bis_unit_hash(w, i);
+}
+
+/* whether the i-th and j-th units have the same clipped sequences */
+static int bis_unit_eq(const worker_t *w, int i, int j) {
+   int n = (w->opt->flag&MEM_F_PE)? 2 : 1;
+   int k;
+   for (k = 0; k < n; ++k) {
+      const bseq1_t *s = &w->seqs[i * n + k], *t = &w->seqs[j * n + k];
+      if (s->l_seq != t->l_seq || memcmp(s->seq, t->seq, s->l_seq)) return 0;
+   }
+   return 1;
+}
+
+/**
+ * Find the units whose clipped sequences repeat those of an earlier unit.
+ * Regions depend on nothing else, so bis_worker1 aligns only the first of
+ * them and mem_process_seqs copies its regions to the others; mapq tie
+ * breaking and the SAM records are still done per read by bis_worker2.
+ * The units have been clipped and hashed by bis_clip_worker.
+ * @return w->dup[], w->dup_next[] and the number of units with dup[i] >= 0
+ */
+static int bis_dedup(worker_t *w) {
+   khash_t(dup) *h = kh_init(dup);
+   khint_t k;
+   int i, absent, n_dup = 0;
+   kh_resize(dup, h, w->n_units);
+   for (i = 0; i < w->n_units; ++i) {
+      k = kh_put(dup, h, w->uhash[i], &absent);
+      w->dup[i] = w->dup_next[i] = -1;
+      if (absent) kh_val(h, k) = i;
+      else if (bis_unit_eq(w, kh_val(h, k), i)) {
+         int j = kh_val(h, k);
+         w->dup[i] = j, ++n_dup;
+         w->dup_next[i] = w->dup_next[j], w->dup_next[j] = i;
+      } // else a hash collision, aligned on its own
+   }
+   kh_destroy(dup, h);
+   return n_dup;
+}
+
+/**
+ * Collect the seeds of the reads of [beg, end) against the strands of
+ * strands[] in one go, see mem_collect_intv_batch
+ * @param strands of each read, see bis_strands
+ * @param cache MEM_SEED_CACHES caches of this thread, two per read
+ */
+static void bis_seed_batch(worker_t *w, int beg, int end, const uint8_t *strands, bwtintv_cache_t **cache) {
+
+   const mem_opt_t *opt = w->opt;
+   mem_seed_job_t jobs[MEM_SEED_CACHES];
+   int n = (opt->flag&MEM_F_PE)? 2 : 1;
+   int r, p, n_jobs = 0;
+
+   for (r = 0; r < (end - beg) * n; ++r)
+      for (p = 0; p < 2; ++p)
+         if (strands[r]>>p&1)
+            bis_seed_job(opt, w->bwt, &w->seqs[beg * n + r], p, cache[r*2+p], jobs, &n_jobs);
+   if (w->hash == 0) mem_collect_intv_batch(opt, n_jobs, jobs); // else seeded by mem_chain
+}
+
+/* chain read s against the given strand and queue it for batched extension */
+static void bis_chain_job(worker_t *w, bseq1_t *s, uint8_t parent, bwtintv_cache_t *cache,
+                          mem_chain_v *chns, mem_ext_v *ext, mem_ext_job_t *jobs, int *n_jobs) {
+   mem_ext_job_t *t = &jobs[(*n_jobs)++];
+   *chns = mem_chain1_core(w->opt, w->bwt, w->hash, w->addon, w->bns, w->pac, s, cache, parent);
+   t->bseq = s; t->parent = parent;
+   t->chns = chns; t->ext = ext;
+}
+
+/**
+ * Chain the seeds of the reads of [beg, end) against the strands of
+ * strands[] and extend the best seed of every chain in one go, see
+ * mem_chain_ext_batch
+ * @param cache, chns, ext MEM_SEED_CACHES of each of this thread, two per read
+ */
+static void bis_chain_batch(worker_t *w, int beg, int end, const uint8_t *strands, bwtintv_cache_t **cache, mem_chain_v *chns, mem_ext_v *ext) {
+
+   const mem_opt_t *opt = w->opt;
+   mem_ext_job_t jobs[MEM_SEED_CACHES];
+   int n = (opt->flag&MEM_F_PE)? 2 : 1;
+   int r, p, k, n_jobs = 0;
+
+   for (r = 0; r < (end - beg) * n; ++r)
+      for (p = 0; p < 2; ++p)
+         if (strands[r]>>p&1) {
+            k = r*2+p;
+            bis_chain_job(w, &w->seqs[beg * n + r], p, cache[k], &chns[k], &ext[k], jobs, &n_jobs);
+         }
+   mem_chain_ext_batch(opt, w->bns, w->pac, n_jobs, jobs);
+}
+
+/**
+ * @param ib the ib-th batch of MEM_SEED_BATCH reads (SE) or pairs (PE)
+ * @param tid thread id
+ */
+static void bis_worker1(void *data, int ib, int tid) {
+
+   worker_t lw, *w = worker_local((worker_t*)data, tid, &lw);
+   const mem_opt_t *opt = w->opt;
+   bwtintv_cache_t **cache = w->intv_cache + tid * MEM_SEED_CACHES;
+   mem_chain_v *chns = w->chns + tid * MEM_SEED_CACHES;
+   mem_ext_v *ext = w->ext + tid * MEM_SEED_CACHES;
+   int i, r, beg = ib * MEM_SEED_BATCH;
+   int end = beg + MEM_SEED_BATCH < w->n_units ? beg + MEM_SEED_BATCH : w->n_units;
+   int n = (opt->flag&MEM_F_PE)? 2 : 1;
+   int prune = opt->prune >= 0 && !opt->parent;
+   uint8_t strands[MEM_SEED_BATCH * 2], likely[MEM_SEED_BATCH];
+   arena_mark_t m;
+
+   /* converted reads and chains live until the batch is aligned */
+   arena_bind(w->arena[tid]); bns_cache_bind(w->refc[tid]);
+   m = arena_mark();
+   for (r = 0; r < (end - beg) * n; ++r) {
+      mem_alnreg_v *regs = &w->regs[beg * n + r];
+      strands[r] = 0;
+      if (w->dup[beg + r / n] >= 0) continue; // given its regions later, see bis_copy_regs
       kv_init(*regs); regs->n_pri = 0;
-      
-      mem_align1_core(opt, w->bwt, w->bns, w->pac,
-                      &w->seqs[i<<1|1], w->intv_cache[tid], regs, 0);
-      if (!opt->parent)     /* unrestricted: align read 2 to parent */
-         mem_align1_core(opt, w->bwt, w->bns, w->pac,
-                         &w->seqs[i<<1|1], w->intv_cache[tid], regs, 1);
-      mem_merge_regions(opt, w->bns, w->pac, &w->seqs[i<<1|1], regs);
+      strands[r] = bis_strands(opt, r % n);
    }
+
+   /* unrestricted reads to their likely strand first, and to the other
+    * strand only if that does not settle them */
+   if (prune)
+      for (i = beg; i < end; ++i)
+         if (w->dup[i] < 0) likely[i - beg] = bis_likely_strands(w, i, strands + (i - beg) * n);
+   bis_seed_batch(w, beg, end, strands, cache);
+   bis_chain_batch(w, beg, end, strands, cache, chns, ext);
+   bis_align_batch(w, beg, end, strands, chns, ext);
+   if (prune) {
+      for (r = 0; r < (end - beg) * n; ++r) {
+         if (strands[r] == 0) continue; // a duplicate
+         if (likely[r / n] && bis_prune(opt, &w->seqs[beg * n + r], &w->regs[beg * n + r]))
+            strands[r] = 0, ++w->n_pruned[tid];
+         else strands[r] ^= 3;
+      }
+      bis_seed_batch(w, beg, end, strands, cache);
+      bis_chain_batch(w, beg, end, strands, cache, chns, ext);
+      bis_align_batch(w, beg, end, strands, chns, ext);
+   }
+
+   for (r = 0; r < (end - beg) * n; ++r) {
+      bseq1_t *s = &w->seqs[beg * n + r];
+      if (w->dup[beg + r / n] >= 0) continue;
+      mem_merge_regions(opt, w->bns, w->pac, s, &w->regs[beg * n + r]);
+      arena_free(s->bisseq[0]); arena_free(s->bisseq[1]);
+      s->bisseq[0] = s->bisseq[1] = 0;
+   }
+   arena_release(m);
+   arena_bind(0); bns_cache_bind(0);
 }
 
 /**
@@ -374,8 +685,11 @@ static void bis_worker1(void *data, int i, int tid) {
  * @param tid thread id
  */
 static void bis_worker2(void *data, int i, int tid) {
-  (void) tid;
-  worker_t *w = (worker_t*)data;
+  worker_t lw, *w = worker_local((worker_t*)data, tid, &lw);
+  arena_mark_t m;
+
+  arena_bind(w->arena[tid]); bns_cache_bind(w->refc[tid]);
+  m = arena_mark();
 
   if (!(w->opt->flag&MEM_F_PE)) { // SE
     if (bwa_verbose >= 4)
@@ -417,20 +731,67 @@ static void bis_worker2(void *data, int i, int tid) {
     mem_alnreg_freeSAM(&w->regs[i<<1|1]);
     free(w->regs[i<<1|0].a); free(w->regs[i<<1|1].a);
   }
+  arena_release(m);
+  arena_bind(0); bns_cache_bind(0);
+}
+
+/* give the j-th unit a copy of the regions of the i-th, see bis_dedup */
+static void bis_copy_regs(worker_t *w, int i, int j) {
+   int k, n = (w->opt->flag&MEM_F_PE)? 2 : 1;
+   for (k = 0; k < n; ++k) {
+      const mem_alnreg_v *src = &w->regs[i * n + k];
+      mem_alnreg_v *dst = &w->regs[j * n + k];
+      *dst = *src; dst->m = src->n;
+      dst->a = src->n? malloc(src->n * sizeof(mem_alnreg_t)) : 0;
+      if (src->n) memcpy(dst->a, src->a, src->n * sizeof(mem_alnreg_t));
+   }
+}
+
+/**
+ * bis_worker1 and bis_worker2 of a batch in one task, for SE reads and for
+ * PE reads of known insert sizes, which need nothing from other batches;
+ * the duplicates of its reads are finalized along with them
+ * @param ib the ib-th batch of MEM_SEED_BATCH reads (SE) or pairs (PE)
+ * @param tid thread id
+ */
+static void bis_worker(void *data, int ib, int tid) {
+
+   worker_t *w = (worker_t*)data;
+   int i, j, beg = ib * MEM_SEED_BATCH;
+   int end = beg + MEM_SEED_BATCH < w->n_units ? beg + MEM_SEED_BATCH : w->n_units;
+
+   bis_worker1(data, ib, tid);
+   for (i = beg; i < end; ++i) {
+      if (w->dup[i] >= 0) continue; // done with the first of them
+      for (j = w->dup_next[i]; j >= 0; j = w->dup_next[j]) {
+         bis_copy_regs(w, i, j);
+         bis_worker2(data, j, tid);
+      }
+      bis_worker2(data, i, tid);
+   }
 }
 
 /**
  * @param n: number of reads (n includes both ends for paired-end)
  * @param seqs: query sequences
  * @param pes0: paired-end statistics
+ * @param pes1: if not NULL, set to the paired-end statistics used
+ * @param isize: running insert-size model, or NULL to infer from this chunk alone
+ * @param numa: per-node index placement from bwa_numa_init(), or NULL
+ * @param addon: add-on index from bwa_addon_init(), or NULL; bns and pac
+ *               are then addon->bns and addon->pac
+ * @param hash: k-mer hash of the main index from mem_hash_init(), or NULL
+ * @param sbuf: seeding buffers from mem_seedbuf_init(), or NULL
  */
 void mem_process_seqs(
    const mem_opt_t *opt, const bwt_t *bwt, const bntseq_t *bns,
    const uint8_t *pac, int64_t n_processed, int n,
-   bseq1_t *seqs, const mem_pestat_t *pes0) {
+   bseq1_t *seqs, const mem_pestat_t *pes0, mem_pestat_t *pes1, mem_isize_t *isize,
+   const bwa_numa_t *numa, const bwa_addon_t *addon, const mem_hash_t *hash,
+   mem_seedbuf_t *sbuf) {
 
    extern void kt_for(int n_threads, void (*func)(void*,int,int), void *data, int n);
-   int i;
+   int i, n_dup, n_batches;
 
    double ctime, rtime;
    ctime = cputime(); rtime = realtime();
@@ -441,33 +802,69 @@ void mem_process_seqs(
    w.regs = malloc(n * sizeof(mem_alnreg_v));
    w.opt = opt; w.bwt = bwt; w.bns = bns; w.pac = pac;
    w.seqs = seqs; w.n_processed = n_processed;
+   w.numa = numa; w.addon = addon; w.hash = hash;
+   memset(&w.pes, 0, sizeof(mem_pestat_t));
    /* w.pes = pes; // isn't this shared across all threads? */
 
    /***** Step 1: Generate mapping position *****/
-   w.intv_cache = malloc(opt->n_threads * sizeof(bwtintv_cache_t));
+   w.n_units = (opt->flag&MEM_F_PE)? n>>1 : n;
+   n_batches = (w.n_units + MEM_SEED_BATCH - 1) / MEM_SEED_BATCH;
+   mem_seedbuf_t *b = sbuf? sbuf : mem_seedbuf_init(opt->n_threads);
+   xassert(b->n_threads >= opt->n_threads, "seeding buffers for fewer threads");
+   w.intv_cache = b->intv_cache; w.chns = b->chns; w.ext = b->ext;
+   w.arena = malloc(opt->n_threads * sizeof(arena_t*));
+   w.refc = malloc(opt->n_threads * sizeof(bns_cache_t*));
+   w.n_pruned = calloc(opt->n_threads, sizeof(int64_t));
+   w.dup = malloc(w.n_units * sizeof(int));
+   w.dup_next = malloc(w.n_units * sizeof(int));
+   w.uhash = malloc(w.n_units * sizeof(uint64_t));
+   kt_for(opt->n_threads, bis_clip_worker, &w, n_batches);
+   n_dup = bis_dedup(&w);
+   free(w.uhash);
    for (i = 0; i < opt->n_threads; ++i)
-      w.intv_cache[i] = bwtintv_cache_init(); // w.intv_cache[i] is used by thread i only
+      w.arena[i] = arena_init(), w.refc[i] = bns_cache_init();
 
-   kt_for(opt->n_threads, bis_worker1, &w, (opt->flag&MEM_F_PE)? n>>1 : n);
-
-   for (i = 0; i < opt->n_threads; ++i)
-      bwtintv_cache_destroy(w.intv_cache[i]);
-   free(w.intv_cache);
-
-   /********************************
-    * Step 2: Obtain PE statistics *
-    ********************************/
-   if (opt->flag & MEM_F_PE) { // infer insert sizes if not provided
+   if (!(opt->flag&MEM_F_PE) || pes0) {
+      /* nothing to wait for between the steps; stream the batches */
       if (pes0) w.pes = *pes0;
-      else w.pes = mem_pestat(opt, w.bns, n, w.regs);
+      kt_for(opt->n_threads, bis_worker, &w, n_batches);
+   } else {
+      kt_for(opt->n_threads, bis_worker1, &w, n_batches);
+
+      /* duplicates get the regions of the first of them */
+      for (i = 0; i < w.n_units; ++i)
+         if (w.dup[i] >= 0) bis_copy_regs(&w, w.dup[i], i);
+
+      /********************************
+       * Step 2: Obtain PE statistics *
+       ********************************/
+      if (isize) { // infer insert sizes from this and the earlier chunks
+         int64_t n_added = mem_isize_add(opt, w.bns, n, w.regs, isize);
+         if (bwa_verbose >= 3) fprintf(stderr, "[M::%s] # candidate unique pairs: %ld, %ld so far\n", __func__, (long)n_added, (long)isize->n);
+         w.pes = mem_isize_pestat(isize);
+      } else w.pes = mem_pestat(opt, w.bns, n, w.regs); // infer insert sizes as not provided
+
+      /***** Step 3: Pairing and generate mapping *****/
+      kt_for(opt->n_threads, bis_worker2, &w, n>>1);
    }
+   if (pes1) *pes1 = w.pes;
 
-   /***** Step 3: Pairing and generate mapping *****/
-   kt_for(opt->n_threads, bis_worker2, &w, (opt->flag&MEM_F_PE)? n>>1 : n);
+   if (opt->prune >= 0 && !opt->parent && bwa_verbose >= 3) {
+      int64_t n_pruned = 0;
+      int64_t n_elig = (int64_t)(w.n_units - n_dup) * ((opt->flag&MEM_F_PE)? 2 : 1); // duplicates are not seeded
+      for (i = 0; i < opt->n_threads; ++i) n_pruned += w.n_pruned[i];
+      fprintf(stderr, "[M::%s] Skipped the unlikely strand of %ld of %ld reads (%.1f%%)\n", __func__, (long)n_pruned, (long)n_elig, n_elig? 100. * n_pruned / n_elig : 0.);
+   }
+   if (n_dup && bwa_verbose >= 3)
+      fprintf(stderr, "[M::%s] Reused the regions of an identical earlier %s for %d of %d\n", __func__, (opt->flag&MEM_F_PE)? "pair" : "read", n_dup, w.n_units);
 
+   if (b != sbuf) mem_seedbuf_destroy(b);
+   free(w.n_pruned); free(w.dup); free(w.dup_next);
    free(w.regs);
+   for (i = 0; i < opt->n_threads; ++i)
+      arena_destroy(w.arena[i]), bns_cache_destroy(w.refc[i]);
+   free(w.arena); free(w.refc);
 
    if (bwa_verbose >= 3)
       fprintf(stderr, "[M::%s] Processed %d reads in %.3f CPU sec, %.3f real sec\n", __func__, n, cputime() - ctime, realtime() - rtime);
 }
-
@@ -103,6 +103,12 @@ typedef struct {
    **/
   uint8_t parent;
 
+  /* with opt->parent == 0, align each read to the strand its C/G content
+   * favors first, and skip the other strand if that gives a unique
+   * full-length hit within prune of a perfect score; <0 to always align
+   * to both */
+  int prune;
+
   /* the following would almost be impossible unless some kind of sequence context capture
    * reads can only be mapped to BSW or BSC strands
    * bsstrand&1: is restricted
@@ -129,6 +135,14 @@ typedef struct {
   double avg, std; // mean and stddev of the insert size distribution
 } mem_pestat_t;
 
+/* insert-size model, a histogram of the insert sizes of unique pairs
+ * built up over chunks; mem_isize_pestat() turns it into a mem_pestat_t */
+typedef struct {
+  int max_ins;     // sizes in [-max_ins, max_ins] are counted
+  int64_t n;       // number of pairs counted
+  uint64_t *cnt;   // cnt[is + max_ins] is the number of pairs of size is
+} mem_isize_t;
+
 /* // the "finalized" version of mem_alnreg_t, it's ready for SAM output */
 /* // mem_alnreg_t lacks finalized cigar, position on the chromosome and mapping quality */
 /* typedef struct { // This struct is only used for the convenience of API. */
@@ -146,6 +160,14 @@ typedef struct {
 
 typedef enum {BSS_UNSPEC, BSS_PARENT, BSS_DAUGHTER} bsstrand_t;
 
+/* k-mer hash seeding in place of the FM-index on a small reference (memhash.c) */
+#define MEM_HASH_K       12      // k-mer length, at most the minimum seed length
+#define MEM_HASH_MAX_HIT 4096    // k-mers with more hits, and more than max_occ, do not start a MEM
+typedef struct mem_hash_s mem_hash_t;
+
+/* per-thread seeding buffers of mem_process_seqs, kept for a whole run */
+typedef struct mem_seedbuf_s mem_seedbuf_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -178,9 +200,36 @@ extern "C" {
    * @param pac    2-bit encoded reference
    * @param n      number of query sequences
    * @param seqs   query sequences; $seqs[i].seq/sam to be modified after the call
-   * @param pes0   insert-size info; if NULL, infer from data;
+   * @param pes0   insert-size info; if NULL, infer from data; if given, or
+   *               for SE reads, each batch of reads is finalized as soon as
+   *               it is aligned
+   * @param pes1   if not NULL, set to the insert-size info used
+   * @param isize  running insert-size model, or NULL; when inferring, the
+   *               pairs of this chunk are added to it and the insert-size
+   *               info is taken from all the pairs added so far
+   * @param numa   NUMA placement of the index (bwa_numa_init); if NULL, use bwt/bns/pac
+   * @param addon  add-on index (bwa_addon_init) also aligned against, or NULL;
+   *               bns and pac must then be its merged ones
+   * @param hash   k-mer hash of the main index (mem_hash_init) seeded from
+   *               instead of bwt, or NULL
+   * @param sbuf   seeding buffers (mem_seedbuf_init) for opt->n_threads
+   *               threads, or NULL to allocate them for this call only
    */
-  void mem_process_seqs(const mem_opt_t *opt, const bwt_t *bwt, const bntseq_t *bns, const uint8_t *pac, int64_t n_processed, int n, bseq1_t *seqs, const mem_pestat_t *pes0);
+  void mem_process_seqs(const mem_opt_t *opt, const bwt_t *bwt, const bntseq_t *bns, const uint8_t *pac, int64_t n_processed, int n, bseq1_t *seqs, const mem_pestat_t *pes0, mem_pestat_t *pes1, mem_isize_t *isize, const bwa_numa_t *numa, const bwa_addon_t *addon, const mem_hash_t *hash, mem_seedbuf_t *sbuf);
+
+  mem_seedbuf_t *mem_seedbuf_init(int n_threads);
+  void mem_seedbuf_destroy(mem_seedbuf_t *b);
+
+  mem_isize_t *mem_isize_init(int max_ins);
+  void mem_isize_destroy(mem_isize_t *m);
+  mem_pestat_t mem_isize_pestat(const mem_isize_t *m);
+  void mem_isize_save(const mem_isize_t *m, const char *fn);
+  /* NULL if fn does not exist; an unreadable fn or one saved with a smaller
+   * max_ins is fatal */
+  mem_isize_t *mem_isize_load(const char *fn, int max_ins);
+
+  mem_hash_t *mem_hash_init(const bntseq_t *bns, const uint8_t *pac);
+  void mem_hash_destroy(mem_hash_t *h);
 
   /**
    * bandwidth for Smith-Waterman
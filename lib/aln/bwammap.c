@@ -0,0 +1,272 @@
+/* single-file, memory-mappable index container
+ *
+ * Copyright (c) 2023 Jacob.Morrison@vai.org
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* <prefix>.bis.idx layout, every section starts on a BWA_MMAP_ALIGN boundary
+ *
+ *   bwa_mmap_hdr_t   magic, version, file length, section offsets/lengths
+ *   BWA_SEC_BWT_HDR  bwt_t of the daughter and the parent strand
+ *   BWA_SEC_BWT0     daughter bwt (occ + 2-bit BWT)
+ *   BWA_SEC_SA0      daughter sampled SA, bit-packed
+ *   BWA_SEC_BWT1     parent bwt
+ *   BWA_SEC_SA1      parent sampled SA
+ *   BWA_SEC_BNS      bntseq_t, ambs, anns, then NUL-terminated name/anno pairs
+ *   BWA_SEC_PAC      forward-only 2-bit packed reference
+ *   BWA_SEC_KMER0    daughter k-mer table, empty without one
+ *   BWA_SEC_KMER1    parent k-mer table
+ *
+ * The loader maps the file read-only and points bwaidx_t straight into the
+ * mapping; only bntseq_t and the anns array are copied to the heap since
+ * align.c patches is_alt in place. */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "bwa.h"
+#include "utils.h"
+
+#define BWA_MMAP_MAGIC   "BISIDX\001"
+#define BWA_MMAP_VERSION 3 // 2: bit-packed SA, 3: k-mer tables
+#define BWA_MMAP_ALIGN   4096
+
+enum {
+  BWA_SEC_BWT_HDR = 0,
+  BWA_SEC_BWT0, BWA_SEC_SA0,
+  BWA_SEC_BWT1, BWA_SEC_SA1,
+  BWA_SEC_BNS, BWA_SEC_PAC,
+  BWA_SEC_KMER0, BWA_SEC_KMER1,
+  BWA_SEC_N
+};
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t n_sec;
+  uint64_t l_file;
+  uint64_t off[BWA_SEC_N];
+  uint64_t len[BWA_SEC_N];
+} bwa_mmap_hdr_t;
+
+#define mmap_align(x) (((x) + BWA_MMAP_ALIGN - 1) / BWA_MMAP_ALIGN * BWA_MMAP_ALIGN)
+
+static void write_pad(FILE *fp, uint64_t *k) {
+  static const uint8_t zeros[BWA_MMAP_ALIGN] = {0};
+  uint64_t x = mmap_align(*k) - *k;
+  if (x) err_fwrite(zeros, 1, x, fp);
+  *k += x;
+}
+
+static void write_sec(FILE *fp, bwa_mmap_hdr_t *h, int sec, const void *data, uint64_t len, uint64_t *k) {
+  write_pad(fp, k);
+  h->off[sec] = *k; h->len[sec] = len;
+  if (len) err_fwrite(data, 1, len, fp);
+  *k += len;
+}
+
+char *bwa_idx_mmap_fn(const char *hint) {
+  char *fn = calloc(strlen(hint) + 10, 1);
+  strcat(strcpy(fn, hint), ".bis.idx");
+  return fn;
+}
+
+/**
+ * Write a fully loaded index (BWA_IDX_ALL) into a single mmap-able file
+ * @param fn   output file name, normally <prefix>.bis.idx
+ * @param idx  index loaded from disk; left untouched
+ * @return     0 on success
+ */
+int bwa_idx_dump_mmap(const char *fn, const bwaidx_t *idx) {
+  bwa_mmap_hdr_t h;
+  bwt_t hdr[2];
+  uint64_t k = 0, x;
+  int i, j;
+  FILE *fp;
+
+  if (idx->bns == 0 || idx->pac == 0 || idx->bwt[0].bwt == 0 || idx->bwt[1].bwt == 0) {
+    if (bwa_verbose >= 1)
+      fprintf(stderr, "[E::%s] all index components must be loaded\n", __func__);
+    return -1;
+  }
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BWA_MMAP_MAGIC, 8);
+  h.version = BWA_MMAP_VERSION;
+  h.n_sec = BWA_SEC_N;
+
+  fp = xopen(fn, "wb");
+  err_fwrite(&h, sizeof(h), 1, fp); k += sizeof(h); // placeholder, rewritten below
+
+  // strand headers; pointers are meaningless on disk and reset on load
+  for (j = 0; j < 2; ++j) {
+    hdr[j] = idx->bwt[j];
+    hdr[j].bwt = 0; hdr[j].sa = 0; hdr[j].kmer = 0;
+  }
+  write_sec(fp, &h, BWA_SEC_BWT_HDR, hdr, sizeof(hdr), &k);
+  for (j = 0; j < 2; ++j) {
+    const bwt_t *bwt = idx->bwt+j;
+    write_sec(fp, &h, j? BWA_SEC_BWT1 : BWA_SEC_BWT0, bwt->bwt, bwt->bwt_size * 4, &k);
+    write_sec(fp, &h, j? BWA_SEC_SA1 : BWA_SEC_SA0, bwt->sa, bwt_sa_words(bwt) * sizeof(bwtint_t), &k);
+  }
+
+  { // bns: fixed-size records first so they stay 8-byte aligned
+    bntseq_t bns = *idx->bns;
+    bns.anns = 0; bns.ambs = 0; bns.fp_pac = 0;
+    write_pad(fp, &k);
+    h.off[BWA_SEC_BNS] = k;
+    err_fwrite(&bns, sizeof(bntseq_t), 1, fp); k += sizeof(bntseq_t);
+    x = idx->bns->n_holes * sizeof(bntamb1_t); err_fwrite(idx->bns->ambs, 1, x, fp); k += x;
+    x = idx->bns->n_seqs * sizeof(bntann1_t); err_fwrite(idx->bns->anns, 1, x, fp); k += x;
+    for (i = 0; i < idx->bns->n_seqs; ++i) {
+      x = strlen(idx->bns->anns[i].name) + 1; err_fwrite(idx->bns->anns[i].name, 1, x, fp); k += x;
+      x = strlen(idx->bns->anns[i].anno) + 1; err_fwrite(idx->bns->anns[i].anno, 1, x, fp); k += x;
+    }
+    h.len[BWA_SEC_BNS] = k - h.off[BWA_SEC_BNS];
+  }
+  write_sec(fp, &h, BWA_SEC_PAC, idx->pac, idx->bns->l_pac/4+1, &k);
+  for (j = 0; j < 2; ++j)
+    write_sec(fp, &h, j? BWA_SEC_KMER1 : BWA_SEC_KMER0, idx->bwt[j].kmer, bwt_kmer_len(idx->bwt+j) * sizeof(bwtint_t), &k);
+  write_pad(fp, &k);
+  h.l_file = k;
+
+  err_fseek(fp, 0, SEEK_SET);
+  err_fwrite(&h, sizeof(h), 1, fp);
+  err_fflush(fp);
+  err_fclose(fp);
+  return 0;
+}
+
+/**
+ * Map <hint>.bis.idx and point a new bwaidx_t into the mapping
+ * @param hint   index prefix
+ * @param which  BWA_IDX_* flags; BWA_IDX_PREFAULT populates the page tables
+ *               up front instead of faulting pages in during alignment
+ * @return       0 if the container does not exist or is not valid
+ */
+bwaidx_t *bwa_idx_load_from_mmap(const char *hint, int which) {
+  bwa_mmap_hdr_t *h;
+  bwaidx_t *idx;
+  uint8_t *mem, *p, *end;
+  struct stat st;
+  char *fn;
+  const char *why;
+  int fd, i, j, flags = MAP_SHARED;
+
+  fn = bwa_idx_mmap_fn(hint);
+  fd = open(fn, O_RDONLY);
+  free(fn);
+  if (fd < 0) return 0;
+  if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < sizeof(bwa_mmap_hdr_t)) {
+    close(fd);
+    return 0;
+  }
+#ifdef MAP_POPULATE
+  if (which & BWA_IDX_PREFAULT) flags |= MAP_POPULATE;
+#endif
+  mem = mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return 0;
+
+  h = (bwa_mmap_hdr_t*) mem;
+  if (memcmp(h->magic, BWA_MMAP_MAGIC, 8) != 0 || h->version != BWA_MMAP_VERSION ||
+      h->n_sec != BWA_SEC_N || h->l_file != (uint64_t) st.st_size ||
+      h->len[BWA_SEC_BWT_HDR] != 2 * sizeof(bwt_t)) { // written by a build with another bwt_t layout
+    if (bwa_verbose >= 2)
+      fprintf(stderr, "[W::%s] ignore '%s.bis.idx': not a valid index container\n", __func__, hint);
+    munmap(mem, st.st_size);
+    return 0;
+  }
+  for (i = 0; i < BWA_SEC_N; ++i)
+    if (h->off[i] < sizeof(bwa_mmap_hdr_t) || h->off[i] > h->l_file || h->len[i] > h->l_file - h->off[i]) {
+      if (bwa_verbose >= 2)
+        fprintf(stderr, "[W::%s] ignore '%s.bis.idx': section %d is out of the file\n", __func__, hint, i);
+      munmap(mem, st.st_size);
+      return 0;
+    }
+  huge_advise(mem, st.st_size); // takes effect where the kernel has file THP
+  if (which & BWA_IDX_PREFAULT) madvise(mem, st.st_size, MADV_WILLNEED);
+
+  idx = calloc(1, sizeof(bwaidx_t));
+  memcpy(idx->bwt, mem + h->off[BWA_SEC_BWT_HDR], 2 * sizeof(bwt_t));
+  for (j = 0; j < 2; ++j) {
+    idx->bwt[j].bwt = (uint32_t*) (mem + h->off[j? BWA_SEC_BWT1 : BWA_SEC_BWT0]);
+    idx->bwt[j].sa  = (bwtint_t*) (mem + h->off[j? BWA_SEC_SA1 : BWA_SEC_SA0]);
+    bwt_set_layout(idx->bwt+j); // derived from the sizes, not trusted from disk
+    if (idx->bwt[j].kmer_k < 0 || idx->bwt[j].kmer_k > BWT_KMER_MAX) idx->bwt[j].kmer_k = -1;
+    if (h->len[j? BWA_SEC_BWT1 : BWA_SEC_BWT0] != idx->bwt[j].bwt_size * 4 ||
+        h->len[j? BWA_SEC_SA1 : BWA_SEC_SA0] != bwt_sa_words(idx->bwt+j) * sizeof(bwtint_t) ||
+        idx->bwt[j].kmer_k < 0 ||
+        h->len[j? BWA_SEC_KMER1 : BWA_SEC_KMER0] != bwt_kmer_len(idx->bwt+j) * sizeof(bwtint_t)) {
+      if (bwa_verbose >= 2)
+        fprintf(stderr, "[W::%s] ignore '%s.bis.idx': inconsistent BWT, SA or k-mer table size\n", __func__, hint);
+      free(idx); munmap(mem, st.st_size);
+      return 0;
+    }
+    idx->bwt[j].kmer = idx->bwt[j].kmer_k? (bwtint_t*) (mem + h->off[j? BWA_SEC_KMER1 : BWA_SEC_KMER0]) : 0;
+  }
+
+  // bns, parsed within its section only
+  p = mem + h->off[BWA_SEC_BNS]; end = p + h->len[BWA_SEC_BNS];
+  idx->bns = calloc(1, sizeof(bntseq_t));
+  why = "truncated bns";
+  if ((uint64_t) (end - p) < sizeof(bntseq_t)) goto bad;
+  memcpy(idx->bns, p, sizeof(bntseq_t)); p += sizeof(bntseq_t);
+  idx->bns->anns = 0;
+  if (idx->bns->n_holes < 0 || idx->bns->n_seqs < 0 ||
+      (uint64_t) idx->bns->n_holes * sizeof(bntamb1_t) + (uint64_t) idx->bns->n_seqs * sizeof(bntann1_t) > (uint64_t) (end - p))
+    goto bad;
+  idx->bns->ambs = (bntamb1_t*) p; p += idx->bns->n_holes * sizeof(bntamb1_t);
+  idx->bns->anns = malloc(idx->bns->n_seqs * sizeof(bntann1_t));
+  memcpy(idx->bns->anns, p, idx->bns->n_seqs * sizeof(bntann1_t)); p += idx->bns->n_seqs * sizeof(bntann1_t);
+  for (i = 0; i < idx->bns->n_seqs; ++i) {
+    uint8_t *q;
+    if ((q = memchr(p, 0, end - p)) == 0) goto bad;
+    idx->bns->anns[i].name = (char*) p; p = q + 1;
+    if ((q = memchr(p, 0, end - p)) == 0) goto bad;
+    idx->bns->anns[i].anno = (char*) p; p = q + 1;
+  }
+  idx->bns->fp_pac = 0;
+  why = "inconsistent pac size";
+  if (idx->bns->l_pac < 0 || h->len[BWA_SEC_PAC] != (uint64_t) idx->bns->l_pac / 4 + 1) goto bad;
+  idx->pac = mem + h->off[BWA_SEC_PAC];
+
+  idx->mem = mem; idx->l_mem = st.st_size;
+  idx->is_mmap = 1;
+  if (bwa_verbose >= 3)
+    fprintf(stderr, "[M::%s] mapped %.1f MB index container%s\n", __func__,
+            st.st_size / 1048576., (which & BWA_IDX_PREFAULT)? " (prefaulted)" : "");
+  return idx;
+
+bad:
+  if (bwa_verbose >= 2)
+    fprintf(stderr, "[W::%s] ignore '%s.bis.idx': %s\n", __func__, hint, why);
+  free(idx->bns->anns); free(idx->bns); free(idx);
+  munmap(mem, st.st_size);
+  return 0;
+}
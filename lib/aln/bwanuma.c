@@ -0,0 +1,310 @@
+/* NUMA placement of the index and of the alignment threads
+ *
+ * Copyright (c) 2023 Jacob.Morrison@vai.org
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Both strands, the SA and pac are one block of memory (the flat image of
+ * bwa_idx2mem() or the mapped .bis.idx container), so the index can be
+ * placed with a single mbind() call:
+ *
+ *   BWA_NUMA_INTERLEAVE  pages of the image are spread over all nodes
+ *   BWA_NUMA_REPLICATE   the image is moved to the first node and copied to
+ *                        every other node; thread tid is pinned to the CPUs
+ *                        of node tid % n_node and reads that node's copy
+ *
+ * The libnuma API is not required; the node topology is read from sysfs and
+ * mbind(2) is called directly. */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "bwa.h"
+#include "utils.h"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND       2
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE    (1<<1)
+#endif
+
+#define BWA_NUMA_MAX_NODE 1024
+
+struct bwa_numa_s {
+  int mode;
+  int n_node;
+  int *node;           // node ids with CPUs
+  cpu_set_t *cpus;     // CPUs of each node
+  bwaidx_t **idx;      // index used by the threads of each node
+  uint8_t **pac;       // add-on merged pac used by each node, see bwa_numa_add_pac()
+  int64_t l_pac;       // its length in bytes
+};
+
+static __thread int numa_pinned = -1; // node the calling thread is pinned to
+
+static int parse_cpulist(const char *fn, cpu_set_t *set) {
+  FILE *fp;
+  int a, b, n = 0;
+  char c;
+
+  CPU_ZERO(set);
+  if ((fp = fopen(fn, "r")) == 0) return 0;
+  while (fscanf(fp, "%d", &a) == 1) {
+    b = a;
+    if (fscanf(fp, "%c", &c) == 1 && c == '-') {
+      if (fscanf(fp, "%d", &b) != 1) break;
+      if (fscanf(fp, "%c", &c) != 1) c = '\n';
+    }
+    for (; a <= b && a < CPU_SETSIZE; ++a, ++n) CPU_SET(a, set);
+    if (c != ',') break;
+  }
+  fclose(fp);
+  return n;
+}
+
+// nodes that have CPUs, in increasing order
+static int numa_topology(int **node, cpu_set_t **cpus) {
+  DIR *dir;
+  struct dirent *e;
+  int n = 0, m = 0, i, j;
+  char fn[64];
+
+  *node = 0; *cpus = 0;
+  if ((dir = opendir("/sys/devices/system/node")) == 0) return 0;
+  while ((e = readdir(dir)) != 0) {
+    int id;
+    cpu_set_t set;
+    if (strncmp(e->d_name, "node", 4) != 0 || sscanf(e->d_name + 4, "%d", &id) != 1) continue;
+    if (id < 0 || id >= BWA_NUMA_MAX_NODE) continue;
+    snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", id);
+    if (parse_cpulist(fn, &set) == 0) continue; // memory-only node
+    if (n == m) {
+      m = m? m<<1 : 4;
+      *node = realloc(*node, m * sizeof(int));
+      *cpus = realloc(*cpus, m * sizeof(cpu_set_t));
+    }
+    for (i = n; i > 0 && (*node)[i-1] > id; --i) { // insertion sort by id
+      (*node)[i] = (*node)[i-1];
+      (*cpus)[i] = (*cpus)[i-1];
+    }
+    (*node)[i] = id; (*cpus)[i] = set;
+    ++n;
+  }
+  closedir(dir);
+  for (i = j = 0; i < n; ++i) j += CPU_COUNT(&(*cpus)[i]);
+  return j? n : 0;
+}
+
+/* set the policy of [mem, mem+len), the range is shrunk to whole pages */
+static int numa_mbind(void *mem, int64_t len, int policy, const int *node, int n_node) {
+#ifdef SYS_mbind
+  unsigned long mask[BWA_NUMA_MAX_NODE / (8 * sizeof(unsigned long))];
+  long pg = sysconf(_SC_PAGESIZE);
+  uintptr_t beg = ((uintptr_t)mem + pg - 1) / pg * pg, end = ((uintptr_t)mem + len) / pg * pg;
+  int i;
+
+  if (end <= beg) return 0;
+  memset(mask, 0, sizeof(mask));
+  for (i = 0; i < n_node; ++i)
+    mask[node[i] / (8 * sizeof(unsigned long))] |= 1UL << (node[i] % (8 * sizeof(unsigned long)));
+  return syscall(SYS_mbind, beg, end - beg, policy, mask, (unsigned long)BWA_NUMA_MAX_NODE, MPOL_MF_MOVE) == 0? 0 : -1;
+#else
+  (void) mem; (void) len; (void) policy; (void) node; (void) n_node;
+  return -1;
+#endif
+}
+
+#define NUMA_REBASE(p, from, to) ((p)? (void*)((uint8_t*)(to) + ((uint8_t*)(p) - (uint8_t*)(from))) : 0)
+
+/* index pointing into the copy mem of idx->mem; works for both the flat
+ * image and the mmap container since every array lives inside the block */
+static bwaidx_t *numa_rebase(const bwaidx_t *idx, uint8_t *mem) {
+  bwaidx_t *r;
+  int i, j;
+
+  r = calloc(1, sizeof(bwaidx_t));
+  for (j = 0; j < 2; ++j) {
+    r->bwt[j] = idx->bwt[j];
+    r->bwt[j].bwt  = NUMA_REBASE(idx->bwt[j].bwt,  idx->mem, mem);
+    r->bwt[j].sa   = NUMA_REBASE(idx->bwt[j].sa,   idx->mem, mem);
+    r->bwt[j].kmer = NUMA_REBASE(idx->bwt[j].kmer, idx->mem, mem);
+  }
+  r->bns = malloc(sizeof(bntseq_t));
+  *r->bns = *idx->bns;
+  r->bns->ambs = NUMA_REBASE(idx->bns->ambs, idx->mem, mem);
+  r->bns->anns = malloc(idx->bns->n_seqs * sizeof(bntann1_t));
+  memcpy(r->bns->anns, idx->bns->anns, idx->bns->n_seqs * sizeof(bntann1_t)); // with the ALT marks
+  for (i = 0; i < idx->bns->n_seqs; ++i) {
+    r->bns->anns[i].name = NUMA_REBASE(idx->bns->anns[i].name, idx->mem, mem);
+    r->bns->anns[i].anno = NUMA_REBASE(idx->bns->anns[i].anno, idx->mem, mem);
+  }
+  r->pac = NUMA_REBASE(idx->pac, idx->mem, mem);
+  r->mem = mem; r->l_mem = idx->l_mem;
+  r->is_mmap = 1; // bwa_idx_destroy() unmaps it
+  return r;
+}
+
+/**
+ * Place the index for a multi-socket run
+ * @param idx   loaded index; turned into a flat image if it is not one yet
+ * @param mode  BWA_NUMA_INTERLEAVE or BWA_NUMA_REPLICATE
+ * @return      0 on a single-node machine or on failure, in which case idx
+ *              is used as is
+ */
+bwa_numa_t *bwa_numa_init(bwaidx_t *idx, int mode) {
+  bwa_numa_t *nm;
+  int i;
+
+  nm = calloc(1, sizeof(bwa_numa_t));
+  nm->mode = mode;
+  nm->n_node = numa_topology(&nm->node, &nm->cpus);
+  if (nm->n_node < 2) {
+    if (bwa_verbose >= 3)
+      fprintf(stderr, "[M::%s] one NUMA node, the index is used as is\n", __func__);
+    bwa_numa_destroy(nm);
+    return 0;
+  }
+  if (idx->mem == 0) { // loaded from the separate files: stage the image on the target nodes
+    int64_t l_mem = bwa_idx_mem_len(idx);
+    uint8_t *mem = mmap(0, l_mem, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      if (bwa_verbose >= 1)
+        fprintf(stderr, "[E::%s] fail to allocate %ld bytes for the index image\n", __func__, (long) l_mem);
+      bwa_numa_destroy(nm);
+      return 0;
+    }
+    huge_advise(mem, l_mem);
+    // placed before the first touch, so no page is ever moved
+    if (mode == BWA_NUMA_INTERLEAVE) numa_mbind(mem, l_mem, MPOL_INTERLEAVE, nm->node, nm->n_node);
+    else numa_mbind(mem, l_mem, MPOL_BIND, nm->node, 1);
+    bwa_idx2mem_at(idx, l_mem, mem);
+    idx->is_mmap = 1; // bwa_idx_destroy() unmaps it
+  }
+
+  nm->idx = calloc(nm->n_node, sizeof(bwaidx_t*));
+  if (mode == BWA_NUMA_INTERLEAVE) {
+    if (numa_mbind(idx->mem, idx->l_mem, MPOL_INTERLEAVE, nm->node, nm->n_node) < 0 && bwa_verbose >= 2)
+      fprintf(stderr, "[W::%s] fail to interleave the index over %d nodes\n", __func__, nm->n_node);
+    for (i = 0; i < nm->n_node; ++i) nm->idx[i] = idx;
+  } else {
+    if (numa_mbind(idx->mem, idx->l_mem, MPOL_BIND, nm->node, 1) < 0 && bwa_verbose >= 2)
+      fprintf(stderr, "[W::%s] fail to move the index to node %d\n", __func__, nm->node[0]);
+    nm->idx[0] = idx;
+    for (i = 1; i < nm->n_node; ++i) {
+      uint8_t *mem = mmap(0, idx->l_mem, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) {
+        if (bwa_verbose >= 1)
+          fprintf(stderr, "[E::%s] fail to allocate the index copy for node %d\n", __func__, nm->node[i]);
+        bwa_numa_destroy(nm);
+        return 0;
+      }
+      huge_advise(mem, idx->l_mem);
+      // bind before the first touch so that memcpy() allocates on the node
+      if (numa_mbind(mem, idx->l_mem, MPOL_BIND, nm->node + i, 1) < 0 && bwa_verbose >= 2)
+        fprintf(stderr, "[W::%s] fail to bind the index copy to node %d\n", __func__, nm->node[i]);
+      memcpy(mem, idx->mem, idx->l_mem);
+      nm->idx[i] = numa_rebase(idx, mem);
+    }
+  }
+  if (bwa_verbose >= 3)
+    fprintf(stderr, "[M::%s] %s the index (%.1f MB) over %d NUMA nodes\n", __func__,
+            mode == BWA_NUMA_INTERLEAVE? "interleave" : "replicate", idx->l_mem / 1048576., nm->n_node);
+  return nm;
+}
+
+/**
+ * Index for worker tid of kt_for(); the calling thread is pinned to the
+ * CPUs of node tid % n_node the first time it asks
+ */
+const bwaidx_t *bwa_numa_local(const bwa_numa_t *nm, int tid) {
+  int i = tid % nm->n_node;
+  if (numa_pinned != i) {
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &nm->cpus[i]) < 0 && bwa_verbose >= 2 && numa_pinned == -1)
+      fprintf(stderr, "[W::%s] fail to pin thread %d to node %d\n", __func__, tid, nm->node[i]);
+    numa_pinned = i;
+  }
+  return nm->idx[i];
+}
+
+/**
+ * Place a pac that is not part of the index image, the merged pac of an
+ * add-on, as the index is placed: interleaved, or copied to every node
+ * @param pac  l bytes, left to the caller
+ */
+void bwa_numa_add_pac(bwa_numa_t *nm, uint8_t *pac, int64_t l) {
+  int i;
+  nm->pac = calloc(nm->n_node, sizeof(uint8_t*));
+  nm->l_pac = l;
+  if (nm->mode == BWA_NUMA_INTERLEAVE) {
+    if (numa_mbind(pac, l, MPOL_INTERLEAVE, nm->node, nm->n_node) < 0 && bwa_verbose >= 2)
+      fprintf(stderr, "[W::%s] fail to interleave the merged pac over %d nodes\n", __func__, nm->n_node);
+    for (i = 0; i < nm->n_node; ++i) nm->pac[i] = pac;
+    return;
+  }
+  numa_mbind(pac, l, MPOL_BIND, nm->node, 1);
+  nm->pac[0] = pac;
+  for (i = 1; i < nm->n_node; ++i) {
+    uint8_t *mem = mmap(0, l, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) { // this node reads the first copy
+      if (bwa_verbose >= 2)
+        fprintf(stderr, "[W::%s] fail to allocate the merged pac copy for node %d\n", __func__, nm->node[i]);
+      nm->pac[i] = pac;
+      continue;
+    }
+    huge_advise(mem, l);
+    numa_mbind(mem, l, MPOL_BIND, nm->node + i, 1);
+    memcpy(mem, pac, l);
+    nm->pac[i] = mem;
+  }
+}
+
+/* pac given to bwa_numa_add_pac() for worker tid, as bwa_numa_local() */
+const uint8_t *bwa_numa_local_pac(const bwa_numa_t *nm, int tid) {
+  return nm->pac[tid % nm->n_node];
+}
+
+/* frees the copies; the index given to bwa_numa_init() and the pac given to
+ * bwa_numa_add_pac() are left to the caller */
+void bwa_numa_destroy(bwa_numa_t *nm) {
+  int i;
+  if (nm == 0) return;
+  if (nm->idx && nm->mode == BWA_NUMA_REPLICATE)
+    for (i = 1; i < nm->n_node; ++i) bwa_idx_destroy(nm->idx[i]);
+  if (nm->pac)
+    for (i = 1; i < nm->n_node; ++i)
+      if (nm->pac[i] != nm->pac[0]) munmap(nm->pac[i], nm->l_pac);
+  free(nm->pac);
+  free(nm->idx); free(nm->node); free(nm->cpus);
+  free(nm);
+}
@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include "bwa.h"
+#include "utils.h"
 
 int bwa_shm_stage(bwaidx_t *idx, const char *hint, const char *_tmpfn)
 {
@@ -26,15 +27,23 @@ int bwa_shm_stage(bwaidx_t *idx, const char *hint, const char *_tmpfn)
 		to_init = 1;
 	}
 	if (shmid < 0) return -1;
-	ftruncate(shmid, BWA_CTL_SIZE);
+	if (ftruncate(shmid, BWA_CTL_SIZE) < 0) {
+		close(shmid);
+		return -1;
+	}
 	shm = mmap(0, BWA_CTL_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm == MAP_FAILED) return -1;
 	cnt = (uint16_t*)shm;
 	if (to_init) {
 		memset(shm, 0, BWA_CTL_SIZE);
 		cnt[1] = 4;
 	}
 
-	if (idx->mem == 0) bwa_idx2mem(idx);
+	if (idx->mem == 0 && bwa_idx2mem(idx) < 0) {
+		munmap(shm, BWA_CTL_SIZE);
+		return -1;
+	}
 
 	if (tmpfn) {
 		FILE *fp;
@@ -53,18 +62,33 @@ int bwa_shm_stage(bwaidx_t *idx, const char *hint, const char *_tmpfn)
 	}
 
 	strcat(strcpy(path, "/bwaidx-"), name);
+	l = 8 + strlen(name) + 1;
+	if (cnt[1] + l > BWA_CTL_SIZE) {
+		fprintf(stderr, "[E::%s] too many indices in shared memory\n", __func__);
+		munmap(shm, BWA_CTL_SIZE);
+		return -1;
+	}
 	if ((shmid = shm_open(path, O_CREAT|O_RDWR|O_EXCL, 0644)) < 0) {
 		shm_unlink(path);
 		perror("shm_open()");
+		munmap(shm, BWA_CTL_SIZE);
+		return -1;
+	}
+	if (ftruncate(shmid, idx->l_mem) < 0) {
+		perror("ftruncate()");
+		close(shmid); shm_unlink(path);
+		munmap(shm, BWA_CTL_SIZE);
 		return -1;
 	}
-	l = 8 + strlen(name) + 1;
-	if (cnt[1] + l > BWA_CTL_SIZE) return -1;
-	memcpy(shm + cnt[1], &idx->l_mem, 8);
-	memcpy(shm + cnt[1] + 8, name, l - 8);
-	cnt[1] += l; ++cnt[0];
-	ftruncate(shmid, idx->l_mem);
 	shm_idx = mmap(0, idx->l_mem, PROT_READ|PROT_WRITE, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm_idx == MAP_FAILED) {
+		perror("mmap()");
+		shm_unlink(path);
+		munmap(shm, BWA_CTL_SIZE);
+		return -1;
+	}
+	huge_advise(shm_idx, idx->l_mem); // honored if shmem_enabled is 'advise'
 	if (tmpfn) {
 		FILE *fp;
 		fp = fopen(tmpfn, "rb");
@@ -79,8 +103,15 @@ int bwa_shm_stage(bwaidx_t *idx, const char *hint, const char *_tmpfn)
 		memcpy(shm_idx, idx->mem, idx->l_mem);
 		free(idx->mem);
 	}
+	free(idx->bns->anns); free(idx->bns); // reallocated by bwa_mem2idx()
 	bwa_mem2idx(idx->l_mem, shm_idx, idx);
 	idx->is_shm = 1;
+
+	// only register the index once its content is in place
+	memcpy(shm + cnt[1], &idx->l_mem, 8);
+	memcpy(shm + cnt[1] + 8, name, l - 8);
+	cnt[1] += l; ++cnt[0];
+	munmap(shm, BWA_CTL_SIZE);
 	return 0;
 }
 
@@ -99,18 +130,26 @@ bwaidx_t *bwa_idx_load_from_shm(const char *hint)
 	++name;
 	if ((shmid = shm_open("/bwactl", O_RDONLY, 0)) < 0) return 0;
 	shm = mmap(0, BWA_CTL_SIZE, PROT_READ, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm == MAP_FAILED) return 0;
 	cnt = (uint16_t*)shm;
-	if (cnt[0] == 0) return 0;
 	for (i = 0, p = (char*)(shm + 4); i < cnt[0]; ++i) {
 		memcpy(&l_mem, p, 8); p += 8;
 		if (strcmp(p, name) == 0) break;
 		p += strlen(p) + 1;
 	}
-	if (i == cnt[0]) return 0;
+	if (i == cnt[0]) {
+		munmap(shm, BWA_CTL_SIZE);
+		return 0;
+	}
+	munmap(shm, BWA_CTL_SIZE);
 
 	strcat(strcpy(path, "/bwaidx-"), name);
 	if ((shmid = shm_open(path, O_RDONLY, 0)) < 0) return 0;
 	shm_idx = mmap(0, l_mem, PROT_READ, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm_idx == MAP_FAILED) return 0;
+	huge_advise(shm_idx, l_mem);
 	idx = calloc(1, sizeof(bwaidx_t));
 	bwa_mem2idx(l_mem, shm_idx, idx);
 	idx->is_shm = 1;
@@ -129,11 +168,17 @@ int bwa_shm_test(const char *hint)
 	++name;
 	if ((shmid = shm_open("/bwactl", O_RDONLY, 0)) < 0) return 0;
 	shm = mmap(0, BWA_CTL_SIZE, PROT_READ, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm == MAP_FAILED) return 0;
 	cnt = (uint16_t*)shm;
 	for (i = 0, p = shm + 4; i < cnt[0]; ++i) {
-		if (strcmp(p + 8, name) == 0) return 1;
-		p += strlen(p) + 9;
+		if (strcmp(p + 8, name) == 0) {
+			munmap(shm, BWA_CTL_SIZE);
+			return 1;
+		}
+		p += strlen(p + 8) + 9;
 	}
+	munmap(shm, BWA_CTL_SIZE);
 	return 0;
 }
 
@@ -144,6 +189,8 @@ int bwa_shm_list(void)
 	char *p, *shm;
 	if ((shmid = shm_open("/bwactl", O_RDONLY, 0)) < 0) return -1;
 	shm = mmap(0, BWA_CTL_SIZE, PROT_READ, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm == MAP_FAILED) return -1;
 	cnt = (uint16_t*)shm;
 	for (i = 0, p = shm + 4; i < cnt[0]; ++i) {
 		int64_t l_mem;
@@ -151,6 +198,7 @@ int bwa_shm_list(void)
 		printf("%s\t%ld\n", p, (long)l_mem);
 		p += strlen(p) + 1;
 	}
+	munmap(shm, BWA_CTL_SIZE);
 	return 0;
 }
 
@@ -163,6 +211,8 @@ int bwa_shm_destroy(void)
 
 	if ((shmid = shm_open("/bwactl", O_RDONLY, 0)) < 0) return -1;
 	shm = mmap(0, BWA_CTL_SIZE, PROT_READ, MAP_SHARED, shmid, 0);
+	close(shmid);
+	if (shm == MAP_FAILED) return -1;
 	cnt = (uint16_t*)shm;
 	for (i = 0, p = shm + 4; i < cnt[0]; ++i) {
 		int64_t l_mem;
@@ -178,17 +228,21 @@ int bwa_shm_destroy(void)
 
 int main_shm(int argc, char *argv[])
 {
-	int c, to_list = 0, to_drop = 0, ret = 0;
+	int c, to_list = 0, to_drop = 0, to_test = 0, ret = 0;
 	char *tmpfn = 0;
-	while ((c = getopt(argc, argv, "ldf:")) >= 0) {
+	while ((c = getopt(argc, argv, "ldtf:")) >= 0) {
 		if (c == 'l') to_list = 1;
 		else if (c == 'd') to_drop = 1;
+		else if (c == 't') to_test = 1;
 		else if (c == 'f') tmpfn = optarg;
 	}
 	if (optind == argc && !to_list && !to_drop) {
-		fprintf(stderr, "\nUsage: bwa shm [-d|-l] [-f tmpFile] [idxbase]\n\n");
+		fprintf(stderr, "\nUsage: biscuit shm [-d|-l] [-t] [-f tmpFile] [idxbase]\n\n");
+		fprintf(stderr, "Stage both strands of a BISCUIT index in shared memory so that\n");
+		fprintf(stderr, "subsequent 'biscuit align' runs attach to it instead of loading from disk.\n\n");
 		fprintf(stderr, "Options: -d       destroy all indices in shared memory\n");
 		fprintf(stderr, "         -l       list names of indices in shared memory\n");
+		fprintf(stderr, "         -t       test if 'idxbase' is in shared memory (exit 0 if so)\n");
 		fprintf(stderr, "         -f FILE  temporary file to reduce peak memory\n\n");
 		return 1;
 	}
@@ -196,10 +250,19 @@ int main_shm(int argc, char *argv[])
 		fprintf(stderr, "[E::%s] open -l or -d cannot be used when 'idxbase' is present\n", __func__);
 		return 1;
 	}
+	if (optind < argc && to_test) {
+		ret = bwa_shm_test(argv[optind])? 0 : 1;
+		if (bwa_verbose >= 3)
+			fprintf(stderr, "[M::%s] index '%s' is %sin shared memory\n", __func__, argv[optind], ret? "not " : "");
+		return ret;
+	}
 	if (optind < argc) {
 		if (bwa_shm_test(argv[optind]) == 0) {
 			bwaidx_t *idx;
-			idx = bwa_idx_load_from_disk(argv[optind], BWA_IDX_ALL);
+			if ((idx = bwa_idx_load_from_disk(argv[optind], BWA_IDX_ALL)) == 0) {
+				fprintf(stderr, "[E::%s] failed to load the index '%s'\n", __func__, argv[optind]);
+				return 1;
+			}
 			if (bwa_shm_stage(idx, argv[optind], tmpfn) < 0) {
 				fprintf(stderr, "[E::%s] failed to stage the index in shared memory\n", __func__);
 				ret = 1;
@@ -54,15 +54,29 @@ void bwt_gen_cnt_table(bwt_t *bwt) {
 static inline bwtint_t bwt_invPsi(const bwt_t *bwt, bwtint_t k) // compute inverse CSA
 {
 	bwtint_t x = k - (k > bwt->primary);
-	x = bwt_B0(bwt, x);
+	x = bwt->occ_n == 3? bwt3_B0(bwt, x) : bwt_B0(bwt, x);
 	x = bwt->L2[x] + bwt_occ(bwt, k, x);
 	return k == bwt->primary? 0 : x;
 }
 
-// bwt->bwt and bwt->occ must be precalculated
-void bwt_cal_sa(bwt_t *bwt, int intv)
+// smallest width that holds every SA value, i.e. 0..seq_len
+int bwt_sa_bits(bwtint_t seq_len)
+{
+	int w;
+	for (w = 1; w < 64 && seq_len >> w; ++w);
+	return w;
+}
+
+static inline void bwt_sa_put(bwt_t *bwt, bwtint_t i, bwtint_t x)
+{
+	bwtint_t b = i * bwt->sa_width;
+	int sh = b & 63;
+	bwt->sa[b>>6] |= x << sh;
+	if (sh + bwt->sa_width > 64) bwt->sa[(b>>6) + 1] |= x >> (64 - sh);
+}
+
+static void bwt_cal_sa_init(bwt_t *bwt, int intv)
 {
-	bwtint_t isa, sa, i; // S(isa) = sa
 	int intv_round = intv;
 
 	kv_roundup32(intv_round);
@@ -72,16 +86,118 @@ void bwt_cal_sa(bwt_t *bwt, int intv)
 	if (bwt->sa) free(bwt->sa);
 	bwt->sa_intv = intv;
 	bwt->n_sa = (bwt->seq_len + intv) / intv;
-	bwt->sa = (bwtint_t*)calloc(bwt->n_sa, sizeof(bwtint_t));
+	bwt->sa_width = bwt_sa_bits(bwt->seq_len);
+	bwt->sa = (bwtint_t*)huge_malloc(bwt_sa_words(bwt) * sizeof(bwtint_t));
+	memset(bwt->sa, 0, bwt_sa_words(bwt) * sizeof(bwtint_t));
+}
+
+// bwt->bwt and bwt->occ must be precalculated
+void bwt_cal_sa(bwt_t *bwt, int intv)
+{
+	bwtint_t isa, sa, i; // S(isa) = sa
+
+	bwt_cal_sa_init(bwt, intv);
 	// calculate SA value
 	isa = 0; sa = bwt->seq_len;
 	for (i = 0; i < bwt->seq_len; ++i) {
-		if (isa % intv == 0) bwt->sa[isa/intv] = sa;
+		if (isa % intv == 0) bwt_sa_put(bwt, isa/intv, sa);
 		--sa;
 		isa = bwt_invPsi(bwt, isa);
 	}
-	if (isa % intv == 0) bwt->sa[isa/intv] = sa;
-	bwt->sa[0] = (bwtint_t)-1; // before this line, bwt->sa[0] = bwt->seq_len
+	if (isa % intv == 0) bwt_sa_put(bwt, isa/intv, sa);
+	// entry 0 keeps seq_len; bwt_sa_entry() reads it as -1
+}
+
+/* Threaded SA sampling. The LF walk of bwt_cal_sa() can only start where the
+ * row of a text position is known. Such anchors are found by searching the
+ * text backward from evenly spaced positions until the match is unique;
+ * the stretches between anchors are then walked concurrently. */
+
+#define BWT_SA_SEG_PER_THREAD 16
+#ifndef BWT_SA_ANCHOR_MAX
+#define BWT_SA_ANCHOR_MAX     0x10000 // give up on an anchor inside longer repeats
+#endif
+
+#define bwt_pac_get(pac, l) ((pac)[(l)>>2] >> ((~(l)&3)<<1) & 3)
+
+typedef struct { bwtint_t pos, row; } bwt_sa_anchor_t;
+
+typedef struct {
+	bwt_t *bwt;
+	const uint8_t *pac;
+	int intv, n;
+	bwt_sa_anchor_t *a; // n anchors; pos == (bwtint_t)-1 if none was found
+} bwt_sa_mt_t;
+
+static inline void bwt_sa_put_sync(bwt_t *bwt, bwtint_t i, bwtint_t x)
+{
+	bwtint_t b = i * bwt->sa_width;
+	int sh = b & 63;
+	__sync_fetch_and_or(&bwt->sa[b>>6], x << sh); // neighboring entries share words
+	if (sh + bwt->sa_width > 64) __sync_fetch_and_or(&bwt->sa[(b>>6) + 1], x >> (64 - sh));
+}
+
+static void bwt_sa_anchor_worker(void *data, int j, int tid)
+{
+	bwt_sa_mt_t *w = (bwt_sa_mt_t*)data;
+	const bwt_t *bwt = w->bwt;
+	bwtint_t k = 0, l = bwt->seq_len, ok, ol, p, e;
+	(void)tid;
+	p = e = bwt->seq_len / w->n * (j + 1);
+	w->a[j].pos = (bwtint_t)-1;
+	while (p > 0 && e - p < BWT_SA_ANCHOR_MAX) {
+		ubyte_t c = bwt_pac_get(w->pac, p - 1);
+		bwt_2occ(bwt, k - 1, l, c, &ok, &ol);
+		k = bwt->L2[c] + ok + 1;
+		l = bwt->L2[c] + ol;
+		--p;
+		if (k == l) { // text[p..e) is unique: k is the row of suffix p
+			w->a[j].pos = p; w->a[j].row = k;
+			break;
+		}
+	}
+}
+
+static void bwt_sa_walk_worker(void *data, int j, int tid)
+{
+	bwt_sa_mt_t *w = (bwt_sa_mt_t*)data;
+	bwtint_t isa, sa, lo;
+	int i;
+	(void)tid;
+	if (j < w->n && w->a[j].pos == (bwtint_t)-1) return; // merged into the next stretch
+	if (j < w->n) isa = w->a[j].row, sa = w->a[j].pos;
+	else isa = 0, sa = w->bwt->seq_len;
+	for (i = j - 1; i >= 0 && w->a[i].pos == (bwtint_t)-1; --i);
+	lo = i >= 0? w->a[i].pos + 1 : 0; // the walk from the previous anchor records lo-1 and down
+	for (;;) {
+		if (isa % w->intv == 0) bwt_sa_put_sync(w->bwt, isa/w->intv, sa);
+		if (sa == lo) break;
+		--sa;
+		isa = bwt_invPsi(w->bwt, isa);
+	}
+}
+
+/**
+ * bwt_cal_sa() with n_threads threads
+ * @param pac  the text bwt was built from, 2-bit packed as in .pac files;
+ *             if 0 or n_threads < 2, the SA is sampled by a single walk
+ */
+void bwt_cal_sa_mt(bwt_t *bwt, int intv, const uint8_t *pac, int n_threads)
+{
+	extern void kt_for(int n_threads, void (*func)(void*,int,int), void *data, int n);
+	bwt_sa_mt_t w;
+
+	if (pac == 0 || n_threads < 2 || bwt->seq_len < (bwtint_t)n_threads * BWT_SA_SEG_PER_THREAD * BWT_SA_ANCHOR_MAX) {
+		bwt_cal_sa(bwt, intv);
+		return;
+	}
+	bwt_cal_sa_init(bwt, intv);
+	w.bwt = bwt; w.pac = pac; w.intv = intv;
+	w.n = n_threads * BWT_SA_SEG_PER_THREAD - 1; // plus the stretch ending at seq_len
+	w.a = (bwt_sa_anchor_t*)calloc(w.n, sizeof(bwt_sa_anchor_t));
+	kt_for(n_threads, bwt_sa_anchor_worker, &w, w.n); // stretches are longer than a search, so anchors stay in order
+	kt_for(n_threads, bwt_sa_walk_worker, &w, w.n + 1);
+	free(w.a);
 }
 
 bwtint_t bwt_sa(const bwt_t *bwt, bwtint_t k)
@@ -91,9 +207,48 @@ bwtint_t bwt_sa(const bwt_t *bwt, bwtint_t k)
 		++sa;
 		k = bwt_invPsi(bwt, k);
 	}
-	/* without setting bwt->sa[0] = -1, the following line should be
-	   changed to (sa + bwt->sa[k/bwt->sa_intv]) % (bwt->seq_len + 1) */
-	return sa + bwt->sa[k/bwt->sa_intv];
+	/* as bwt_sa_entry(bwt, 0) == -1, the following line does not need to be
+	   (sa + SA[k/bwt->sa_intv]) % (bwt->seq_len + 1) */
+	return sa + bwt_sa_entry(bwt, k/bwt->sa_intv);
+}
+
+/* Resolve sa[i] = bwt_sa(bwt, k[i]) for n positions; k and sa may be the
+ * same array. Up to BWT_SA_LANES LF walks are in flight at a time. After
+ * each step a walk prefetches the block of its next step, or its sampled
+ * SA entry when it is done, so the cache misses of all walks overlap. */
+#define BWT_SA_LANES 32
+void bwt_sa_batch(const bwt_t *bwt, int64_t n, const bwtint_t *k, bwtint_t *sa)
+{
+	bwtint_t mask = bwt->sa_intv - 1, cur[BWT_SA_LANES];
+	int64_t idx[BWT_SA_LANES], next = 0;
+	uint8_t fin[BWT_SA_LANES];
+	int i, n_lanes = 0;
+
+	for (;;) {
+		while (n_lanes < BWT_SA_LANES && next < n) { // refill the free lanes
+			cur[n_lanes] = k[next];
+			fin[n_lanes] = !(cur[n_lanes] & mask);
+			if (fin[n_lanes]) __builtin_prefetch(bwt_sa_word(bwt, cur[n_lanes]/bwt->sa_intv));
+			else bwt_prefetch_occ(bwt, cur[n_lanes]);
+			idx[n_lanes++] = next;
+			sa[next++] = 0;
+		}
+		if (n_lanes == 0) break;
+		for (i = 0; i < n_lanes;) {
+			if (fin[i]) { // the sampled entry was prefetched in the previous round
+				sa[idx[i]] += bwt_sa_entry(bwt, cur[i]/bwt->sa_intv);
+				--n_lanes;
+				cur[i] = cur[n_lanes]; fin[i] = fin[n_lanes]; idx[i] = idx[n_lanes];
+				continue;
+			}
+			cur[i] = bwt_invPsi(bwt, cur[i]);
+			++sa[idx[i]];
+			fin[i] = !(cur[i] & mask);
+			if (fin[i]) __builtin_prefetch(bwt_sa_word(bwt, cur[i]/bwt->sa_intv));
+			else bwt_prefetch_occ(bwt, cur[i]);
+			++i;
+		}
+	}
 }
 
 static inline int __occ_aux(uint64_t y, int c)
@@ -105,11 +260,355 @@ static inline int __occ_aux(uint64_t y, int c)
 	return ((y + (y >> 4)) & 0xf0f0f0f0f0f0f0full) * 0x101010101010101ull >> 56;
 }
 
+/*****************************************
+ * Three-letter occurrence kernels       *
+ * same algorithms as the 4-symbol ones, *
+ * with 3 counters per 128-base block    *
+ *****************************************/
+
+static bwtint_t bwt3_occ(const bwt_t *bwt, bwtint_t k, ubyte_t c)
+{
+	bwtint_t n;
+	uint32_t *p, *end;
+
+	if (c == bwt->absent || k == (bwtint_t)(-1)) return 0;
+	if (k == bwt->seq_len) return bwt->L2[c+1] - bwt->L2[c];
+	k -= (k >= bwt->primary); // because $ is not in bwt
+
+	n = ((bwtint_t*)(p = bwt3_occ_intv(bwt, k)))[bwt3_slot(bwt, c)];
+	p += BWT3_OCC_SIZE;
+	end = p + (((k>>5) - ((k&~OCC_INTV_MASK)>>5))<<1);
+	for (; p < end; p += 2) n += __occ_aux((uint64_t)p[0]<<32 | p[1], c);
+	n += __occ_aux(((uint64_t)p[0]<<32 | p[1]) & ~((1ull<<((~k&31)<<1)) - 1), c);
+	if (c == 0) n -= ~k&31; // corrected for the masked bits
+	return n;
+}
+
+static void bwt3_2occ(const bwt_t *bwt, bwtint_t k, bwtint_t l, ubyte_t c, bwtint_t *ok, bwtint_t *ol)
+{
+	bwtint_t _k, _l;
+	_k = (k >= bwt->primary)? k-1 : k;
+	_l = (l >= bwt->primary)? l-1 : l;
+	if (c == bwt->absent) {
+		*ok = *ol = 0;
+	} else if (_l/OCC_INTERVAL != _k/OCC_INTERVAL || k == (bwtint_t)(-1) || l == (bwtint_t)(-1)) {
+		*ok = bwt3_occ(bwt, k, c);
+		*ol = bwt3_occ(bwt, l, c);
+	} else {
+		bwtint_t m, n, i, j;
+		uint32_t *p;
+		k = _k; l = _l;
+		n = ((bwtint_t*)(p = bwt3_occ_intv(bwt, k)))[bwt3_slot(bwt, c)];
+		p += BWT3_OCC_SIZE;
+		j = k >> 5 << 5;
+		for (i = k/OCC_INTERVAL*OCC_INTERVAL; i < j; i += 32, p += 2)
+			n += __occ_aux((uint64_t)p[0]<<32 | p[1], c);
+		m = n;
+		n += __occ_aux(((uint64_t)p[0]<<32 | p[1]) & ~((1ull<<((~k&31)<<1)) - 1), c);
+		if (c == 0) n -= ~k&31;
+		*ok = n;
+		j = l >> 5 << 5;
+		for (; i < j; i += 32, p += 2)
+			m += __occ_aux((uint64_t)p[0]<<32 | p[1], c);
+		m += __occ_aux(((uint64_t)p[0]<<32 | p[1]) & ~((1ull<<((~l&31)<<1)) - 1), c);
+		if (c == 0) m -= ~l&31;
+		*ol = m;
+	}
+}
+
+// load the three block counters into cnt[4], leaving the absent symbol at 0
+static inline void bwt3_load_occ(const bwt_t *bwt, const uint32_t *p, bwtint_t cnt[4])
+{
+	const bwtint_t *q = (const bwtint_t*)p;
+	int c, i;
+	for (c = i = 0; c < 4; ++c)
+		cnt[c] = c == bwt->absent? 0 : q[i++];
+}
+
+/**************************************************
+ * Runtime-dispatched in-block occurrence counting *
+ **************************************************/
+
+/* The kernels below count symbols among bases [0, r] of the 8 BWT words
+ * of one 128-base block and are picked once, at load time, from the CPU
+ * features. Masked-out bases read as A, so A is always derived from the
+ * other three counts. The bit-twiddling/cnt_table code above remains the
+ * fallback when no accelerated kernel is available. */
+
+typedef void (*occ4_blk_f)(const uint32_t *p, int r, bwtint_t cnt[4]);
+typedef bwtint_t (*occ1_blk_f)(const uint32_t *p, int r, int c);
+
+static occ4_blk_f occ4_blk = 0;
+static occ1_blk_f occ1_blk = 0;
+static const char *occ_impl_name = "scalar";
+
+#define OCC_M1 0x5555555555555555ull
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BWT_OCC_X86 1
+#define BWT_TARGET(x) __attribute__((target(x)))
+#else
+#define BWT_TARGET(x)
+#endif
+
+// 64-bit word holding bases 32w..32w+31 of the block, bases past r masked
+static inline uint64_t occ_blk_word(const uint32_t *p, int w, int r)
+{
+	uint64_t y = (uint64_t)p[w<<1]<<32 | p[w<<1|1];
+	return w < r>>5? y : y & ~((1ull<<((~r&31)<<1)) - 1);
+}
+
+BWT_TARGET("popcnt")
+static void occ4_blk_popcnt(const uint32_t *p, int r, bwtint_t cnt[4])
+{
+	int w;
+	bwtint_t n1 = 0, n2 = 0, n3 = 0;
+	for (w = 0; w <= r>>5; ++w) {
+		uint64_t y = occ_blk_word(p, w, r), lo = y & OCC_M1, hi = y >> 1 & OCC_M1;
+		n1 += __builtin_popcountll(lo & ~hi);
+		n2 += __builtin_popcountll(hi & ~lo);
+		n3 += __builtin_popcountll(hi & lo);
+	}
+	cnt[0] += r + 1 - n1 - n2 - n3;
+	cnt[1] += n1; cnt[2] += n2; cnt[3] += n3;
+}
+
+BWT_TARGET("popcnt")
+static bwtint_t occ1_blk_popcnt(const uint32_t *p, int r, int c)
+{
+	int w;
+	bwtint_t n = 0;
+	for (w = 0; w <= r>>5; ++w) {
+		uint64_t y = occ_blk_word(p, w, r);
+		y = ((c&2)? y : ~y) >> 1 & ((c&1)? y : ~y) & OCC_M1;
+		n += __builtin_popcountll(y);
+	}
+	if (c == 0) n -= ~r&31; // masked bases read as A
+	return n;
+}
+
+#ifdef BWT_OCC_X86
+
+// load the block's 8 BWT words keeping bases [0, r]; words past r are
+// not read at all, so the last block of the bwt array is never overrun
+BWT_TARGET("avx2")
+static inline __m256i occ_blk_load_avx2(const uint32_t *p, int r)
+{
+	const __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i wr = _mm256_set1_epi32(r>>4);
+	__m256i full = _mm256_cmpgt_epi32(wr, idx);
+	__m256i last = _mm256_and_si256(_mm256_cmpeq_epi32(wr, idx), _mm256_set1_epi32(~((1U<<((~r&15)<<1)) - 1)));
+	__m256i ld = _mm256_or_si256(full, _mm256_cmpeq_epi32(wr, idx));
+	return _mm256_and_si256(_mm256_maskload_epi32((const int*)p, ld), _mm256_or_si256(full, last));
+}
+
+BWT_TARGET("avx2")
+static inline __m256i popcnt8_avx2(__m256i v) // per-byte popcount
+{
+	const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i m4 = _mm256_set1_epi8(0x0f);
+	return _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, m4)),
+	                       _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), m4)));
+}
+
+BWT_TARGET("avx2")
+static inline bwtint_t hsum64_avx2(__m256i v)
+{
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	return (bwtint_t)_mm_cvtsi128_si64(s) + (bwtint_t)_mm_extract_epi64(s, 1);
+}
+
+BWT_TARGET("avx2")
+static void occ4_blk_avx2(const uint32_t *p, int r, bwtint_t cnt[4])
+{
+	const __m256i m1 = _mm256_set1_epi32(0x55555555);
+	__m256i v = occ_blk_load_avx2(p, r), z = _mm256_setzero_si256();
+	__m256i lo = _mm256_and_si256(v, m1), hi = _mm256_and_si256(_mm256_srli_epi32(v, 1), m1);
+	bwtint_t n1, n2, n3;
+	// counts are at most 16 per byte lane for the 2-bit masks, so sum before sad
+	n1 = hsum64_avx2(_mm256_sad_epu8(popcnt8_avx2(_mm256_andnot_si256(hi, lo)), z));
+	n2 = hsum64_avx2(_mm256_sad_epu8(popcnt8_avx2(_mm256_andnot_si256(lo, hi)), z));
+	n3 = hsum64_avx2(_mm256_sad_epu8(popcnt8_avx2(_mm256_and_si256(hi, lo)), z));
+	cnt[0] += r + 1 - n1 - n2 - n3;
+	cnt[1] += n1; cnt[2] += n2; cnt[3] += n3;
+}
+
+BWT_TARGET("avx2")
+static bwtint_t occ1_blk_avx2(const uint32_t *p, int r, int c)
+{
+	const __m256i m1 = _mm256_set1_epi32(0x55555555);
+	__m256i v = occ_blk_load_avx2(p, r), y;
+	__m256i lo = _mm256_and_si256(v, m1), hi = _mm256_and_si256(_mm256_srli_epi32(v, 1), m1);
+	if (c == 0) { // A is what is left after C, G and T
+		y = _mm256_or_si256(lo, hi);
+		return r + 1 - hsum64_avx2(_mm256_sad_epu8(popcnt8_avx2(y), _mm256_setzero_si256()));
+	}
+	y = c == 1? _mm256_andnot_si256(hi, lo) : c == 2? _mm256_andnot_si256(lo, hi) : _mm256_and_si256(hi, lo);
+	return hsum64_avx2(_mm256_sad_epu8(popcnt8_avx2(y), _mm256_setzero_si256()));
+}
+
+#if defined(__GNUC__) && (__GNUC__ >= 8)
+#define BWT_OCC_AVX512 1
+
+BWT_TARGET("avx2,avx512f,avx512vl,avx512vpopcntdq")
+static void occ4_blk_avx512(const uint32_t *p, int r, bwtint_t cnt[4])
+{
+	const __m256i m1 = _mm256_set1_epi32(0x55555555);
+	__m256i v = occ_blk_load_avx2(p, r);
+	__m256i lo = _mm256_and_si256(v, m1), hi = _mm256_and_si256(_mm256_srli_epi32(v, 1), m1);
+	bwtint_t n1, n2, n3;
+	n1 = hsum64_avx2(_mm256_popcnt_epi64(_mm256_andnot_si256(hi, lo)));
+	n2 = hsum64_avx2(_mm256_popcnt_epi64(_mm256_andnot_si256(lo, hi)));
+	n3 = hsum64_avx2(_mm256_popcnt_epi64(_mm256_and_si256(hi, lo)));
+	cnt[0] += r + 1 - n1 - n2 - n3;
+	cnt[1] += n1; cnt[2] += n2; cnt[3] += n3;
+}
+
+BWT_TARGET("avx2,avx512f,avx512vl,avx512vpopcntdq")
+static bwtint_t occ1_blk_avx512(const uint32_t *p, int r, int c)
+{
+	const __m256i m1 = _mm256_set1_epi32(0x55555555);
+	__m256i v = occ_blk_load_avx2(p, r), y;
+	__m256i lo = _mm256_and_si256(v, m1), hi = _mm256_and_si256(_mm256_srli_epi32(v, 1), m1);
+	if (c == 0) return r + 1 - hsum64_avx2(_mm256_popcnt_epi64(_mm256_or_si256(lo, hi)));
+	y = c == 1? _mm256_andnot_si256(hi, lo) : c == 2? _mm256_andnot_si256(lo, hi) : _mm256_and_si256(hi, lo);
+	return hsum64_avx2(_mm256_popcnt_epi64(y));
+}
+#endif
+#endif /* BWT_OCC_X86 */
+
+/**
+ * Select the occurrence kernels; called once before the first query
+ * @param max_level  0: scalar, 1: POPCNT, 2: AVX2, 3: AVX-512 VPOPCNTDQ;
+ *                   the best level supported by the CPU up to max_level is used
+ * @return           name of the selected implementation
+ */
+const char *bwt_occ_dispatch(int max_level)
+{
+	occ4_blk = 0; occ1_blk = 0; occ_impl_name = "scalar";
+#ifdef BWT_OCC_X86
+	__builtin_cpu_init();
+#ifdef BWT_OCC_AVX512
+	if (max_level >= 3 && __builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("avx512vl")) {
+		occ4_blk = occ4_blk_avx512; occ1_blk = occ1_blk_avx512; occ_impl_name = "AVX-512 VPOPCNTDQ";
+		return occ_impl_name;
+	}
+#endif
+	if (max_level >= 2 && __builtin_cpu_supports("avx2")) {
+		occ4_blk = occ4_blk_avx2; occ1_blk = occ1_blk_avx2; occ_impl_name = "AVX2";
+	} else if (max_level >= 1 && __builtin_cpu_supports("popcnt")) {
+		occ4_blk = occ4_blk_popcnt; occ1_blk = occ1_blk_popcnt; occ_impl_name = "POPCNT";
+	}
+#elif defined(__aarch64__)
+	if (max_level >= 1) { // NEON cnt is always available
+		occ4_blk = occ4_blk_popcnt; occ1_blk = occ1_blk_popcnt; occ_impl_name = "POPCNT";
+	}
+#endif
+	return occ_impl_name;
+}
+
+const char *bwt_occ_impl(void)
+{
+	return occ_impl_name;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor)) static void bwt_occ_dispatch_init(void)
+{
+	bwt_occ_dispatch(3);
+}
+#endif
+
+// counters of the block holding k for either layout; returns its BWT words
+static inline const uint32_t *bwt_occ_blk(const bwt_t *bwt, bwtint_t k, bwtint_t cnt[4])
+{
+	const uint32_t *p;
+	if (bwt->occ_n == 3) {
+		p = bwt3_occ_intv(bwt, k);
+		bwt3_load_occ(bwt, p, cnt);
+		return p + BWT3_OCC_SIZE;
+	}
+	p = bwt_occ_intv(bwt, k);
+	memcpy(cnt, p, 4 * sizeof(bwtint_t));
+	return p + sizeof(bwtint_t);
+}
+
+static inline bwtint_t bwt_occ_blk1(const bwt_t *bwt, bwtint_t k, int c, const uint32_t **p)
+{
+	if (bwt->occ_n == 3) {
+		*p = bwt3_occ_intv(bwt, k) + BWT3_OCC_SIZE;
+		return ((const bwtint_t*)(*p - BWT3_OCC_SIZE))[bwt3_slot(bwt, c)];
+	}
+	*p = bwt_occ_intv(bwt, k) + sizeof(bwtint_t);
+	return ((const bwtint_t*)(*p - sizeof(bwtint_t)))[c];
+}
+
+static bwtint_t bwt_occ_fast(const bwt_t *bwt, bwtint_t k, ubyte_t c)
+{
+	const uint32_t *p;
+	bwtint_t n;
+	if (c == bwt->absent || k == (bwtint_t)(-1)) return 0;
+	if (k == bwt->seq_len) return bwt->L2[c+1] - bwt->L2[c];
+	k -= (k >= bwt->primary);
+	n = bwt_occ_blk1(bwt, k, c, &p);
+	return n + occ1_blk(p, k & OCC_INTV_MASK, c);
+}
+
+static void bwt_2occ_fast(const bwt_t *bwt, bwtint_t k, bwtint_t l, ubyte_t c, bwtint_t *ok, bwtint_t *ol)
+{
+	bwtint_t _k, _l, n;
+	const uint32_t *p;
+	_k = k - (k >= bwt->primary);
+	_l = l - (l >= bwt->primary);
+	if (c == bwt->absent) {
+		*ok = *ol = 0;
+	} else if (_l>>OCC_INTV_SHIFT != _k>>OCC_INTV_SHIFT || k == (bwtint_t)(-1) || l == (bwtint_t)(-1) || l == bwt->seq_len) {
+		*ok = bwt_occ_fast(bwt, k, c);
+		*ol = bwt_occ_fast(bwt, l, c);
+	} else {
+		n = bwt_occ_blk1(bwt, _k, c, &p);
+		*ok = n + occ1_blk(p, _k & OCC_INTV_MASK, c);
+		*ol = n + occ1_blk(p, _l & OCC_INTV_MASK, c);
+	}
+}
+
+static void bwt_occ4_fast(const bwt_t *bwt, bwtint_t k, bwtint_t cnt[4])
+{
+	const uint32_t *p;
+	if (k == (bwtint_t)(-1)) {
+		memset(cnt, 0, 4 * sizeof(bwtint_t));
+		return;
+	}
+	k -= (k >= bwt->primary);
+	p = bwt_occ_blk(bwt, k, cnt);
+	occ4_blk(p, k & OCC_INTV_MASK, cnt);
+}
+
+static void bwt_2occ4_fast(const bwt_t *bwt, bwtint_t k, bwtint_t l, bwtint_t cntk[4], bwtint_t cntl[4])
+{
+	bwtint_t _k, _l;
+	const uint32_t *p;
+	_k = k - (k >= bwt->primary);
+	_l = l - (l >= bwt->primary);
+	if (_l>>OCC_INTV_SHIFT != _k>>OCC_INTV_SHIFT || k == (bwtint_t)(-1) || l == (bwtint_t)(-1)) {
+		bwt_occ4_fast(bwt, k, cntk);
+		bwt_occ4_fast(bwt, l, cntl);
+	} else {
+		p = bwt_occ_blk(bwt, _k, cntk);
+		memcpy(cntl, cntk, 4 * sizeof(bwtint_t));
+		occ4_blk(p, _k & OCC_INTV_MASK, cntk);
+		occ4_blk(p, _l & OCC_INTV_MASK, cntl);
+	}
+}
+
 bwtint_t bwt_occ(const bwt_t *bwt, bwtint_t k, ubyte_t c)
 {
 	bwtint_t n;
 	uint32_t *p, *end;
 
+	if (occ1_blk) return bwt_occ_fast(bwt, k, c);
+	if (bwt->occ_n == 3) return bwt3_occ(bwt, k, c);
 	if (k == bwt->seq_len) return bwt->L2[c+1] - bwt->L2[c];
 	if (k == (bwtint_t)(-1)) return 0;
 	k -= (k >= bwt->primary); // because $ is not in bwt
@@ -133,6 +632,14 @@ bwtint_t bwt_occ(const bwt_t *bwt, bwtint_t k, ubyte_t c)
 void bwt_2occ(const bwt_t *bwt, bwtint_t k, bwtint_t l, ubyte_t c, bwtint_t *ok, bwtint_t *ol)
 {
 	bwtint_t _k, _l;
+	if (occ1_blk) {
+		bwt_2occ_fast(bwt, k, l, c, ok, ol);
+		return;
+	}
+	if (bwt->occ_n == 3) {
+		bwt3_2occ(bwt, k, l, c, ok, ol);
+		return;
+	}
 	_k = (k >= bwt->primary)? k-1 : k;
 	_l = (l >= bwt->primary)? l-1 : l;
 	if (_l/OCC_INTERVAL != _k/OCC_INTERVAL || k == (bwtint_t)(-1) || l == (bwtint_t)(-1)) {
@@ -168,12 +675,70 @@ void bwt_2occ(const bwt_t *bwt, bwtint_t k, bwtint_t l, ubyte_t c, bwtint_t *ok,
 	((bwt)->cnt_table[(b)&0xff] + (bwt)->cnt_table[(b)>>8&0xff]		\
 	 + (bwt)->cnt_table[(b)>>16&0xff] + (bwt)->cnt_table[(b)>>24])
 
+static void bwt3_occ4(const bwt_t *bwt, bwtint_t k, bwtint_t cnt[4])
+{
+	bwtint_t x;
+	uint32_t *p, tmp, *end;
+	if (k == (bwtint_t)(-1)) {
+		memset(cnt, 0, 4 * sizeof(bwtint_t));
+		return;
+	}
+	k -= (k >= bwt->primary); // because $ is not in bwt
+	p = bwt3_occ_intv(bwt, k);
+	bwt3_load_occ(bwt, p, cnt);
+	p += BWT3_OCC_SIZE;
+	end = p + ((k>>4) - ((k&~OCC_INTV_MASK)>>4));
+	for (x = 0; p < end; ++p) x += __occ_aux4(bwt, *p);
+	tmp = *p & ~((1U<<((~k&15)<<1)) - 1);
+	x += __occ_aux4(bwt, tmp) - (~k&15);
+	// the absent symbol's byte is always 0
+	cnt[0] += x&0xff; cnt[1] += x>>8&0xff; cnt[2] += x>>16&0xff; cnt[3] += x>>24;
+}
+
+static void bwt3_2occ4(const bwt_t *bwt, bwtint_t k, bwtint_t l, bwtint_t cntk[4], bwtint_t cntl[4])
+{
+	bwtint_t _k, _l;
+	_k = k - (k >= bwt->primary);
+	_l = l - (l >= bwt->primary);
+	if (_l>>OCC_INTV_SHIFT != _k>>OCC_INTV_SHIFT || k == (bwtint_t)(-1) || l == (bwtint_t)(-1)) {
+		bwt3_occ4(bwt, k, cntk);
+		bwt3_occ4(bwt, l, cntl);
+	} else {
+		bwtint_t x, y;
+		uint32_t *p, tmp, *endk, *endl;
+		k = _k; l = _l;
+		p = bwt3_occ_intv(bwt, k);
+		bwt3_load_occ(bwt, p, cntk);
+		p += BWT3_OCC_SIZE;
+		endk = p + ((k>>4) - ((k&~OCC_INTV_MASK)>>4));
+		endl = p + ((l>>4) - ((l&~OCC_INTV_MASK)>>4));
+		for (x = 0; p < endk; ++p) x += __occ_aux4(bwt, *p);
+		y = x;
+		tmp = *p & ~((1U<<((~k&15)<<1)) - 1);
+		x += __occ_aux4(bwt, tmp) - (~k&15);
+		for (; p < endl; ++p) y += __occ_aux4(bwt, *p);
+		tmp = *p & ~((1U<<((~l&15)<<1)) - 1);
+		y += __occ_aux4(bwt, tmp) - (~l&15);
+		memcpy(cntl, cntk, 4 * sizeof(bwtint_t));
+		cntk[0] += x&0xff; cntk[1] += x>>8&0xff; cntk[2] += x>>16&0xff; cntk[3] += x>>24;
+		cntl[0] += y&0xff; cntl[1] += y>>8&0xff; cntl[2] += y>>16&0xff; cntl[3] += y>>24;
+	}
+}
+
 // k is the BWT position
 // cnt is the occurrence for each alphabet
 void bwt_occ4(const bwt_t *bwt, bwtint_t k, bwtint_t cnt[4])
 {
 	bwtint_t x;
 	uint32_t *p, tmp, *end;
+	if (occ4_blk) {
+		bwt_occ4_fast(bwt, k, cnt);
+		return;
+	}
+	if (bwt->occ_n == 3) {
+		bwt3_occ4(bwt, k, cnt);
+		return;
+	}
 	if (k == (bwtint_t)(-1)) {
 		memset(cnt, 0, 4 * sizeof(bwtint_t));
 		return;
@@ -204,6 +769,14 @@ void bwt_occ4(const bwt_t *bwt, bwtint_t k, bwtint_t cnt[4])
 void bwt_2occ4(const bwt_t *bwt, bwtint_t k, bwtint_t l, bwtint_t cntk[4], bwtint_t cntl[4])
 {
 	bwtint_t _k, _l;
+	if (occ4_blk) {
+		bwt_2occ4_fast(bwt, k, l, cntk, cntl);
+		return;
+	}
+	if (bwt->occ_n == 3) {
+		bwt3_2occ4(bwt, k, l, cntk, cntl);
+		return;
+	}
 	_k = k - (k >= bwt->primary);
 	_l = l - (l >= bwt->primary);
 	if (_l>>OCC_INTV_SHIFT != _k>>OCC_INTV_SHIFT || k == (bwtint_t)(-1) || l == (bwtint_t)(-1)) {
@@ -292,7 +865,7 @@ void bwt_extend(const bwt_t *bwt, const bwtintv_t *ik, bwtintv_t ok[4], int is_b
 	ok[0].x[is_back] = ok[1].x[is_back] + ok[1].x[2];
 }
 
-static void bwt_reverse_intvs(bwtintv_v *p) {
+void bwt_reverse_intvs(bwtintv_v *p) {
   if (p->n > 1) {
     int j;
     for (j = 0; (unsigned) j < p->n>>1; ++j) {
@@ -307,6 +880,7 @@ static void bwt_reverse_intvs(bwtintv_v *p) {
 int bwt_smem1a(const bwt_t *bwt, const bwt_t *bwtc, int len, const uint8_t *q, int x, int min_intv, uint64_t max_intv, bwtintv_v *mem, bwtintv_v *tmpvec[2]) {
 
   int i, j, c, ret;
+  bwtint_t u;
   bwtintv_t ik, ok[4];
   bwtintv_v a[2], *prev, *curr, *swap;
 
@@ -318,20 +892,21 @@ int bwt_smem1a(const bwt_t *bwt, const bwt_t *bwtc, int len, const uint8_t *q, i
   curr = tmpvec && tmpvec[1]? tmpvec[1] : &a[1];
   bwt_set_intv(bwt, bwtc, q[x], ik); // the initial interval of a single base
   ik.info = x + 1;
+  u = bwt_kmer_child(bwt, 0, 0, q[x]);
 
   for (i = x + 1, curr->n = 0; i < len; ++i) { // forward search
     if (ik.x[2] < max_intv) { // an interval small enough, currently won't come here
       kv_push(bwtintv_t, *curr, ik);
       break;
     } else if (q[i] < 4) { // an A/C/G/T base
-      c = 3 - q[i]; // complement of q[i]
-      bwt_extend(bwtc, &ik, ok, 0);
-      if (ok[c].x[2] != ik.x[2]) { // change of the interval size
+      u = bwt_kmer_child(bwt, u, i - x, q[i]);
+      bwt_extend_fwd(bwt, bwtc, u, &ik, q[i], &ok[0]);
+      if (ok[0].x[2] != ik.x[2]) { // change of the interval size
         kv_push(bwtintv_t, *curr, ik);
         // no more matches
-        if (ok[c].x[2] < (unsigned) min_intv) break; // the interval size is too small to be extended further
+        if (ok[0].x[2] < (unsigned) min_intv) break; // the interval size is too small to be extended further
       }
-      ik = ok[c]; ik.info = i + 1;
+      ik = ok[0]; ik.info = i + 1;
     } else { // an ambiguous base
       kv_push(bwtintv_t, *curr, ik);
       break; // always terminate extension at an ambiguous base; in this case, i<len always stands
@@ -374,22 +949,24 @@ int bwt_smem1(const bwt_t *bwt, const bwt_t *bwtc, int len, const uint8_t *q, in
 }
 
 int bwt_seed_strategy1(const bwt_t *bwt, const bwt_t *bwtc, int len, const uint8_t *q, int x, int min_len, int max_intv, bwtintv_t *mem) {
-  int i, c;
-  bwtintv_t ik, ok[4];
+  int i;
+  bwtint_t u;
+  bwtintv_t ik, ok;
 
   memset(mem, 0, sizeof(bwtintv_t));
   if (q[x] > 3) return x + 1;
   bwt_set_intv(bwt, bwtc, q[x], ik); // the initial interval of a single base
+  u = bwt_kmer_child(bwt, 0, 0, q[x]);
   for (i = x + 1; i < len; ++i) { // forward search
     if (q[i] < 4) { // an A/C/G/T base
-      c = 3 - q[i]; // complement of q[i]
-      bwt_extend(bwtc, &ik, ok, 0);
-      if (ok[c].x[2] < (unsigned) max_intv && i - x >= min_len) {
-        *mem = ok[c];
+      u = bwt_kmer_child(bwt, u, i - x, q[i]);
+      bwt_extend_fwd(bwt, bwtc, u, &ik, q[i], &ok);
+      if (ok.x[2] < (unsigned) max_intv && i - x >= min_len) {
+        *mem = ok;
         mem->info = (uint64_t)x<<32 | (i + 1);
         return i + 1;
       }
-      ik = ok[c];
+      ik = ok;
     } else return i + 1;
   }
   return len;
@@ -409,14 +986,25 @@ void bwt_dump_bwt(const char *fn, const bwt_t *bwt) {
   err_fclose(fp);
 }
 
+/* A packed .sa starts with BWT_SA_MAGIC, whose last byte is the format
+ * version, in place of the primary of the unpacked format. Older loaders
+ * then stop at their primary check instead of misreading the file. The
+ * 64-bit field after L2 holds sa_intv in its lower half and the width of
+ * the packed entries in its upper half; the packed words follow. Files
+ * with width 0 are unpacked, with plain 64-bit entries from 1 on. */
+#define BWT_SA_MAGIC   "BISSA\0\0\1"
+#define BWT_SA_VERSION 1
+
 void bwt_dump_sa(const char *fn, const bwt_t *bwt) {
   FILE *fp;
+  uint64_t x = (uint64_t)bwt->sa_width << 32 | (uint32_t)bwt->sa_intv;
   fp = xopen(fn, "wb");
+  err_fwrite(BWT_SA_MAGIC, 1, 8, fp);
   err_fwrite(&bwt->primary, sizeof(bwtint_t), 1, fp);
   err_fwrite(bwt->L2+1, sizeof(bwtint_t), 4, fp);
-  err_fwrite(&bwt->sa_intv, sizeof(bwtint_t), 1, fp);
+  err_fwrite(&x, sizeof(bwtint_t), 1, fp);
   err_fwrite(&bwt->seq_len, sizeof(bwtint_t), 1, fp);
-  err_fwrite(bwt->sa + 1, sizeof(bwtint_t), bwt->n_sa - 1, fp);
+  err_fwrite(bwt->sa, sizeof(bwtint_t), bwt_sa_words(bwt), fp);
   err_fflush(fp);
   err_fclose(fp);
 }
@@ -435,24 +1023,135 @@ static bwtint_t fread_fix(FILE *fp, bwtint_t size, void *a) { // Mac/Darwin has
 void bwt_restore_sa(const char *fn, bwt_t *bwt) {
   char skipped[256];
   FILE *fp;
-  bwtint_t primary;
+  bwtint_t primary, i;
+  uint64_t x;
+  int packed;
 
   fp = xopen(fn, "rb");
   err_fread_noeof(&primary, sizeof(bwtint_t), 1, fp);
+  packed = memcmp(&primary, BWT_SA_MAGIC, 5) == 0; // a primary is never this large
+  if (packed) {
+    xassert(((uint8_t*)&primary)[7] == BWT_SA_VERSION, "unsupported SA file version; rebuild the index.");
+    err_fread_noeof(&primary, sizeof(bwtint_t), 1, fp);
+  }
   xassert(primary == bwt->primary, "SA-BWT inconsistency: primary is not the same.");
   err_fread_noeof(skipped, sizeof(bwtint_t), 4, fp); // skip
-  err_fread_noeof(&bwt->sa_intv, sizeof(bwtint_t), 1, fp);
+  err_fread_noeof(&x, sizeof(bwtint_t), 1, fp);
   err_fread_noeof(&primary, sizeof(bwtint_t), 1, fp);
   xassert(primary == bwt->seq_len, "SA-BWT inconsistency: seq_len is not the same.");
 
+  bwt->sa_intv = (uint32_t)x;
   bwt->n_sa = (bwt->seq_len + bwt->sa_intv) / bwt->sa_intv;
-  bwt->sa = (bwtint_t*)calloc(bwt->n_sa, sizeof(bwtint_t));
-  bwt->sa[0] = -1;
+  bwt->sa_width = bwt_sa_bits(bwt->seq_len);
+  if (x>>32) packed = 1; // also packed files from before the magic
+  xassert(!packed || x>>32 == bwt->sa_width, "SA-BWT inconsistency: unexpected SA entry width.");
+  bwt->sa = (bwtint_t*)huge_malloc(bwt_sa_words(bwt) * sizeof(bwtint_t));
 
-  fread_fix(fp, sizeof(bwtint_t) * (bwt->n_sa - 1), bwt->sa + 1);
+  if (packed) fread_fix(fp, sizeof(bwtint_t) * bwt_sa_words(bwt), bwt->sa);
+  else { // unpacked SA, pack it while reading
+    bwtint_t buf[0x1000];
+    memset(bwt->sa, 0, bwt_sa_words(bwt) * sizeof(bwtint_t));
+    for (i = 1; i < bwt->n_sa;) {
+      bwtint_t j, n = bwt->n_sa - i < 0x1000? bwt->n_sa - i : 0x1000;
+      err_fread_noeof(buf, sizeof(bwtint_t), n, fp);
+      for (j = 0; j < n; ++j, ++i) bwt_sa_put(bwt, i, buf[j]);
+    }
+  }
   err_fclose(fp);
 }
 
+/***************
+ * k-mer table *
+ ***************/
+
+/**
+ * Tabulate the bi-intervals of all strings up to length k on the alphabet of
+ * bwt, i.e. without the symbol that does not occur in its text
+ * @param bwt   strand to seed against; receives the table
+ * @param bwtc  the other strand, used for forward extension as in seeding
+ */
+void bwt_kmer_build(bwt_t *bwt, const bwt_t *bwtc, int k)
+{
+	bwtint_t u, lo, hi;
+	int c, l, sigma;
+
+	xassert(k >= 0 && k <= BWT_KMER_MAX, "k-mer table length is out of range.");
+	free(bwt->kmer); bwt->kmer = 0;
+	bwt->kmer_k = k; // bwt->kmer_absent is set by bwt_set_layout()
+	if (k == 0) return;
+	bwt->kmer = (bwtint_t*)huge_malloc(bwt_kmer_len(bwt) * sizeof(bwtint_t));
+	memset(bwt->kmer, 0, bwt_kmer_len(bwt) * sizeof(bwtint_t));
+	sigma = bwt_kmer_sigma(bwt);
+
+	for (c = 0; c < 4; ++c) { // single bases, as bwt_set_intv()
+		bwtintv_t ik;
+		if ((u = bwt_kmer_child(bwt, 0, 0, c)) == BWT_KMER_NONE) continue;
+		bwt_set_intv(bwt, bwtc, c, ik);
+		memcpy(bwt_kmer_intv(bwt, u), ik.x, 3 * sizeof(bwtint_t));
+	}
+	for (l = 1, lo = 1, hi = sigma; l < k; ++l, lo = hi + 1, hi = hi * sigma + sigma) {
+		for (u = lo; u <= hi; ++u) { // extend every string of length l, empty intervals included
+			bwtintv_t ik, ok[4];
+			memcpy(ik.x, bwt_kmer_intv(bwt, u), 3 * sizeof(bwtint_t));
+			bwt_extend(bwtc, &ik, ok, 0);
+			for (c = 0; c < 4; ++c) {
+				bwtint_t v = bwt_kmer_child(bwt, u, l, c);
+				if (v != BWT_KMER_NONE) memcpy(bwt_kmer_intv(bwt, v), ok[3-c].x, 3 * sizeof(bwtint_t));
+			}
+		}
+	}
+}
+
+void bwt_dump_kmer(const char *fn, const bwt_t *bwt) {
+  FILE *fp;
+  int32_t x[2];
+  x[0] = bwt->kmer_k; x[1] = bwt->kmer_absent;
+  fp = xopen(fn, "wb");
+  err_fwrite(&bwt->primary, sizeof(bwtint_t), 1, fp);
+  err_fwrite(&bwt->seq_len, sizeof(bwtint_t), 1, fp);
+  err_fwrite(x, sizeof(int32_t), 2, fp);
+  err_fwrite(bwt->kmer, sizeof(bwtint_t), bwt_kmer_len(bwt), fp);
+  err_fflush(fp);
+  err_fclose(fp);
+}
+
+/* @return 0 on success, -1 if there is no table for this strand */
+int bwt_restore_kmer(const char *fn, bwt_t *bwt) {
+  FILE *fp;
+  bwtint_t primary, seq_len;
+  int32_t x[2];
+
+  if ((fp = fopen(fn, "rb")) == 0) return -1;
+  err_fread_noeof(&primary, sizeof(bwtint_t), 1, fp);
+  err_fread_noeof(&seq_len, sizeof(bwtint_t), 1, fp);
+  err_fread_noeof(x, sizeof(int32_t), 2, fp);
+  xassert(primary == bwt->primary && seq_len == bwt->seq_len, "k-mer table does not match the BWT.");
+  xassert(x[0] > 0 && x[0] <= BWT_KMER_MAX && x[1] == bwt->kmer_absent, "corrupted k-mer table.");
+  bwt->kmer_k = x[0];
+  bwt->kmer = (bwtint_t*)huge_malloc(bwt_kmer_len(bwt) * sizeof(bwtint_t));
+  fread_fix(fp, bwt_kmer_len(bwt) * sizeof(bwtint_t), bwt->kmer);
+  err_fclose(fp);
+  return 0;
+}
+
+/* The .bwt file has no layout field; the occurrence layout is implied by
+ * its size. A raw (not yet updated) BWT keeps the 4-counter default.
+ * The width of packed SA entries only depends on seq_len and the k-mer
+ * table alphabet on the symbol counts. */
+void bwt_set_layout(bwt_t *bwt) {
+  bwtint_t n_occ = (bwt->seq_len + OCC_INTERVAL - 1) / OCC_INTERVAL + 1;
+  int c;
+  bwt->sa_width = bwt_sa_bits(bwt->seq_len);
+  for (c = 0; c < 4 && bwt->L2[c+1] != bwt->L2[c]; ++c);
+  bwt->kmer_absent = c < 4? c : -1;
+  bwt->occ_n = 4; bwt->absent = -1;
+  if (bwt->bwt_size != ((bwt->seq_len + 15) >> 4) + n_occ * BWT3_OCC_SIZE) return;
+  for (c = 1; c < 4; ++c)
+    if (bwt->L2[c+1] == bwt->L2[c]) break;
+  xassert(c < 4, "three-letter BWT without an absent symbol.");
+  bwt->occ_n = 3; bwt->absent = c;
+}
+
 bwt_t *bwt_restore_bwt(const char *fn) {
   bwt_t *bwt;
   FILE *fp;
@@ -461,7 +1160,7 @@ bwt_t *bwt_restore_bwt(const char *fn) {
   fp = xopen(fn, "rb");
   err_fseek(fp, 0, SEEK_END);
   bwt->bwt_size = (err_ftell(fp) - sizeof(bwtint_t) * 5) >> 2;
-  bwt->bwt = (uint32_t*)calloc(bwt->bwt_size, 4);
+  bwt->bwt = (uint32_t*)huge_malloc(bwt->bwt_size * 4); // filled by fread_fix()
   err_fseek(fp, 0, SEEK_SET);
   err_fread_noeof(&bwt->primary, sizeof(bwtint_t), 1, fp);
   err_fread_noeof(bwt->L2+1, sizeof(bwtint_t), 4, fp);
@@ -469,6 +1168,7 @@ bwt_t *bwt_restore_bwt(const char *fn) {
   bwt->seq_len = bwt->L2[4];
   err_fclose(fp);
   bwt_gen_cnt_table(bwt);
+  bwt_set_layout(bwt);
 
   return bwt;
 }
@@ -480,7 +1180,7 @@ void bwt_restore_bwt2(const char *fn, bwt_t *bwt) {
   fp = xopen(fn, "rb");
   err_fseek(fp, 0, SEEK_END);
   bwt->bwt_size = (err_ftell(fp) - sizeof(bwtint_t) * 5) >> 2;
-  bwt->bwt = (uint32_t*)calloc(bwt->bwt_size, 4);
+  bwt->bwt = (uint32_t*)huge_malloc(bwt->bwt_size * 4); // filled by fread_fix()
   err_fseek(fp, 0, SEEK_SET);
   err_fread_noeof(&bwt->primary, sizeof(bwtint_t), 1, fp);
   err_fread_noeof(bwt->L2+1, sizeof(bwtint_t), 4, fp);
@@ -488,11 +1188,12 @@ void bwt_restore_bwt2(const char *fn, bwt_t *bwt) {
   bwt->seq_len = bwt->L2[4];
   err_fclose(fp);
   bwt_gen_cnt_table(bwt);
+  bwt_set_layout(bwt);
 }
 
 void bwt_destroy(bwt_t *bwt) {
   if (bwt == 0) return;
-  free(bwt->sa); free(bwt->bwt);
+  free(bwt->sa); free(bwt->bwt); free(bwt->kmer);
   free(bwt);
 }
 
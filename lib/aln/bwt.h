@@ -63,11 +63,20 @@ typedef struct {
    uint32_t *bwt;
    // look up table for counting bases in 4-base/8-bit word
    uint32_t cnt_table[256];
-   // suffix array
+   // suffix array, n_sa entries of sa_width bits packed into 64-bit words
    int sa_intv;
    bwtint_t n_sa;
    bwtint_t *sa;
    uint8_t parent;               /* parent or daughter */
+   // occurrence layout: 4 counters per block, or 3 for a three-letter BWT
+   // (bisulfite-converted strands never contain C or G, respectively)
+   uint8_t occ_n;
+   int8_t absent;                /* symbol missing from a three-letter BWT, -1 otherwise */
+   uint8_t sa_width;             /* bits per sampled SA entry, enough for seq_len */
+   // optional k-mer table, see bwt_kmer_build()
+   int8_t kmer_k;                /* longest k-mer in the table, 0 without a table */
+   int8_t kmer_absent;           /* symbol left out of the table alphabet, -1 if none */
+   bwtint_t *kmer;               /* x[0], x[1], x[2] of every node */
 } bwt_t;
 
 /**
@@ -95,6 +104,16 @@ typedef struct { size_t n, m; bwtintv_t *a; } bwtintv_v;
 // 4 is 2^4 * 2^5 (uint32_t) == 2^9 == 512 bits for a unit
 #define bwt_occ_intv(b, k) ((b)->bwt + ((k)>>7<<4))
 
+// three-letter layout: every 128 bases take 3 x 64-bit occurrence counts
+// followed by 256 bits of BWT, i.e. 14 uint32_t instead of 16
+#define BWT3_OCC_SIZE 6
+#define BWT3_BLK_SIZE (BWT3_OCC_SIZE + 8)
+#define bwt3_bwt(b, k) ((b)->bwt[((k)>>7)*BWT3_BLK_SIZE + BWT3_OCC_SIZE + (((k)&0x7f)>>4)])
+#define bwt3_occ_intv(b, k) ((b)->bwt + ((k)>>7)*BWT3_BLK_SIZE)
+// index of the counter of symbol c in a three-letter block (c != absent)
+#define bwt3_slot(b, c) ((c) - ((c) > (b)->absent))
+#define bwt3_B0(b, k) (bwt3_bwt(b, k)>>((~(k)&0xf)<<1)&3)
+
 /* retrieve a character from the $-removed BWT string. Note that
  * bwt_t::bwt is not exactly the BWT string and therefore this macro is
  * called bwt_B0 instead of bwt_B */
@@ -104,6 +123,57 @@ typedef struct { size_t n, m; bwtintv_t *a; } bwtintv_v;
 
 #define bwt_set_intv(bwt, bwtc, c, ik) ((ik).x[0] = (bwt)->L2[(int)(c)]+1, (ik).x[2] = (bwt)->L2[(int)(c)+1]-(bwt)->L2[(int)(c)], (ik).x[1] = (bwtc)->L2[3-(c)]+1, (ik).info = 0)
 
+// packed SA: number of 64-bit words, one spare so that an entry can always be read as two words
+#define bwt_sa_words(b) (((b)->n_sa * (b)->sa_width + 63) / 64 + 1)
+#define bwt_sa_word(b, i) ((b)->sa + ((i) * (b)->sa_width >> 6))
+
+// i-th sampled SA entry; entry 0 (the position of '$') reads as -1, see bwt_sa()
+static inline bwtint_t bwt_sa_entry(const bwt_t *bwt, bwtint_t i) {
+	bwtint_t b = i * bwt->sa_width, x;
+	int sh = b & 63;
+	if (i == 0) return (bwtint_t)(-1);
+	x = bwt->sa[b>>6] >> sh;
+	if (sh + bwt->sa_width > 64) x |= bwt->sa[(b>>6) + 1] << (64 - sh);
+	return bwt->sa_width == 64? x : x & ((1ULL << bwt->sa_width) - 1);
+}
+
+/* The k-mer table holds the bi-interval of every string of length 1..kmer_k
+ * over the alphabet of the strand (bisulfite-converted strands lack C or G)
+ * exactly as bwt_set_intv()/bwt_extend() would compute it during seeding.
+ * Strings are nodes of a complete sigma-ary tree numbered in BFS order: the
+ * empty string is node 0 and the children of node u are u*sigma+1..u*sigma+sigma.
+ * Node u is stored at kmer[(u-1)*3]. */
+#define BWT_KMER_MAX  14
+#define BWT_KMER_DEF  12
+#define BWT_KMER_NONE ((bwtint_t)(-1))
+#define bwt_kmer_sigma(b) ((b)->kmer_absent < 0? 4 : 3)
+#define bwt_kmer_intv(b, u) ((b)->kmer + ((u) - 1) * 3)
+
+// number of bwtint_t in the table
+static inline bwtint_t bwt_kmer_len(const bwt_t *bwt) {
+	bwtint_t n = 0, x = 1;
+	int l;
+	for (l = 0; l < bwt->kmer_k; ++l) x *= bwt_kmer_sigma(bwt), n += x;
+	return n * 3;
+}
+
+// node of s+c given the node u of s, |s| == l; BWT_KMER_NONE if s+c is not in the table
+static inline bwtint_t bwt_kmer_child(const bwt_t *bwt, bwtint_t u, int l, int c) {
+	int a = bwt->kmer_absent;
+	if (u == BWT_KMER_NONE || l >= bwt->kmer_k || c > 3 || c == a) return BWT_KMER_NONE;
+	return u * bwt_kmer_sigma(bwt) + (c - (a >= 0 && c > a)) + 1;
+}
+
+// prefetch the occurrence block read by bwt_occ()/bwt_2occ4() for Occ(., k)
+static inline void bwt_prefetch_occ(const bwt_t *bwt, bwtint_t k) {
+	const uint32_t *p;
+	if (k == (bwtint_t)(-1)) return;
+	k -= (k >= bwt->primary);
+	if (bwt->occ_n == 3) p = bwt3_occ_intv(bwt, k), __builtin_prefetch(p + BWT3_BLK_SIZE - 1);
+	else p = bwt_occ_intv(bwt, k), __builtin_prefetch(p + 15);
+	__builtin_prefetch(p);
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -119,13 +189,27 @@ extern "C" {
 
 	void bwt_bwtgen(const char *fn_pac, const char *fn_bwt); // from BWT-SW
 	void bwt_bwtgen2(const char *fn_pac, const char *fn_bwt, int block_size); // from BWT-SW
+	bwt_t *bwt_blk_build(const uint8_t *pac, int64_t n, int n_threads, int64_t mem_cap); // blockwise, multi-threaded
 	void bwt_cal_sa(bwt_t *bwt, int intv);
+	void bwt_cal_sa_mt(bwt_t *bwt, int intv, const uint8_t *pac, int n_threads);
+	void bwt_kmer_build(bwt_t *bwt, const bwt_t *bwtc, int k);
+	void bwt_dump_kmer(const char *fn, const bwt_t *bwt);
+	int bwt_restore_kmer(const char *fn, bwt_t *bwt);
+	int bwt_sa_bits(bwtint_t seq_len);
 
 	void bwt_bwtupdate_core(bwt_t *bwt);
+	int bwt_bwtupdate_core3(bwt_t *bwt);
+	void bwt_set_layout(bwt_t *bwt);
+
+	/* select POPCNT/AVX2/AVX-512 occurrence kernels (done automatically at
+	 * startup); max_level caps the choice, 0 forces the scalar code */
+	const char *bwt_occ_dispatch(int max_level);
+	const char *bwt_occ_impl(void);
 
 	bwtint_t bwt_occ(const bwt_t *bwt, bwtint_t k, ubyte_t c);
 	void bwt_occ4(const bwt_t *bwt, bwtint_t k, bwtint_t cnt[4]);
 	bwtint_t bwt_sa(const bwt_t *bwt, bwtint_t k);
+	void bwt_sa_batch(const bwt_t *bwt, int64_t n, const bwtint_t *k, bwtint_t *sa);
 
 	// more efficient version of bwt_occ/bwt_occ4 for retrieving two close Occ values
 	void bwt_gen_cnt_table(bwt_t *bwt);
@@ -139,6 +223,23 @@ extern "C" {
 	 * Extend bi-SA-interval _ik_
 	 */
 	void bwt_extend(const bwt_t *bwt, const bwtintv_t *ik, bwtintv_t ok[4], int is_back);
+	void bwt_reverse_intvs(bwtintv_v *p);
+
+	/**
+	 * Forward-extend _ik_ with base _c_ of the query (the complement is searched
+	 * in _bwtc_), reading the result from the k-mer table of _bwt_ when _u_,
+	 * the node of the extended string, is in it. Only ok->x[] is set.
+	 */
+	static inline void bwt_extend_fwd(const bwt_t *bwt, const bwt_t *bwtc, bwtint_t u, const bwtintv_t *ik, int c, bwtintv_t *ok) {
+		if (u != BWT_KMER_NONE) {
+			const bwtint_t *p = bwt_kmer_intv(bwt, u);
+			ok->x[0] = p[0]; ok->x[1] = p[1]; ok->x[2] = p[2];
+		} else {
+			bwtintv_t t[4];
+			bwt_extend(bwtc, ik, t, 0);
+			*ok = t[3 - c];
+		}
+	}
 
 	/**
 	 * Given a query _q_, collect potential SMEMs covering position _x_ and store them in _mem_.
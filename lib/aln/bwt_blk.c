@@ -0,0 +1,497 @@
+/* Blockwise multi-threaded BWT construction
+ *
+ * Copyright (c) 2023 Jacob.Morrison@vai.org
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The suffixes are sorted in blocks of consecutive buckets (suffixes sharing
+ * their first symbols), so that only one block of positions is in memory at
+ * a time. Buckets are sorted in parallel by comparison.
+ *
+ * Bucket keys are the first BLK_K3 symbols in base 3 when the text has at
+ * most three letters, as a converted strand has, or the first BLK_K4 in base
+ * 4 otherwise. A bucket too large for a block, or too large for the threads
+ * to share a block evenly, is split into units by its next symbols; only a
+ * unit that is still too large (long runs of one letter) can stretch a block
+ * beyond the memory cap. Each block takes one scan of the text to fill, and
+ * positions are held in 40 bits so that a scan collects as many as possible.
+ *
+ * To bound the cost of a comparison in repeats, a difference cover sample
+ * (Karkkainen 2007, "Fast BWT in small space by blockwise suffix sorting")
+ * is ranked first: positions whose residue modulo BLK_DC_V is in the cover
+ * D. For any two suffixes i and j there is a delta < BLK_DC_V such that
+ * i+delta and j+delta are both samples, so once their first BLK_DC_V symbols
+ * match, the order of i and j is that of the two samples. The samples are
+ * ranked by naming their first BLK_DC_V symbols with the same bucket sort
+ * and suffix sorting the string of names with QSufSortSuffixSort().
+ *
+ * The builder handles texts well beyond the 2G symbols of is_bwt(); ranks
+ * take 64 bits once there are more samples than 32 bits can rank. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bwt.h"
+#include "bwa.h"
+#include "utils.h"
+#include "ksort.h"
+#include "QSufSort.h"
+
+#ifdef USE_MALLOC_WRAPPERS
+#  include "malloc_wrap.h"
+#endif
+
+#define BLK_DC_V   1024 // period of the difference cover
+#define BLK_DC_R   32   // sqrt(BLK_DC_V); D = {0..R-1} U {R, 2R, ..., V-R}
+#define BLK_K3     12   // symbols that define a bucket of a 3-letter text, 3 bytes
+#define BLK_K4     10   // and of a 4-letter text
+#define BLK_SUB3   6    // further symbols that split a bucket into units
+#define BLK_SUB4   5
+#define BLK_MIN_SPLIT 65536 // smaller buckets are only split to fit a block
+#define BLK_PAD    16   // zero bytes after the text, read by blk_word()
+#define BLK_MAX_PASS 256 // most blocks, however small mem_cap is
+#ifndef BLK_RANK64_MIN
+#define BLK_RANK64_MIN UINT32_MAX // samples from which ranks take 64 bits
+#endif
+
+typedef struct {
+	uint32_t lo;
+	uint8_t hi;
+} __attribute__((packed)) blk_pos_t; // a 40-bit text position
+
+#define blk_pos(x) ((int64_t)(x).hi << 32 | (x).lo)
+
+typedef struct {
+	int64_t n;                 // text length
+	const uint8_t *pac;        // 2-bit text, BLK_PAD zero bytes after it
+	int n_threads;
+	int naming;                // compare on the first BLK_DC_V symbols only
+	int r, k, sub_k;           // key base, symbols of a bucket key and of a unit key
+	int dmap[4];               // digit of each symbol; absent ones share the next one's
+	int dig[256];              // base-3 value of the 4 symbols of a byte
+	int64_t n_bkt, n_sub;      // r^k buckets, r^sub_k units of a split bucket
+	int dc_idx[BLK_DC_V];      // position in the cover of each residue, or -1
+	int dc_x[BLK_DC_V];        // dc_x[d] and dc_x[d]+d are both in the cover
+	int64_t dc_off[BLK_DC_V];  // first sample of each residue class in the cover
+	int64_t m;                 // number of samples
+	uint32_t *rank32;          // rank of each sample suffix, 1-based
+	uint64_t *rank64;          // the same with BLK_RANK64_MIN samples or more
+	int64_t **tcnt;            // per-thread counts of buckets, then of units
+	int32_t *split;            // index of each split bucket, or -1
+	int64_t n_split;
+	int64_t *uoff;             // first unit of each bucket, n_bkt + 1 entries
+	int64_t *ucnt;             // positions in each unit
+	int64_t u0, u1, k0, k1;    // units of the block and the buckets they are in
+	int64_t *cur;              // fill cursors of the units of the block
+	blk_pos_t *a;              // positions of the block, sorted per unit
+} blk_t;
+
+static inline uint64_t blk_word(const uint8_t *pac, int64_t p) // 32 symbols from p
+{
+	const uint8_t *q = pac + (p >> 2);
+	uint64_t x;
+	int sh = (p & 3) << 1;
+	memcpy(&x, q, 8);
+	x = __builtin_bswap64(x);
+	return sh? x << sh | q[8] >> (8 - sh) : x;
+}
+
+#define blk_sym(pac, l) ((pac)[(l)>>2] >> ((~(l)&3)<<1) & 3)
+
+static inline int64_t blk_sidx(const blk_t *b, int64_t p)
+{
+	return b->dc_off[b->dc_idx[p % BLK_DC_V]] + p / BLK_DC_V;
+}
+
+static int blk_cmp(const blk_t *b, int64_t i, int64_t j)
+{
+	int64_t li = b->n - i, lj = b->n - j, l = li < lj? li : lj, o, si, sj;
+	int x, y;
+	if (l > BLK_DC_V) l = BLK_DC_V;
+	for (o = 0; o < l; o += 32) {
+		uint64_t wi = blk_word(b->pac, i + o), wj = blk_word(b->pac, j + o);
+		if (l - o < 32) {
+			uint64_t mask = ~0ULL << ((32 - (l - o)) << 1);
+			wi &= mask; wj &= mask;
+		}
+		if (wi != wj) return wi < wj? -1 : 1;
+	}
+	if (li <= BLK_DC_V || lj <= BLK_DC_V) return li < lj? -1 : li > lj; // the shorter is a prefix of the other
+	if (b->naming) return 0;
+	x = i % BLK_DC_V; y = j % BLK_DC_V;
+	o = (b->dc_x[(y - x + BLK_DC_V) % BLK_DC_V] - x + BLK_DC_V) % BLK_DC_V; // i+o and j+o are samples
+	si = blk_sidx(b, i + o); sj = blk_sidx(b, j + o);
+	if (b->rank32) return b->rank32[si] < b->rank32[sj]? -1 : 1;
+	return b->rank64[si] < b->rank64[sj]? -1 : 1;
+}
+
+static __thread const blk_t *blk_ctx; // set by each sorting thread
+#define blk_lt(p, q) (blk_cmp(blk_ctx, blk_pos(p), blk_pos(q)) < 0)
+KSORT_INIT(blk, blk_pos_t, blk_lt)
+#define blk_lt64(p, q) (blk_cmp(blk_ctx, (p), (q)) < 0)
+KSORT_INIT(blk64, int64_t, blk_lt64)
+
+static void blk_cover(blk_t *b)
+{
+	int i, j, n_d = 0, d[2*BLK_DC_R];
+	for (i = 0; i < BLK_DC_R; ++i) d[n_d++] = i;
+	for (i = 1; i < BLK_DC_V / BLK_DC_R; ++i) d[n_d++] = i * BLK_DC_R;
+	for (i = 0; i < BLK_DC_V; ++i) b->dc_idx[i] = -1, b->dc_x[i] = -1;
+	for (i = 0; i < n_d; ++i) b->dc_idx[d[i]] = i;
+	for (i = 0; i < n_d; ++i)
+		for (j = 0; j < n_d; ++j) {
+			int diff = (d[j] - d[i] + BLK_DC_V) % BLK_DC_V;
+			if (b->dc_x[diff] < 0) b->dc_x[diff] = d[i];
+		}
+	for (i = 0; i < BLK_DC_V; ++i) xassert(b->dc_x[i] >= 0, "incomplete difference cover");
+	for (i = 0, b->m = 0; i < n_d; ++i) { // residue classes in the order of the cover
+		b->dc_off[i] = b->m;
+		if (d[i] < b->n) b->m += (b->n - 1 - d[i]) / BLK_DC_V + 1;
+	}
+}
+
+/* key digits from the symbol counts c[] of the text: digits keep the order
+ * of the symbols that occur, and an absent symbol, which is only ever read
+ * as the zero padding past the end, never sorts above a present one */
+static void blk_alphabet(blk_t *b, const bwtint_t c[4])
+{
+	int i, j, x, r;
+	for (i = 0, r = 0; i < 4; ++i) b->dmap[i] = r, r += c[i] > 0;
+	if (r <= 3) b->r = 3, b->k = BLK_K3, b->sub_k = BLK_SUB3;
+	else b->r = 4, b->k = BLK_K4, b->sub_k = BLK_SUB4;
+	for (i = 0; i < 4; ++i)
+		if (b->dmap[i] >= b->r) b->dmap[i] = b->r - 1;
+	for (i = 0; i < 256; ++i) {
+		for (j = 6, x = 0; j >= 0; j -= 2) x = x * 3 + b->dmap[i >> j & 3];
+		b->dig[i] = x;
+	}
+	for (i = 0, b->n_bkt = 1; i < b->k; ++i) b->n_bkt *= b->r;
+	for (i = 0, b->n_sub = 1; i < b->sub_k; ++i) b->n_sub *= b->r;
+}
+
+static inline int blk_keep(const blk_t *b, int64_t p)
+{
+	return !b->naming || b->dc_idx[p % BLK_DC_V] >= 0;
+}
+
+/* 32 symbols from p, zero past the end of the text */
+static inline uint64_t blk_head(const blk_t *b, int64_t p)
+{
+	uint64_t w = blk_word(b->pac, p);
+	if (b->n - p < 32) w &= ~0ULL << ((32 - (b->n - p)) << 1);
+	return w;
+}
+
+/* buckets are only defined for the suffixes of length b->k or longer */
+static inline int64_t blk_key(const blk_t *b, uint64_t w)
+{
+	if (b->r == 4) return w >> (64 - 2 * BLK_K4);
+	return ((int64_t)b->dig[w >> 56] * 81 + b->dig[w >> 48 & 0xff]) * 81 + b->dig[w >> 40 & 0xff];
+}
+
+/* unit of a suffix within its split bucket */
+static inline int64_t blk_subkey(const blk_t *b, uint64_t w)
+{
+	int64_t x = 0;
+	int i;
+	for (i = 0, w <<= 2 * b->k; i < b->sub_k; ++i, w <<= 2) x = x * b->r + b->dmap[w >> 62];
+	return x;
+}
+
+#define blk_bucket(b, p) blk_key((b), blk_head((b), (p)))
+
+#define BLK_CHUNK(b, j, s, e) do { \
+		int64_t _l = ((b)->n - (b)->k + 1 + (b)->n_threads * 4 - 1) / ((b)->n_threads * 4); \
+		(s) = (j) * _l; (e) = (s) + _l < (b)->n - (b)->k + 1? (s) + _l : (b)->n - (b)->k + 1; \
+	} while (0)
+
+static void blk_count_worker(void *data, int j, int tid)
+{
+	blk_t *b = (blk_t*)data;
+	int64_t p, s, e, *c = b->tcnt[tid];
+	BLK_CHUNK(b, j, s, e);
+	for (p = s; p < e; ++p)
+		if (blk_keep(b, p)) ++c[blk_bucket(b, p)];
+}
+
+static void blk_split_worker(void *data, int j, int tid)
+{
+	blk_t *b = (blk_t*)data;
+	int64_t p, s, e, *c = b->tcnt[tid];
+	BLK_CHUNK(b, j, s, e);
+	for (p = s; p < e; ++p) {
+		uint64_t w;
+		int32_t x;
+		if (!blk_keep(b, p)) continue;
+		w = blk_head(b, p);
+		if ((x = b->split[blk_key(b, w)]) >= 0) ++c[x * b->n_sub + blk_subkey(b, w)];
+	}
+}
+
+static void blk_fill_worker(void *data, int j, int tid)
+{
+	blk_t *b = (blk_t*)data;
+	int64_t p, s, e, k, u, x;
+	(void)tid;
+	BLK_CHUNK(b, j, s, e);
+	for (p = s; p < e; ++p) {
+		uint64_t w;
+		if (!blk_keep(b, p)) continue;
+		w = blk_head(b, p);
+		k = blk_key(b, w);
+		if (k < b->k0 || k > b->k1) continue;
+		u = b->uoff[k] + (b->split[k] >= 0? blk_subkey(b, w) : 0);
+		if (u < b->u0 || u >= b->u1) continue;
+		x = __sync_fetch_and_add(&b->cur[u - b->u0], 1);
+		b->a[x].lo = (uint32_t)p; b->a[x].hi = (uint8_t)(p >> 32);
+	}
+}
+
+static void blk_sort_worker(void *data, int j, int tid)
+{
+	blk_t *b = (blk_t*)data;
+	int64_t s = j? b->cur[j-1] : 0, e = b->cur[j]; // cursors end at the unit ends
+	(void)tid;
+	blk_ctx = b;
+	if (e - s > 1) ks_introsort(blk, e - s, b->a + s);
+}
+
+/* per-thread counts into tcnt[0], n of them */
+static void blk_reduce(blk_t *b, int64_t n)
+{
+	int64_t x;
+	int t;
+	for (t = 1; t < b->n_threads; ++t) {
+		for (x = 0; x < n; ++x) b->tcnt[0][x] += b->tcnt[t][x];
+		free(b->tcnt[t]);
+	}
+}
+
+/* count the positions of every unit and return the number of units */
+static int64_t blk_units(blk_t *b, int64_t cap, int n_chunk)
+{
+	extern void kt_for(int n_threads, void (*func)(void*,int,int), void *data, int n);
+	int64_t k, u, tot = 0, split_at, *cnt;
+	int t;
+
+	b->tcnt = calloc(b->n_threads, sizeof(int64_t*));
+	for (t = 0; t < b->n_threads; ++t) b->tcnt[t] = calloc(b->n_bkt, sizeof(int64_t));
+	kt_for(b->n_threads, blk_count_worker, b, n_chunk);
+	blk_reduce(b, b->n_bkt);
+	cnt = b->tcnt[0];
+	for (k = 0; k < b->n_bkt; ++k) tot += cnt[k];
+
+	// split what does not fit a block, or would keep one thread busy alone
+	split_at = b->n_threads > 1? tot / (4 * b->n_threads) : cap;
+	if (split_at < BLK_MIN_SPLIT) split_at = BLK_MIN_SPLIT;
+	if (split_at > cap) split_at = cap;
+	b->split = malloc(b->n_bkt * sizeof(int32_t));
+	b->uoff = malloc((b->n_bkt + 1) * sizeof(int64_t));
+	for (k = 0, u = 0, b->n_split = 0; k < b->n_bkt; ++k) {
+		b->split[k] = cnt[k] > split_at? b->n_split++ : -1;
+		b->uoff[k] = u;
+		u += b->split[k] >= 0? b->n_sub : 1;
+	}
+	b->uoff[b->n_bkt] = u;
+	b->ucnt = calloc(u > 0? u : 1, sizeof(int64_t));
+	for (k = 0; k < b->n_bkt; ++k)
+		if (b->split[k] < 0) b->ucnt[b->uoff[k]] = cnt[k];
+	free(cnt);
+
+	if (b->n_split) {
+		for (t = 0; t < b->n_threads; ++t) b->tcnt[t] = calloc(b->n_split * b->n_sub, sizeof(int64_t));
+		kt_for(b->n_threads, blk_split_worker, b, n_chunk);
+		blk_reduce(b, b->n_split * b->n_sub);
+		for (k = 0; k < b->n_bkt; ++k)
+			if (b->split[k] >= 0)
+				memcpy(b->ucnt + b->uoff[k], b->tcnt[0] + b->split[k] * b->n_sub, b->n_sub * sizeof(int64_t));
+		free(b->tcnt[0]);
+	}
+	free(b->tcnt); b->tcnt = 0;
+	return u;
+}
+
+typedef void (*blk_emit_f)(blk_t *b, int64_t p, void *data);
+
+/* Pass every kept suffix but the empty one to emit() in sorted order; at
+ * most cap positions are held at a time unless a unit is larger. Returns
+ * the number of blocks, i.e. of scans over the text. */
+static int blk_sort_all(blk_t *b, int64_t cap, blk_emit_f emit, void *data)
+{
+	extern void kt_for(int n_threads, void (*func)(void*,int,int), void *data, int n);
+	int64_t i, j, k, u, n_unit, tot, max = 0, n_short = 0, shorts[BLK_K3];
+	int n_chunk = b->n - b->k + 1 > 0? b->n_threads * 4 : 0, n_pass = 0;
+
+	// suffixes shorter than b->k precede the bucket their zero-padded prefix falls into
+	for (i = b->n - b->k + 1 > 0? b->n - b->k + 1 : 0; i < b->n; ++i)
+		if (blk_keep(b, i)) shorts[n_short++] = i;
+	blk_ctx = b;
+	ks_introsort(blk64, n_short, shorts);
+
+	n_unit = blk_units(b, cap, n_chunk);
+	for (u = 0, tot = 0; u < n_unit; ++u) {
+		if (b->ucnt[u] > max) max = b->ucnt[u];
+		tot += b->ucnt[u];
+	}
+	if (cap > tot) cap = tot;
+	if (cap < max) {
+		if (bwa_verbose >= 2)
+			fprintf(stderr, "[W::%s] %ld suffixes share their first %d symbols; the memory cap is exceeded by %.1f MB\n",
+					__func__, (long)max, b->k + b->sub_k, (max - cap) * sizeof(blk_pos_t) / 1048576.);
+		cap = max;
+	}
+	b->a = malloc((cap > 0? cap : 1) * sizeof(blk_pos_t));
+	b->cur = malloc((n_unit > 0? n_unit : 1) * sizeof(int64_t));
+
+	for (b->u0 = 0, i = 0, k = 0; b->u0 < n_unit; b->u0 = b->u1) {
+		for (b->u1 = b->u0, tot = 0; b->u1 < n_unit && tot + b->ucnt[b->u1] <= cap; ++b->u1) {
+			b->cur[b->u1 - b->u0] = tot;
+			tot += b->ucnt[b->u1];
+		}
+		for (b->k0 = k; b->uoff[b->k0 + 1] <= b->u0; ++b->k0);
+		for (b->k1 = b->k0; b->uoff[b->k1 + 1] < b->u1; ++b->k1);
+		if (tot > 0) {
+			kt_for(b->n_threads, blk_fill_worker, b, n_chunk);
+			kt_for(b->n_threads, blk_sort_worker, b, b->u1 - b->u0);
+			++n_pass;
+		}
+		for (u = b->u0, j = 0, k = b->k0; u < b->u1; ++u) {
+			for (; b->uoff[k + 1] <= u; ++k);
+			for (; i < n_short && blk_bucket(b, shorts[i]) <= k; ++i) emit(b, shorts[i], data);
+			for (; j < b->cur[u - b->u0]; ++j) emit(b, blk_pos(b->a[j]), data);
+		}
+	}
+	for (; i < n_short; ++i) emit(b, shorts[i], data);
+	free(b->a); free(b->cur); free(b->ucnt); free(b->uoff); free(b->split);
+	b->a = 0; b->cur = b->ucnt = b->uoff = 0; b->split = 0;
+	return n_pass;
+}
+
+typedef struct {
+	qsint_t *name; // name of each sample
+	qsint_t n_name;
+	int64_t last;
+} blk_name_t;
+
+static void blk_emit_name(blk_t *b, int64_t p, void *data)
+{
+	blk_name_t *nm = (blk_name_t*)data;
+	if (nm->last < 0 || blk_cmp(b, nm->last, p) != 0) ++nm->n_name;
+	nm->name[blk_sidx(b, p)] = nm->n_name;
+	nm->last = p;
+}
+
+typedef struct {
+	bwt_t *bwt;
+	int64_t row, k; // rows so far, BWT symbols so far
+} blk_out_t;
+
+static void blk_emit_bwt(blk_t *b, int64_t p, void *data)
+{
+	blk_out_t *o = (blk_out_t*)data;
+	if (p == 0) o->bwt->primary = o->row;
+	else {
+		o->bwt->bwt[o->k>>4] |= (uint32_t)blk_sym(b->pac, p - 1) << ((15 - (o->k&15)) << 1);
+		++o->k;
+	}
+	++o->row;
+}
+
+/**
+ * Construct the BWT of a 2-bit packed text with n_threads threads
+ * @param pac      the text; it must be followed by 16 zero bytes
+ * @param n        text length, below 2^40
+ * @param mem_cap  target peak memory in bytes, 0 for no limit; the text,
+ *                 the output and the sample ranks (~n/4 bytes) are fixed,
+ *                 the remainder bounds the positions sorted at a time
+ * @return         BWT without occurrence counts, as bwt_pac2bwt()
+ */
+bwt_t *bwt_blk_build(const uint8_t *pac, int64_t n, int n_threads, int64_t mem_cap)
+{
+	blk_t *b;
+	bwt_t *bwt;
+	blk_name_t nm;
+	blk_out_t o;
+	qsint_t *I;
+	int64_t i, cap;
+	int n_pass;
+	double t;
+
+	xassert(n < 1LL<<40, "text too long for 40-bit positions");
+	b = calloc(1, sizeof(blk_t));
+	b->n = n; b->pac = pac; b->n_threads = n_threads > 0? n_threads : 1;
+	blk_cover(b);
+	bwt = calloc(1, sizeof(bwt_t));
+	bwt->seq_len = n;
+	for (i = 0; i < n; ++i) ++bwt->L2[1 + blk_sym(pac, i)];
+	blk_alphabet(b, bwt->L2 + 1);
+	for (i = 2; i <= 4; ++i) bwt->L2[i] += bwt->L2[i-1];
+	cap = mem_cap > 0? (mem_cap - n / 2 - b->m * 16) / (int64_t)sizeof(blk_pos_t) : INT64_MAX;
+	if (cap < n / BLK_MAX_PASS) { // each block rescans the text
+		if (bwa_verbose >= 2)
+			fprintf(stderr, "[W::%s] raising the memory cap by %.1f MB to keep to about %d scans of the text per phase\n",
+					__func__, (n / BLK_MAX_PASS - (cap > 0? cap : 0)) * sizeof(blk_pos_t) / 1048576., BLK_MAX_PASS);
+		cap = n / BLK_MAX_PASS;
+	}
+	if (cap < 1) cap = 1;
+
+	// rank the samples
+	t = realtime();
+	nm.name = malloc((b->m + 1) * sizeof(qsint_t));
+	nm.n_name = 0; nm.last = -1;
+	b->naming = 1;
+	n_pass = blk_sort_all(b, cap, blk_emit_name, &nm);
+	b->naming = 0;
+	I = malloc((b->m + 1) * sizeof(qsint_t));
+	if (b->m > 0) QSufSortSuffixSort(nm.name, I, b->m, nm.n_name, 1, 0); // nm.name becomes the inverse SA
+	free(I);
+	if (b->m < BLK_RANK64_MIN) {
+		b->rank32 = malloc((b->m + 1) * sizeof(uint32_t));
+		for (i = 0; i < b->m; ++i) b->rank32[i] = nm.name[i];
+	} else {
+		b->rank64 = malloc((b->m + 1) * sizeof(uint64_t));
+		for (i = 0; i < b->m; ++i) b->rank64[i] = nm.name[i];
+	}
+	free(nm.name);
+	if (bwa_verbose >= 3)
+		fprintf(stderr, "[M::%s] ranked %ld difference cover samples in %d pass(es) in %.2f sec\n",
+				__func__, (long)b->m, n_pass, realtime() - t);
+
+	// sort all suffixes
+	t = realtime();
+	bwt->bwt_size = (n + 15) >> 4;
+	bwt->bwt = calloc(bwt->bwt_size, 4);
+	o.bwt = bwt; o.row = 1; o.k = 0; // row 0 is the empty suffix
+	if (n > 0) {
+		bwt->bwt[0] = (uint32_t)blk_sym(pac, n - 1) << 30;
+		o.k = 1;
+	}
+	n_pass = blk_sort_all(b, cap, blk_emit_bwt, &o);
+	xassert(o.row == n + 1 && o.k == n, "inconsistent BWT length");
+	if (bwa_verbose >= 3)
+		fprintf(stderr, "[M::%s] sorted %ld suffixes with %d thread(s) in %d pass(es) in %.2f sec\n",
+				__func__, (long)n, b->n_threads, n_pass, realtime() - t);
+	free(b->rank32); free(b->rank64); free(b);
+	return bwt;
+}
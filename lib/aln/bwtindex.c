@@ -31,9 +31,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <math.h>
+#include <pthread.h>
 #include <zlib.h>
 #include "bntseq.h"
 #include "bwt.h"
+#include "bwa.h"
 #include "utils.h"
 #include "wzmisc.h"
 
@@ -47,6 +50,7 @@
 
 
 int is_bwt(ubyte_t *T, int n);
+extern void kt_for(int n_threads, void (*func)(void*,int,int), void *data, int n);
 
 int64_t bwa_seq_len(const char *fn_pac)
 {
@@ -151,6 +155,43 @@ void bwt_bwtupdate_core(bwt_t *bwt)
    xassert(k + sizeof(bwtint_t) == bwt->bwt_size, "inconsistent bwt_size");
    // update bwt
    free(bwt->bwt); bwt->bwt = buf;
+   bwt->occ_n = 4; bwt->absent = -1;
+}
+
+/**
+ * Three-letter variant of bwt_bwtupdate_core(): interleave only the counts
+ * of the symbols present in the BWT. Returns -1, leaving bwt untouched, if
+ * the BWT uses all four symbols (or lacks A, which the occurrence kernels
+ * rely on for masking).
+ */
+int bwt_bwtupdate_core3(bwt_t *bwt)
+{
+   bwtint_t i, k, c[4], n_occ;
+   uint32_t *buf;
+   int a, j, absent;
+
+   for (a = 1, absent = -1; a < 4; ++a)
+      if (bwt->L2[a+1] == bwt->L2[a]) absent = a;
+   if (absent < 0) return -1;
+
+   n_occ = (bwt->seq_len + OCC_INTERVAL - 1) / OCC_INTERVAL + 1;
+   bwt->bwt_size += n_occ * BWT3_OCC_SIZE; // the new size
+   buf = (uint32_t*)calloc(bwt->bwt_size, 4); // will be the new bwt
+   c[0] = c[1] = c[2] = c[3] = 0;
+   for (i = k = 0; i < bwt->seq_len; ++i) {
+      if (i % OCC_INTERVAL == 0) {
+         for (a = 0; a < 4; ++a)
+            if (a != absent) memcpy(buf + k, c + a, sizeof(bwtint_t)), k += 2;
+      }
+      if (i % 16 == 0) buf[k++] = bwt->bwt[i/16];
+      ++c[bwt_B00(bwt, i)];
+   }
+   for (a = 0, j = 0; a < 4; ++a)
+      if (a != absent) memcpy(buf + k + (j++)*2, c + a, sizeof(bwtint_t));
+   xassert(k + BWT3_OCC_SIZE == bwt->bwt_size, "inconsistent bwt_size");
+   free(bwt->bwt); bwt->bwt = buf;
+   bwt->occ_n = 3; bwt->absent = absent;
+   return 0;
 }
 
 int bwa_bwtupdate(int argc, char *argv[]) // the "bwtupdate" command
@@ -188,14 +229,135 @@ int bwa_bwt2sa(int argc, char *argv[]) // the "bwt2sa" command
 	return 0;
 }
 
+static void bwt_update(bwt_t *bwt, int three_letter) {
+    if (three_letter && bwt_bwtupdate_core3(bwt) == 0) {
+        fprintf(stderr, "[%s] three-letter BWT without '%c', %.1f MB\n", __func__, "ACGT"[bwt->absent], bwt->bwt_size * 4. / 1048576);
+        return;
+    }
+    if (three_letter) fprintf(stderr, "[W::%s] BWT uses four letters; keep the default layout\n", __func__);
+    bwt_bwtupdate_core(bwt);
+}
+
+/* one strand of the index: BWT construction, update and SA sampling */
+typedef struct {
+    const char *prefix;
+    int parent, algo_type, three_letter, sa_intv, n_threads;
+    int64_t mem_cap; // of '-a blk', in bytes
+} index_strand_t;
+
+/* the 2-bit text a BWT was built from, as written by bis_bns_fasta2pac(),
+ * followed by the zero bytes bwt_blk_build() reads past the end */
+static uint8_t *index_load_pac(const char *fn, int64_t seq_len) {
+    int64_t l = (seq_len + 3) / 4;
+    uint8_t *pac = calloc(l + 16, 1);
+    FILE *fp = xopen(fn, "rb");
+    err_fread_noeof(pac, 1, l, fp);
+    err_fclose(fp);
+    return pac;
+}
+
+static void *index_strand(void *data) {
+    index_strand_t *st = (index_strand_t*)data;
+    const char *name = st->parent? "parent" : "daughter", *ext = st->parent? ".par" : ".dau";
+    char *fn_pac, *fn_bwt, *fn_sa;
+    uint8_t *pac = 0;
+    bwt_t *bwt;
+    double t;
+
+    fn_pac = calloc(strlen(st->prefix) + 10, 1); strcat(strcpy(fn_pac, st->prefix), ext); strcat(fn_pac, ".pac");
+    fn_bwt = calloc(strlen(st->prefix) + 10, 1); strcat(strcpy(fn_bwt, st->prefix), ext); strcat(fn_bwt, ".bwt");
+    fn_sa  = calloc(strlen(st->prefix) + 10, 1); strcat(strcpy(fn_sa,  st->prefix), ext); strcat(fn_sa,  ".sa");
+
+    t = realtime();
+    fprintf(stderr, "[%s] Construct BWT for the %s strands...\n", __func__, name);
+    if (st->algo_type == 4 || st->n_threads > 1) /* also finds the anchors of SA sampling */
+        pac = index_load_pac(fn_pac, bwa_seq_len(fn_pac));
+    if (st->algo_type == 2) bwt_bwtgen(fn_pac, fn_bwt);
+    else if (st->algo_type == 4) {
+        int64_t n = bwa_seq_len(fn_pac);
+        bwt = bwt_blk_build(pac, n, st->n_threads, st->mem_cap > 0? st->mem_cap : 2 * n);
+        bwt_dump_bwt(fn_bwt, bwt);
+        bwt_destroy(bwt);
+    } else if (st->algo_type == 1 || st->algo_type == 3) {
+        bwt = bwt_pac2bwt(fn_pac, st->algo_type == 3);
+        bwt_dump_bwt(fn_bwt, bwt);
+        bwt_destroy(bwt);
+    }
+    fprintf(stderr, "[%s] %s BWT constructed in %.2f sec\n", __func__, name, realtime() - t);
+
+    t = realtime();
+    bwt = bwt_restore_bwt(fn_bwt);
+    bwt_update(bwt, st->three_letter);
+    bwt_dump_bwt(fn_bwt, bwt);
+    fprintf(stderr, "[%s] %s BWT updated in %.2f sec\n", __func__, name, realtime() - t);
+
+    t = realtime();
+    bwt_cal_sa_mt(bwt, st->sa_intv, pac, st->n_threads);
+    bwt_dump_sa(fn_sa, bwt);
+    fprintf(stderr, "[%s] %s SA constructed in %.2f sec with %d thread(s), interval %d, %d-bit entries, %.1f MB\n",
+            __func__, name, realtime() - t, st->n_threads, bwt->sa_intv, bwt->sa_width, bwt_sa_words(bwt) * 8. / 1048576);
+    bwt_destroy(bwt);
+    free(pac); free(fn_pac); free(fn_bwt); free(fn_sa);
+    return 0;
+}
+
+typedef struct {
+    bwt_t *bwt[2];
+    int k;
+} index_kmer_t;
+
+static void index_kmer_worker(void *data, int c, int tid) {
+    index_kmer_t *km = (index_kmer_t*)data;
+    (void)tid;
+    bwt_kmer_build(km->bwt[c], km->bwt[!c], km->k);
+}
+
+/* Rough peak memory in bytes for strands of l_pac symbols (the forward
+ * sequence and its reverse complement); with more than one thread the two
+ * strand pipelines run at the same time. */
+static double index_mem_estimate(int64_t l_pac, int algo_type, int sa_intv, int kmer_k, int n_threads, int64_t mem_cap) {
+    double n = l_pac, bwt = n / 4. + n / 8., sa, strand, kmer;
+    int l;
+    if (algo_type == 4) strand = mem_cap > 0? mem_cap / (n_threads > 1? 2. : 1.) : 2. * n; // the blocks fill the cap
+    else strand = algo_type == 2? n / 2. + bwt : 5. * n + n / 4.; // BWT-SW works on blocks; IS and divsufsort keep a 32-bit SA
+    if (bwt + n / 4. > strand) strand = bwt + n / 4.;      // update: the raw BWT next to the new one
+    sa = bwt + n * bwt_sa_bits(n) / 8. / sa_intv + (n_threads > 1? n / 4. : 0); // plus the text to find anchors in
+    if (sa > strand) strand = sa;
+    if (n_threads > 1) strand *= 2;
+    for (l = 1, kmer = 0; l <= kmer_k; ++l) kmer += pow(3, l);
+    kmer = 2. * (bwt + kmer * 3 * sizeof(bwtint_t)); // both strands and their tables
+    return strand > kmer? strand : kmer;
+}
+
+/* "16G", "512M" or a byte count */
+static int64_t index_parse_mem(const char *s) {
+    char *p;
+    double x = strtod(s, &p);
+    if (p == s || x < 0) return -1;
+    if (*p == 'k' || *p == 'K') x *= 1024., ++p;
+    else if (*p == 'm' || *p == 'M') x *= 1048576., ++p;
+    else if (*p == 'g' || *p == 'G') x *= 1073741824., ++p;
+    return *p == 0? (int64_t)x : -1;
+}
+
 static void usage() {
     fprintf(stderr, "\n");
     fprintf(stderr, "Usage: biscuit index [options] <in.fasta>\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "    -a STR     BWT construction algorithm: bwtsw, div, or is [auto]\n");
+    fprintf(stderr, "    -a STR     BWT construction algorithm: bwtsw, div, is, or blk (blockwise and\n");
+    fprintf(stderr, "                   multi-threaded, for long genomes) [auto]\n");
     fprintf(stderr, "    -p STR     Prefix of the index [same as fasta name]\n");
     fprintf(stderr, "    -6         Index files named as <in.fasta>.64.* instead of <in.fasta>*\n");
+    fprintf(stderr, "    -3         Store only three occurrence counts per BWT block, as converted\n");
+    fprintf(stderr, "                   strands lack C (parent) or G (daughter) [off]\n");
+    fprintf(stderr, "    -s INT     Suffix array sampling interval, a power of 2; 1 keeps the full SA,\n");
+    fprintf(stderr, "                   trading memory for faster seed lookup [32]\n");
+    fprintf(stderr, "    -k INT     Tabulate the SA intervals of all converted k-mers up to this length\n");
+    fprintf(stderr, "                   so that seeding starts k bases deep, 0 to disable [%d]\n", BWT_KMER_DEF);
+    fprintf(stderr, "    -M         Also write a single-file, memory-mappable index (<prefix>.bis.idx)\n");
+    fprintf(stderr, "    -@ INT     Number of threads; the two strands are built concurrently [1]\n");
+    fprintf(stderr, "    -m STR     Peak memory of '-a blk' for both strands, e.g. 16G [8 bytes per base]\n");
     fprintf(stderr, "    -h         This help\n");
     fprintf(stderr, "\n");
     fprintf(stderr,	"Warning: '-a bwtsw' does not work for short genomes, while '-a is' and '-a div'\n");
@@ -208,21 +370,43 @@ int main_biscuit_index(int argc, char *argv[]) {
     extern void bwa_pac_rev_core(const char *fn, const char *fn_rev);
 
     char *prefix = 0, *str, *str2, *str3;
-    int c, algo_type = 0, is_64 = 0;
+    int c, algo_type = 0, is_64 = 0, to_mmap = 0, three_letter = 0, sa_intv = 32, kmer_k = BWT_KMER_DEF, n_threads = 1;
+    int64_t mem_cap = 0;
     clock_t t;
     int64_t l_pac;
 
     if (argc<2) { usage(); return 1; }
-    while ((c = getopt(argc, argv, ":6a:p:h")) >= 0) {
+    while ((c = getopt(argc, argv, ":36a:k:m:p:s:M@:h")) >= 0) {
         switch (c) {
             case 'a': // if -a is not set, algo_type will be determined later
                 if (strcmp(optarg, "div") == 0) algo_type = 1;
                 else if (strcmp(optarg, "bwtsw") == 0) algo_type = 2;
                 else if (strcmp(optarg, "is") == 0) algo_type = 3;
+                else if (strcmp(optarg, "blk") == 0) algo_type = 4;
                 else err_fatal(__func__, "unknown algorithm: '%s'.", optarg);
                 break;
             case 'p': prefix = strdup(optarg); break;
             case '6': is_64 = 1; break;
+            case 's':
+                sa_intv = atoi(optarg);
+                if (sa_intv < 1 || (sa_intv & (sa_intv - 1)))
+                    wzfatal("SA sampling interval must be a power of 2: %s\n", optarg);
+                break;
+            case 'k':
+                kmer_k = atoi(optarg);
+                if (kmer_k < 0 || kmer_k > BWT_KMER_MAX)
+                    wzfatal("k-mer table length must be within 0..%d: %s\n", BWT_KMER_MAX, optarg);
+                break;
+            case 'M': to_mmap = 1; break;
+            case 'm':
+                if ((mem_cap = index_parse_mem(optarg)) < 0)
+                    wzfatal("Unrecognized memory size: %s\n", optarg);
+                break;
+            case '@':
+                n_threads = atoi(optarg);
+                if (n_threads < 1) wzfatal("Number of threads must be positive: %s\n", optarg);
+                break;
+            case '3': three_letter = 1; break;
             case 'h': usage(); return 1;
             case ':': usage(); wzfatal("Option needs an argument: -%c\n", optopt); break;
             case '?': usage(); wzfatal("Unrecognized option: -%c\n", optopt); break;
@@ -244,103 +428,75 @@ int main_biscuit_index(int argc, char *argv[]) {
     str3 = (char*)calloc(strlen(prefix) + 50, 1);
 
     { /* nucleotide indexing */
-        /* generates .ct.pac, .ct.ann and .ct.amb */
-        gzFile fp = xzopen(argv[optind], "r");
-        t = clock();
+        /* generates .par.pac, .dau.pac, .bis.pac, .bis.ann and .bis.amb in one read */
+        double rt = realtime();
         fprintf(stderr, "[%s] Pack bisulfite FASTA... ", __func__);
-
-        l_pac = bis_bns_fasta2bntseq(fp, prefix, 1); /* parent strand */
-        l_pac = bis_bns_fasta2bntseq(fp, prefix, 0); /* daughter strand */
-
-        fprintf(stderr, "%.2f sec\n", (float)(clock() - t) / CLOCKS_PER_SEC);
-        err_gzclose(fp);
+        l_pac = bis_bns_fasta2pac(argv[optind], prefix);
+        fprintf(stderr, "%.2f sec\n", realtime() - rt);
     }
-    if (algo_type == 0) algo_type = l_pac > 50000000? 2 : 3; // set the algorithm for generating BWT
+    if (algo_type == 0) algo_type = l_pac > 50000000? (n_threads > 1? 4 : 2) : 3; // set the algorithm for generating BWT
+    if (bwa_verbose >= 3)
+        fprintf(stderr, "[M::%s] estimated peak memory %.2f GB with %d thread(s)\n", __func__,
+                index_mem_estimate(l_pac, algo_type, sa_intv, kmer_k, n_threads, mem_cap) / 1073741824., n_threads);
     {
-        t = clock();
-        fprintf(stderr, "[%s] Construct BWT for the parent strands...\n", __func__);
-        strcpy(str, prefix); strcat(str, ".par.pac");
-        strcpy(str2, prefix); strcat(str2, ".par.bwt");
-        if (algo_type == 2) bwt_bwtgen(str, str2);
-        else if (algo_type == 1 || algo_type == 3) {
-            bwt_t *bwt;
-            bwt = bwt_pac2bwt(str, algo_type == 3);
-            bwt_dump_bwt(str2, bwt);
-            bwt_destroy(bwt);
+        index_strand_t st[2];
+        for (c = 0; c < 2; ++c) {
+            st[c].prefix = prefix; st[c].parent = !c;
+            st[c].algo_type = algo_type; st[c].three_letter = three_letter; st[c].sa_intv = sa_intv;
+            st[c].mem_cap = n_threads > 1? mem_cap / 2 : mem_cap;
+            st[c].n_threads = c? n_threads / 2 : (n_threads + 1) / 2; // parent gets the odd thread
+            if (st[c].n_threads < 1) st[c].n_threads = 1;
         }
-        fprintf(stderr, "[%s] %.2f seconds elapse.\n", __func__, (float)(clock() - t) / CLOCKS_PER_SEC);
-    }
-    {
-        t = clock();
-        fprintf(stderr, "[%s] Construct BWT for the daughter strands...\n", __func__);
-        strcpy(str, prefix); strcat(str, ".dau.pac");
-        strcpy(str2, prefix); strcat(str2, ".dau.bwt");
-        if (algo_type == 2) bwt_bwtgen(str, str2);
-        else if (algo_type == 1 || algo_type == 3) {
-            bwt_t *bwt;
-            bwt = bwt_pac2bwt(str, algo_type == 3);
-            bwt_dump_bwt(str2, bwt);
-            bwt_destroy(bwt);
+        if (n_threads > 1) { /* the strands share nothing until the k-mer tables */
+            pthread_t tid[2];
+            for (c = 0; c < 2; ++c) pthread_create(&tid[c], 0, index_strand, &st[c]);
+            for (c = 0; c < 2; ++c) pthread_join(tid[c], 0);
+        } else {
+            index_strand(&st[0]);
+            index_strand(&st[1]);
         }
-        fprintf(stderr, "[%s] %.2f seconds elapse.\n", __func__, (float)(clock() - t) / CLOCKS_PER_SEC);
-    }
-    {
-        bwt_t *bwt;
-        strcpy(str, prefix); strcat(str, ".par.bwt");
-        t = clock();
-        fprintf(stderr, "[%s] Update parent BWT... \n", __func__);
-        bwt = bwt_restore_bwt(str);
-        bwt_bwtupdate_core(bwt);
-        bwt_dump_bwt(str, bwt);
-        bwt_destroy(bwt);
-        fprintf(stderr, "[%s] %.2f sec\n", __func__, (float)(clock() - t) / CLOCKS_PER_SEC);
-    }
-    {
-        bwt_t *bwt;
-        strcpy(str, prefix); strcat(str, ".dau.bwt");
-        t = clock();
-        fprintf(stderr, "[%s] Update daughter BWT... \n", __func__);
-        bwt = bwt_restore_bwt(str);
-        bwt_bwtupdate_core(bwt);
-        bwt_dump_bwt(str, bwt);
-        bwt_destroy(bwt);
-        fprintf(stderr, "[%s] %.2f sec\n", __func__, (float)(clock() - t) / CLOCKS_PER_SEC);
-    }
-    {
-        gzFile fp = xzopen(argv[optind], "r");
-        t = clock();
-        fprintf(stderr, "[%s] Pack forward-only FASTA... ", __func__);
-        l_pac = dump_forward_pac(fp, prefix);
-        fprintf(stderr, "%.2f sec\n", (float)(clock() - t) / CLOCKS_PER_SEC);
-        err_gzclose(fp);
         strcpy(str, prefix); strcat(str, ".par.pac");
         unlink(str);
         strcpy(str, prefix); strcat(str, ".dau.pac");
         unlink(str);
     }
     {
-        bwt_t *bwt;
-        strcpy(str, prefix); strcat(str, ".par.bwt");
-        strcpy(str3, prefix); strcat(str3, ".par.sa");
-        t = clock();
-        fprintf(stderr, "[%s] Construct parent SA from BWT and Occ... ", __func__);
-        bwt = bwt_restore_bwt(str);
-        bwt_cal_sa(bwt, 32);
-        bwt_dump_sa(str3, bwt);
-        bwt_destroy(bwt);
-        fprintf(stderr, "%.2f sec\n", (float)(clock() - t) / CLOCKS_PER_SEC);
+        index_kmer_t km;
+        strcpy(str, prefix); strcat(str, ".dau.bwt");
+        strcpy(str2, prefix); strcat(str2, ".par.bwt");
+        for (c = 0; c < 2; ++c) { /* a stale table would not match the new BWT */
+            strcpy(str3, prefix); strcat(str3, c? ".par.kmer" : ".dau.kmer");
+            unlink(str3);
+        }
+        if (kmer_k > 0) {
+            double rt = realtime();
+            fprintf(stderr, "[%s] Tabulate %d-mer intervals... ", __func__, kmer_k);
+            km.bwt[0] = bwt_restore_bwt(str);
+            km.bwt[1] = bwt_restore_bwt(str2);
+            km.k = kmer_k;
+            kt_for(n_threads > 1? 2 : 1, index_kmer_worker, &km, 2); /* each reads the other strand only */
+            for (c = 0; c < 2; ++c) {
+                strcpy(str3, prefix); strcat(str3, c? ".par.kmer" : ".dau.kmer");
+                bwt_dump_kmer(str3, km.bwt[c]);
+            }
+            fprintf(stderr, "%.2f sec, %.1f MB per strand\n", realtime() - rt,
+                    bwt_kmer_len(km.bwt[1]) * 8. / 1048576);
+            bwt_destroy(km.bwt[0]); bwt_destroy(km.bwt[1]);
+        }
     }
     {
-        bwt_t *bwt;
-        strcpy(str, prefix); strcat(str, ".dau.bwt");
-        strcpy(str3, prefix); strcat(str3, ".dau.sa");
-        t = clock();
-        fprintf(stderr, "[%s] Construct daughter SA from BWT and Occ... ", __func__);
-        bwt = bwt_restore_bwt(str);
-        bwt_cal_sa(bwt, 32);
-        bwt_dump_sa(str3, bwt);
-        bwt_destroy(bwt);
-        fprintf(stderr, "%.2f sec\n", (float)(clock() - t) / CLOCKS_PER_SEC);
+        char *fn = bwa_idx_mmap_fn(prefix);
+        if (to_mmap) {
+            bwaidx_t *idx;
+            t = clock();
+            idx = bwa_idx_load_from_disk(prefix, BWA_IDX_ALL);
+            fprintf(stderr, "[%s] Write memory-mappable index container... ", __func__);
+            if (idx == 0 || bwa_idx_dump_mmap(fn, idx) < 0)
+                wzfatal("Failed to write %s\n", fn);
+            bwa_idx_destroy(idx);
+            fprintf(stderr, "%.2f sec\n", (float)(clock() - t) / CLOCKS_PER_SEC);
+        } else unlink(fn); /* a stale container would shadow the new index */
+        free(fn);
     }
     free(str3); free(str2); free(str); free(prefix);
     return 0;
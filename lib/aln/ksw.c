@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <emmintrin.h>
 #include "ksw.h"
@@ -45,10 +46,12 @@ const kswr_t g_defr = { 0, -1, -1, -1, -1, -1, -1 };
 
 struct _kswq_t {
 	int qlen, slen;
-	uint8_t shift, mdiff, max, size;
-	__m128i *qp, *H0, *H1, *E, *Hmax;
+	uint8_t shift, mdiff, max, size, vsize; // vsize: bytes per vector of the profile, 16, 32 or 64
+	__m128i *qp, *H0, *H1, *E, *Hmax, *V; // V: columns an SSE2 profile would have, for vsize > 16
 };
 
+static int ksw_vsize = 16; // widest vector the striped kernels may use; set at start-up
+
 /**
  * Initialize the query data structure
  *
@@ -63,18 +66,27 @@ struct _kswq_t {
 kswq_t *ksw_qinit(int size, int qlen, const uint8_t *query, int m, const int8_t *mat)
 {
 	kswq_t *q;
-	int slen, a, tmp, p;
+	int slen, a, tmp, p, vsize;
 
 	size = size > 1? 2 : 1;
-	p = 8 * (3 - size); // # values per __m128i
+	for (vsize = ksw_vsize; vsize > 16 && qlen < 4 * vsize / size; vsize >>= 1); // with fewer segments, the lazy-F loop dominates
+	p = vsize / size; // # values per vector
 	slen = (qlen + p - 1) / p; // segmented length
-	q = (kswq_t*)malloc(sizeof(kswq_t) + 256 + 16 * slen * (m + 4)); // a single block of memory
-	q->qp = (__m128i*)(((size_t)q + sizeof(kswq_t) + 15) >> 4 << 4); // align memory
-	q->H0 = q->qp + slen * m;
-	q->H1 = q->H0 + slen;
-	q->E  = q->H1 + slen;
-	q->Hmax = q->E + slen;
-	q->slen = slen; q->qlen = qlen; q->size = size;
+	q = (kswq_t*)malloc(sizeof(kswq_t) + 256 + vsize * slen * (m + 5)); // a single block of memory
+	q->qp = (__m128i*)(((size_t)q + sizeof(kswq_t) + 63) >> 6 << 6); // align memory
+	q->H0 = q->qp + slen * m * (vsize / 16);
+	q->H1 = q->H0 + slen * (vsize / 16);
+	q->E  = q->H1 + slen * (vsize / 16);
+	q->Hmax = q->E + slen * (vsize / 16);
+	q->V = q->Hmax + slen * (vsize / 16);
+	q->slen = slen; q->qlen = qlen; q->size = size; q->vsize = vsize;
+	if (vsize > 16) { // wider vectors pad more columns; keep those out of the maxima as SSE2 never has them
+		int i, k, nlen = (qlen + 16 / size - 1) / (16 / size) * (16 / size);
+		uint8_t *t = (uint8_t*)q->V;
+		for (i = 0; i < slen; ++i)
+			for (k = i; k < slen * p; k += slen)
+				memset(t, k < nlen? 0xff : 0, size), t += size;
+	}
 	// compute shift
 	tmp = m * m;
 	for (a = 0, q->shift = 127, q->mdiff = 0; a < tmp; ++a) { // find the minimum and maximum score
@@ -333,6 +345,322 @@ end_loop8:
 	return r;
 }
 
+/* AVX2 and AVX-512BW versions of ksw_u8() and ksw_i16(), striped the same
+ * way over 32 or 64 bytes. Cells are the same as with SSE2; the max of a
+ * row only covers the columns of an SSE2 profile (q->V), so that padding
+ * does not move te, score2 or te2. */
+
+typedef kswr_t (*ksw_sw_f)(kswq_t*, int, const uint8_t*, int, int, int, int, int);
+
+static ksw_sw_f ksw_sw[3][2] = { { ksw_u8, ksw_i16 } }; // [vsize>>5][size-1]
+
+/* SW with XS_P 8-bit lanes; see ksw_u8() for the details */
+#define KSW_SW_U8_KERNEL(func) \
+static kswr_t func(kswq_t *q, int tlen, const uint8_t *target, int _o_del, int _e_del, int _o_ins, int _e_ins, int xtra) \
+{ \
+	int slen, i, m_b, n_b, te = -1, gmax = 0, minsc, endsc; \
+	uint64_t *b; \
+	xs_v zero, oe_del, e_del, oe_ins, e_ins, shift, *H0, *H1, *E, *Hmax, *V; \
+	kswr_t r; \
+	r = g_defr; \
+	minsc = (xtra&KSW_XSUBO)? xtra&0xffff : 0x10000; \
+	endsc = (xtra&KSW_XSTOP)? xtra&0xffff : 0x10000; \
+	m_b = n_b = 0; b = 0; \
+	zero = xs_set1_8(0); \
+	oe_del = xs_set1_8(_o_del + _e_del); \
+	e_del = xs_set1_8(_e_del); \
+	oe_ins = xs_set1_8(_o_ins + _e_ins); \
+	e_ins = xs_set1_8(_e_ins); \
+	shift = xs_set1_8(q->shift); \
+	H0 = (xs_v*)q->H0; H1 = (xs_v*)q->H1; E = (xs_v*)q->E; Hmax = (xs_v*)q->Hmax; V = (xs_v*)q->V; \
+	slen = q->slen; \
+	for (i = 0; i < slen; ++i) { \
+		xs_store(E + i, zero); \
+		xs_store(H0 + i, zero); \
+		xs_store(Hmax + i, zero); \
+	} \
+	for (i = 0; i < tlen; ++i) { \
+		int j, k, imax; \
+		xs_v e, h, t, f = zero, max = zero, *S = (xs_v*)q->qp + target[i] * slen; \
+		h = xs_load(H0 + slen - 1); \
+		h = xs_shl(h, 1); \
+		for (j = 0; LIKELY(j < slen); ++j) { \
+			h = xs_adds_u8(h, xs_load(S + j)); \
+			h = xs_subs_u8(h, shift); \
+			e = xs_load(E + j); \
+			h = xs_max_u8(h, e); \
+			h = xs_max_u8(h, f); \
+			max = xs_max_u8(max, xs_and(h, xs_load(V + j))); \
+			xs_store(H1 + j, h); \
+			e = xs_subs_u8(e, e_del); \
+			t = xs_subs_u8(h, oe_del); \
+			e = xs_max_u8(e, t); \
+			xs_store(E + j, e); \
+			f = xs_subs_u8(f, e_ins); \
+			t = xs_subs_u8(h, oe_ins); \
+			f = xs_max_u8(f, t); \
+			h = xs_load(H0 + j); \
+		} \
+		for (k = 0; LIKELY(k < XS_P); ++k) { \
+			f = xs_shl(f, 1); \
+			for (j = 0; LIKELY(j < slen); ++j) { \
+				h = xs_load(H1 + j); \
+				h = xs_max_u8(h, f); \
+				xs_store(H1 + j, h); \
+				h = xs_subs_u8(h, oe_ins); \
+				f = xs_subs_u8(f, e_ins); \
+				if (UNLIKELY(xs_zero(xs_subs_u8(f, h)))) goto end_loop; \
+			} \
+		} \
+end_loop: \
+		imax = xs_hmax_u8(max); \
+		if (imax >= minsc) { \
+			if (n_b == 0 || (int32_t)b[n_b-1] + 1 != i) { \
+				if (n_b == m_b) { \
+					m_b = m_b? m_b<<1 : 8; \
+					b = (uint64_t*)realloc(b, 8 * m_b); \
+				} \
+				b[n_b++] = (uint64_t)imax<<32 | i; \
+			} else if ((int)(b[n_b-1]>>32) < imax) b[n_b-1] = (uint64_t)imax<<32 | i; \
+		} \
+		if (imax > gmax) { \
+			gmax = imax; te = i; \
+			for (j = 0; LIKELY(j < slen); ++j) \
+				xs_store(Hmax + j, xs_load(H1 + j)); \
+			if (gmax + q->shift >= 255 || gmax >= endsc) break; \
+		} \
+		S = H1; H1 = H0; H0 = S; \
+	} \
+	r.score = gmax + q->shift < 255? gmax : 255; \
+	r.te = te; \
+	if (r.score != 255) { \
+		int max = -1, tmp, low, high, qlen = slen * XS_P; \
+		uint8_t *t = (uint8_t*)Hmax, *v = (uint8_t*)V; \
+		for (i = 0; i < qlen; ++i, ++t) \
+			if (v[i] == 0) continue; \
+			else if ((int)*t > max) max = *t, r.qe = i / XS_P + i % XS_P * slen; \
+			else if ((int)*t == max && (tmp = i / XS_P + i % XS_P * slen) < r.qe) r.qe = tmp; \
+		if (b) { \
+			i = (r.score + q->max - 1) / q->max; \
+			low = te - i; high = te + i; \
+			for (i = 0; i < n_b; ++i) { \
+				int e = (int32_t)b[i]; \
+				if ((e < low || e > high) && (int)(b[i]>>32) > r.score2) \
+					r.score2 = b[i]>>32, r.te2 = e; \
+			} \
+		} \
+	} \
+	free(b); \
+	return r; \
+}
+
+/* SW with XS_P/2 16-bit lanes; see ksw_i16() for the details */
+#define KSW_SW_I16_KERNEL(func) \
+static kswr_t func(kswq_t *q, int tlen, const uint8_t *target, int _o_del, int _e_del, int _o_ins, int _e_ins, int xtra) \
+{ \
+	int slen, i, m_b, n_b, te = -1, gmax = 0, minsc, endsc; \
+	uint64_t *b; \
+	xs_v zero, oe_del, e_del, oe_ins, e_ins, *H0, *H1, *E, *Hmax, *V; \
+	kswr_t r; \
+	r = g_defr; \
+	minsc = (xtra&KSW_XSUBO)? xtra&0xffff : 0x10000; \
+	endsc = (xtra&KSW_XSTOP)? xtra&0xffff : 0x10000; \
+	m_b = n_b = 0; b = 0; \
+	zero = xs_set1_16(0); \
+	oe_del = xs_set1_16(_o_del + _e_del); \
+	e_del = xs_set1_16(_e_del); \
+	oe_ins = xs_set1_16(_o_ins + _e_ins); \
+	e_ins = xs_set1_16(_e_ins); \
+	H0 = (xs_v*)q->H0; H1 = (xs_v*)q->H1; E = (xs_v*)q->E; Hmax = (xs_v*)q->Hmax; V = (xs_v*)q->V; \
+	slen = q->slen; \
+	for (i = 0; i < slen; ++i) { \
+		xs_store(E + i, zero); \
+		xs_store(H0 + i, zero); \
+		xs_store(Hmax + i, zero); \
+	} \
+	for (i = 0; i < tlen; ++i) { \
+		int j, k, imax; \
+		xs_v e, t, h, f = zero, max = zero, *S = (xs_v*)q->qp + target[i] * slen; \
+		h = xs_load(H0 + slen - 1); \
+		h = xs_shl(h, 2); \
+		for (j = 0; LIKELY(j < slen); ++j) { \
+			h = xs_adds_i16(h, xs_load(S + j)); \
+			e = xs_load(E + j); \
+			h = xs_max_i16(h, e); \
+			h = xs_max_i16(h, f); \
+			max = xs_max_i16(max, xs_and(h, xs_load(V + j))); \
+			xs_store(H1 + j, h); \
+			e = xs_subs_u16(e, e_del); \
+			t = xs_subs_u16(h, oe_del); \
+			e = xs_max_i16(e, t); \
+			xs_store(E + j, e); \
+			f = xs_subs_u16(f, e_ins); \
+			t = xs_subs_u16(h, oe_ins); \
+			f = xs_max_i16(f, t); \
+			h = xs_load(H0 + j); \
+		} \
+		for (k = 0; LIKELY(k < XS_P / 2); ++k) { \
+			f = xs_shl(f, 2); \
+			for (j = 0; LIKELY(j < slen); ++j) { \
+				h = xs_load(H1 + j); \
+				h = xs_max_i16(h, f); \
+				xs_store(H1 + j, h); \
+				h = xs_subs_u16(h, oe_ins); \
+				f = xs_subs_u16(f, e_ins); \
+				if (UNLIKELY(xs_none_gt_i16(f, h))) goto end_loop; \
+			} \
+		} \
+end_loop: \
+		imax = xs_hmax_i16(max); \
+		if (imax >= minsc) { \
+			if (n_b == 0 || (int32_t)b[n_b-1] + 1 != i) { \
+				if (n_b == m_b) { \
+					m_b = m_b? m_b<<1 : 8; \
+					b = (uint64_t*)realloc(b, 8 * m_b); \
+				} \
+				b[n_b++] = (uint64_t)imax<<32 | i; \
+			} else if ((int)(b[n_b-1]>>32) < imax) b[n_b-1] = (uint64_t)imax<<32 | i; \
+		} \
+		if (imax > gmax) { \
+			gmax = imax; te = i; \
+			for (j = 0; LIKELY(j < slen); ++j) \
+				xs_store(Hmax + j, xs_load(H1 + j)); \
+			if (gmax >= endsc) break; \
+		} \
+		S = H1; H1 = H0; H0 = S; \
+	} \
+	r.score = gmax; r.te = te; \
+	{ \
+		int max = -1, tmp, low, high, qlen = slen * XS_P / 2; \
+		uint16_t *t = (uint16_t*)Hmax, *v = (uint16_t*)V; \
+		for (i = 0, r.qe = -1; i < qlen; ++i, ++t) \
+			if (v[i] == 0) continue; \
+			else if ((int)*t > max) max = *t, r.qe = i / (XS_P / 2) + i % (XS_P / 2) * slen; \
+			else if ((int)*t == max && (tmp = i / (XS_P / 2) + i % (XS_P / 2) * slen) < r.qe) r.qe = tmp; \
+		if (b) { \
+			i = (r.score + q->max - 1) / q->max; \
+			low = te - i; high = te + i; \
+			for (i = 0; i < n_b; ++i) { \
+				int e = (int32_t)b[i]; \
+				if ((e < low || e > high) && (int)(b[i]>>32) > r.score2) \
+					r.score2 = b[i]>>32, r.te2 = e; \
+			} \
+		} \
+	} \
+	free(b); \
+	return r; \
+}
+
+#ifdef __GNUC__
+#include <immintrin.h>
+
+// AVX2: 32 bytes; shifts and maxima cross the two 128-bit lanes
+#define XS_P 32
+#define xs_v __m256i
+#define xs_load(p) _mm256_load_si256(p)
+#define xs_store(p, v) _mm256_store_si256((p), (v))
+#define xs_set1_8(x) _mm256_set1_epi8(x)
+#define xs_set1_16(x) _mm256_set1_epi16(x)
+#define xs_and(a, b) _mm256_and_si256(a, b)
+#define xs_shl(a, n) _mm256_alignr_epi8((a), _mm256_permute2x128_si256((a), (a), 0x08), 16 - (n))
+#define xs_adds_u8(a, b) _mm256_adds_epu8(a, b)
+#define xs_subs_u8(a, b) _mm256_subs_epu8(a, b)
+#define xs_max_u8(a, b) _mm256_max_epu8(a, b)
+#define xs_adds_i16(a, b) _mm256_adds_epi16(a, b)
+#define xs_subs_u16(a, b) _mm256_subs_epu16(a, b)
+#define xs_max_i16(a, b) _mm256_max_epi16(a, b)
+#define xs_zero(a) _mm256_testz_si256(a, a)
+#define xs_none_gt_i16(a, b) xs_zero(_mm256_cmpgt_epi16(a, b))
+#define xs_hmax_u8(a) ksw_hmax_u8_128(_mm_max_epu8(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)))
+#define xs_hmax_i16(a) ksw_hmax_i16_128(_mm_max_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)))
+
+static inline int ksw_hmax_u8_128(__m128i xx)
+{
+	int ret;
+	__max_16(ret, xx);
+	return ret;
+}
+
+static inline int ksw_hmax_i16_128(__m128i xx)
+{
+	int ret;
+	__max_8(ret, xx);
+	return ret;
+}
+
+__attribute__((target("avx2"))) KSW_SW_U8_KERNEL(ksw_u8_avx2)
+__attribute__((target("avx2"))) KSW_SW_I16_KERNEL(ksw_i16_avx2)
+#undef XS_P
+#undef xs_v
+#undef xs_load
+#undef xs_store
+#undef xs_set1_8
+#undef xs_set1_16
+#undef xs_and
+#undef xs_shl
+#undef xs_adds_u8
+#undef xs_subs_u8
+#undef xs_max_u8
+#undef xs_adds_i16
+#undef xs_subs_u16
+#undef xs_max_i16
+#undef xs_zero
+#undef xs_none_gt_i16
+#undef xs_hmax_u8
+#undef xs_hmax_i16
+
+// AVX-512BW: 64 bytes
+#define XS_P 64
+#define xs_v __m512i
+#define xs_load(p) _mm512_load_si512((const void*)(p))
+#define xs_store(p, v) _mm512_store_si512((void*)(p), (v))
+#define xs_set1_8(x) _mm512_set1_epi8(x)
+#define xs_set1_16(x) _mm512_set1_epi16(x)
+#define xs_and(a, b) _mm512_and_si512(a, b)
+#define xs_shl(a, n) _mm512_alignr_epi8((a), _mm512_alignr_epi64((a), _mm512_setzero_si512(), 6), 16 - (n))
+#define xs_adds_u8(a, b) _mm512_adds_epu8(a, b)
+#define xs_subs_u8(a, b) _mm512_subs_epu8(a, b)
+#define xs_max_u8(a, b) _mm512_max_epu8(a, b)
+#define xs_adds_i16(a, b) _mm512_adds_epi16(a, b)
+#define xs_subs_u16(a, b) _mm512_subs_epu16(a, b)
+#define xs_max_i16(a, b) _mm512_max_epi16(a, b)
+#define xs_zero(a) (_mm512_test_epi8_mask(a, a) == 0)
+#define xs_none_gt_i16(a, b) (_mm512_cmpgt_epi16_mask(a, b) == 0)
+#define xs_hmax_u8(a) ksw_hmax_u8_256(_mm256_max_epu8(_mm512_castsi512_si256(a), _mm512_extracti64x4_epi64(a, 1)))
+#define xs_hmax_i16(a) ksw_hmax_i16_256(_mm256_max_epi16(_mm512_castsi512_si256(a), _mm512_extracti64x4_epi64(a, 1)))
+
+__attribute__((target("avx2"))) static inline int ksw_hmax_u8_256(__m256i a)
+{
+	return ksw_hmax_u8_128(_mm_max_epu8(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+}
+
+__attribute__((target("avx2"))) static inline int ksw_hmax_i16_256(__m256i a)
+{
+	return ksw_hmax_i16_128(_mm_max_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+}
+
+__attribute__((target("avx2,avx512f,avx512bw"))) KSW_SW_U8_KERNEL(ksw_u8_avx512)
+__attribute__((target("avx2,avx512f,avx512bw"))) KSW_SW_I16_KERNEL(ksw_i16_avx512)
+#undef XS_P
+#undef xs_v
+#undef xs_load
+#undef xs_store
+#undef xs_set1_8
+#undef xs_set1_16
+#undef xs_and
+#undef xs_shl
+#undef xs_adds_u8
+#undef xs_subs_u8
+#undef xs_max_u8
+#undef xs_adds_i16
+#undef xs_subs_u16
+#undef xs_max_i16
+#undef xs_zero
+#undef xs_none_gt_i16
+#undef xs_hmax_u8
+#undef xs_hmax_i16
+#endif
+
 static inline void revseq(int l, uint8_t *s)
 {
 	int i, t;
@@ -349,13 +677,14 @@ kswr_t ksw_align2(int qlen, uint8_t *query, int tlen, uint8_t *target, int m, co
 
 	q = (qry && *qry)? *qry : ksw_qinit((xtra&KSW_XBYTE)? 1 : 2, qlen, query, m, mat);
 	if (qry && *qry == 0) *qry = q;
-	func = q->size == 2? ksw_i16 : ksw_u8;
+	func = ksw_sw[q->vsize>>5][q->size-1];
 	size = q->size;
 	r = func(q, tlen, target, o_del, e_del, o_ins, e_ins, xtra);
 	if (qry == 0) free(q);
 	if ((xtra&KSW_XSTART) == 0 || ((xtra&KSW_XSUBO) && r.score < (xtra&0xffff))) return r;
 	revseq(r.qe + 1, query); revseq(r.te + 1, target); // +1 because qe/te points to the exact end, not the position after the end
 	q = ksw_qinit(size, r.qe + 1, query, m, mat);
+	func = ksw_sw[q->vsize>>5][size-1]; // a shorter query may get narrower vectors
 	rr = func(q, tlen, target, o_del, e_del, o_ins, e_ins, KSW_XSTOP | r.score);
 	revseq(r.qe + 1, query); revseq(r.te + 1, target);
 	free(q);
@@ -483,6 +812,276 @@ int ksw_extend(int qlen, const uint8_t *query, int tlen, const uint8_t *target,
 	return ksw_extend2(qlen, query, tlen, target, m, mat, gapo, gape, gapo, gape, w, end_bonus, zdrop, h0, qle, tle, gtle, gscore, max_off);
 }
 
+/***********************************
+ *** Batched (inter-sequence) SW ***
+ ***********************************/
+
+/* Up to XB_L extensions run side by side, one per 16-bit lane of a vector
+ * (8 with SSE2, 16 with AVX2, 32 with AVX-512BW), each following
+ * ksw_extend2() cell by cell. Band limits, the maximum and Z-drop stay
+ * per-lane scalars; a row runs over the union of the lane bands with the
+ * cells outside a lane's band masked, so a lane stops exactly where
+ * ksw_extend2() would. The kernel is written once against the xb_*()
+ * macros and instantiated for each instruction set; the widest one the CPU
+ * has is picked at start-up. */
+
+#define KSW_XB_MAX_M 8
+
+typedef struct {
+	kswx_t *p; // job in the lane, 0 if idle
+	int i, beg, end, w, max, max_i, max_j, max_ie, gscore, max_off;
+} kswx_lane_t;
+
+typedef void (*ksw_extb_f)(int n, kswx_t **jobs, int m, int o_del, int e_del, int o_ins, int e_ins, int zdrop);
+
+/* Each lane has its own row, so a lane that stops takes the next job
+ * straight away instead of idling until the slowest lane is done. */
+#define KSW_XB_KERNEL(func) \
+static void func(int n, kswx_t **jobs, int m, int o_del, int e_del, int o_ins, int e_ins, int zdrop) \
+{ \
+	int i, j, l, c, n_act, next = 0, qmax = 0, oe_del = o_del + e_del, oe_ins = o_ins + e_ins; \
+	int16_t *H, *E, *qp, lbeg[XB_L], lend[XB_L], lh1[XB_L], lt[XB_L], lmx[XB_L], lmj[XB_L]; \
+	xb_v zero = xb_set1(0), v_oe_del = xb_set1(oe_del), v_e_del = xb_set1(e_del), v_oe_ins = xb_set1(oe_ins), v_e_ins = xb_set1(e_ins); \
+	xb_m mt[KSW_XB_MAX_M]; \
+	kswx_lane_t st[XB_L]; \
+	for (l = 0; l < n; ++l) \
+		qmax = qmax > jobs[l]->qlen? qmax : jobs[l]->qlen; \
+	H = (int16_t*)calloc((2 * (qmax + 1) + m * qmax) * XB_L, 2); \
+	E = H + (qmax + 1) * XB_L; qp = E + (qmax + 1) * XB_L; \
+	memset(st, 0, sizeof(st)); \
+	do { \
+		xb_v beg, end, h1, f, mx, mj; \
+		int J0 = qmax, J1 = 0; \
+		for (l = n_act = 0; l < XB_L; ++l) { /* apply the band and compute the first column */ \
+			kswx_lane_t *s = &st[l]; \
+			kswx_t *p; \
+			int x; \
+			for (;;) { \
+				if (s->p && s->i >= s->p->tlen) { /* the job is done */ \
+					p = s->p; \
+					p->score = s->max; \
+					p->qle = s->max_j + 1, p->tle = s->max_i + 1; \
+					p->gtle = s->max_ie + 1, p->gscore = s->gscore; \
+					p->max_off = s->max_off; \
+					s->p = 0; \
+				} \
+				if (s->p || next == n) break; \
+				p = s->p = jobs[next++]; /* query profile, first row and band, as in ksw_extend2() */ \
+				for (j = 0; j <= qmax; ++j) H[j * XB_L + l] = E[j * XB_L + l] = 0; \
+				for (c = 0; c < m; ++c) \
+					for (j = 0; j < p->qlen; ++j) \
+						qp[(c * qmax + j) * XB_L + l] = p->mat[c * m + p->query[j]]; \
+				H[l] = p->h0; H[XB_L + l] = p->h0 > oe_ins? p->h0 - oe_ins : 0; \
+				for (j = 2; j <= p->qlen && H[(j-1) * XB_L + l] > e_ins; ++j) \
+					H[j * XB_L + l] = H[(j-1) * XB_L + l] - e_ins; \
+				for (i = 0, x = 0; i < m * m; ++i) \
+					x = x > p->mat[i]? x : p->mat[i]; \
+				s->w = p->w; \
+				i = (int)((double)(p->qlen * x + p->end_bonus - o_ins) / e_ins + 1.); \
+				i = i > 1? i : 1; \
+				s->w = s->w < i? s->w : i; \
+				i = (int)((double)(p->qlen * x + p->end_bonus - o_del) / e_del + 1.); \
+				i = i > 1? i : 1; \
+				s->w = s->w < i? s->w : i; \
+				s->max = p->h0, s->max_i = s->max_j = -1, s->max_ie = -1, s->gscore = -1; \
+				s->max_off = 0; \
+				s->i = 0, s->beg = 0, s->end = p->qlen; \
+			} \
+			if (s->p == 0) { \
+				lbeg[l] = lend[l] = lh1[l] = lt[l] = 0; \
+				continue; \
+			} \
+			p = s->p, i = s->i; \
+			if (s->beg < i - s->w) s->beg = i - s->w; \
+			if (s->end > i + s->w + 1) s->end = i + s->w + 1; \
+			if (s->end > p->qlen) s->end = p->qlen; \
+			if (s->beg == 0) { \
+				x = p->h0 - (o_del + e_del * (i + 1)); \
+				if (x < 0) x = 0; \
+			} else x = 0; \
+			lbeg[l] = s->beg, lend[l] = s->end, lh1[l] = x, lt[l] = p->target[i]; \
+			J0 = J0 < s->beg? J0 : s->beg; \
+			J1 = J1 > s->end? J1 : s->end; \
+			++n_act; \
+		} \
+		if (n_act == 0) break; \
+		beg = xb_load(lbeg), end = xb_load(lend), h1 = xb_load(lh1); \
+		for (c = 0; c < m; ++c) mt[c] = xb_eq(xb_load(lt), xb_set1(c)); \
+		f = zero, mx = zero, mj = xb_set1(-1); \
+		for (j = J0; j < J1; ++j) { /* the same cell order as ksw_extend2() */ \
+			xb_v jv = xb_set1(j), q = zero, M, e, h, t; \
+			xb_m act, z; \
+			act = xb_mandnot(xb_gt(beg, jv), xb_gt(end, jv)); /* beg <= j < end */ \
+			for (c = 0; c < m; ++c) q = xb_blend(q, xb_load(&qp[(c * qmax + j) * XB_L]), mt[c]); \
+			M = xb_load(&H[j * XB_L]), e = xb_load(&E[j * XB_L]); \
+			xb_store(&H[j * XB_L], xb_blend(M, h1, act)); \
+			M = xb_blend(zero, xb_add(M, q), xb_gt(M, zero)); \
+			h = xb_max(xb_max(M, e), f); \
+			h1 = xb_blend(h1, h, act); \
+			z = xb_mandnot(xb_gt(mx, h), act); \
+			mj = xb_blend(mj, jv, z); \
+			mx = xb_blend(mx, h, z); \
+			t = xb_max(xb_sub(M, v_oe_del), zero); \
+			xb_store(&E[j * XB_L], xb_blend(e, xb_max(xb_sub(e, v_e_del), t), act)); \
+			t = xb_max(xb_sub(M, v_oe_ins), zero); \
+			f = xb_blend(f, xb_max(xb_sub(f, v_e_ins), t), act); \
+		} \
+		xb_store(lh1, h1), xb_store(lmx, mx), xb_store(lmj, mj); \
+		for (l = 0; l < XB_L; ++l) { /* the end of the row, per lane */ \
+			kswx_lane_t *s = &st[l]; \
+			int m1 = lmx[l], mj1 = lmj[l]; \
+			if (s->p == 0) continue; \
+			i = s->i++; \
+			H[s->end * XB_L + l] = lh1[l], E[s->end * XB_L + l] = 0; \
+			if ((s->beg < s->end? s->end : s->beg) == s->p->qlen) { \
+				s->max_ie = s->gscore > lh1[l]? s->max_ie : i; \
+				s->gscore = s->gscore > lh1[l]? s->gscore : lh1[l]; \
+			} \
+			if (m1 == 0) { \
+				s->i = s->p->tlen; /* stop */ \
+				continue; \
+			} \
+			if (m1 > s->max) { \
+				s->max = m1, s->max_i = i, s->max_j = mj1; \
+				s->max_off = s->max_off > abs(mj1 - i)? s->max_off : abs(mj1 - i); \
+			} else if (zdrop > 0) { \
+				if (i - s->max_i > mj1 - s->max_j) { \
+					if (s->max - m1 - ((i - s->max_i) - (mj1 - s->max_j)) * e_del > zdrop) s->i = s->p->tlen; \
+				} else { \
+					if (s->max - m1 - ((mj1 - s->max_j) - (i - s->max_i)) * e_ins > zdrop) s->i = s->p->tlen; \
+				} \
+				if (s->i == s->p->tlen) continue; \
+			} \
+			for (j = s->beg; j < s->end && H[j * XB_L + l] == 0 && E[j * XB_L + l] == 0; ++j); \
+			s->beg = j; \
+			for (j = s->end; j >= s->beg && H[j * XB_L + l] == 0 && E[j * XB_L + l] == 0; --j); \
+			s->end = j + 2 < s->p->qlen? j + 2 : s->p->qlen; \
+		} \
+	} while (1); \
+	free(H); \
+}
+
+// SSE2: 8 lanes
+#define XB_L 8
+#define xb_v __m128i
+#define xb_m __m128i
+#define xb_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define xb_store(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define xb_set1(x) _mm_set1_epi16(x)
+#define xb_add(a, b) _mm_add_epi16(a, b)
+#define xb_sub(a, b) _mm_sub_epi16(a, b)
+#define xb_max(a, b) _mm_max_epi16(a, b)
+#define xb_gt(a, b) _mm_cmpgt_epi16(a, b)
+#define xb_eq(a, b) _mm_cmpeq_epi16(a, b)
+#define xb_mandnot(a, b) _mm_andnot_si128(a, b) // ~a & b
+#define xb_blend(a, b, x) _mm_or_si128(_mm_andnot_si128(x, a), _mm_and_si128(x, b)) // b where x is set
+KSW_XB_KERNEL(ksw_extb_sse2)
+#undef XB_L
+#undef xb_v
+#undef xb_m
+#undef xb_load
+#undef xb_store
+#undef xb_set1
+#undef xb_add
+#undef xb_sub
+#undef xb_max
+#undef xb_gt
+#undef xb_eq
+#undef xb_mandnot
+#undef xb_blend
+
+static ksw_extb_f ksw_extb = ksw_extb_sse2;
+
+#ifdef __GNUC__
+
+// AVX2: 16 lanes
+#define XB_L 16
+#define xb_v __m256i
+#define xb_m __m256i
+#define xb_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define xb_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define xb_set1(x) _mm256_set1_epi16(x)
+#define xb_add(a, b) _mm256_add_epi16(a, b)
+#define xb_sub(a, b) _mm256_sub_epi16(a, b)
+#define xb_max(a, b) _mm256_max_epi16(a, b)
+#define xb_gt(a, b) _mm256_cmpgt_epi16(a, b)
+#define xb_eq(a, b) _mm256_cmpeq_epi16(a, b)
+#define xb_mandnot(a, b) _mm256_andnot_si256(a, b)
+#define xb_blend(a, b, x) _mm256_blendv_epi8(a, b, x)
+__attribute__((target("avx2"))) KSW_XB_KERNEL(ksw_extb_avx2)
+#undef XB_L
+#undef xb_v
+#undef xb_m
+#undef xb_load
+#undef xb_store
+#undef xb_set1
+#undef xb_add
+#undef xb_sub
+#undef xb_max
+#undef xb_gt
+#undef xb_eq
+#undef xb_mandnot
+#undef xb_blend
+
+// AVX-512BW: 32 lanes, with mask registers
+#define XB_L 32
+#define xb_v __m512i
+#define xb_m __mmask32
+#define xb_load(p) _mm512_loadu_si512((const void*)(p))
+#define xb_store(p, v) _mm512_storeu_si512((void*)(p), (v))
+#define xb_set1(x) _mm512_set1_epi16(x)
+#define xb_add(a, b) _mm512_add_epi16(a, b)
+#define xb_sub(a, b) _mm512_sub_epi16(a, b)
+#define xb_max(a, b) _mm512_max_epi16(a, b)
+#define xb_gt(a, b) _mm512_cmpgt_epi16_mask(a, b)
+#define xb_eq(a, b) _mm512_cmpeq_epi16_mask(a, b)
+#define xb_mandnot(a, b) (~(a) & (b))
+#define xb_blend(a, b, x) _mm512_mask_blend_epi16(x, a, b)
+__attribute__((target("avx2,avx512f,avx512bw"))) KSW_XB_KERNEL(ksw_extb_avx512)
+#undef XB_L
+#undef xb_v
+#undef xb_m
+#undef xb_load
+#undef xb_store
+#undef xb_set1
+#undef xb_add
+#undef xb_sub
+#undef xb_max
+#undef xb_gt
+#undef xb_eq
+#undef xb_mandnot
+#undef xb_blend
+
+#endif
+
+static int kswx_cmp(const void *a, const void *b)
+{
+	const kswx_t *x = *(kswx_t*const*)a, *y = *(kswx_t*const*)b;
+	if (x->qlen != y->qlen) return x->qlen > y->qlen? -1 : 1;
+	return (x->tlen < y->tlen) - (x->tlen > y->tlen);
+}
+
+void ksw_extend2_batch(int n, kswx_t *jobs, int m, int o_del, int e_del, int o_ins, int e_ins, int zdrop)
+{
+	kswx_t **a;
+	int i, k, l;
+	if (n <= 0) return;
+	a = (kswx_t**)malloc(n * sizeof(kswx_t*));
+	for (i = k = 0; i < n; ++i) {
+		kswx_t *p = &jobs[i];
+		int max = 0;
+		assert(p->h0 > 0);
+		for (l = 0; l < m * m; ++l)
+			max = max > p->mat[l]? max : p->mat[l];
+		if (m > KSW_XB_MAX_M || p->h0 + p->qlen * max >= INT16_MAX || o_del + e_del >= INT16_MAX || o_ins + e_ins >= INT16_MAX) // scores may not fit in 16 bits
+			p->score = ksw_extend2(p->qlen, p->query, p->tlen, p->target, m, p->mat, o_del, e_del, o_ins, e_ins, p->w, p->end_bonus, zdrop, p->h0, &p->qle, &p->tle, &p->gtle, &p->gscore, &p->max_off);
+		else a[k++] = p;
+	}
+	qsort(a, k, sizeof(kswx_t*), kswx_cmp); // neighbouring lanes have bands of similar widths
+	ksw_extb(k, a, m, o_del, e_del, o_ins, e_ins, zdrop);
+	free(a);
+}
+
 /********************
  * Global alignment *
  ********************/
@@ -501,7 +1100,7 @@ static inline uint32_t *push_cigar(int *n_cigar, int *m_cigar, uint32_t *cigar,
 	return cigar;
 }
 
-int ksw_global2(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_cigar_, uint32_t **cigar_)
+static int ksw_global2_scalar(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_cigar_, uint32_t **cigar_)
 {
 	eh_t *eh;
 	int8_t *qp; // query profile
@@ -605,6 +1204,254 @@ int ksw_global2(int qlen, const uint8_t *query, int tlen, const uint8_t *target,
 	return score;
 }
 
+/* The same DP as ksw_global2_scalar(), one anti-diagonal at a time: cells
+ * of a diagonal only depend on the two before it, so XG_L of them are done
+ * in the 16-bit lanes of a vector. A diagonal is kept in arrays indexed by
+ * i+1, the target position; entries just outside its band hold the first
+ * row or column, or -inf. The direction bytes are those of the scalar code,
+ * stored per diagonal, so the traceback and thus the CIGAR are the same. */
+
+#define KSW_GLB_NEG (-0x6000) // -inf; a finite score never gets this low, see ksw_glb_fits()
+
+typedef int (*ksw_glb_f)(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_path, uint8_t **path);
+
+#define KSW_GLB_KERNEL(func) \
+static int func(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_path, uint8_t **path) \
+{ \
+	int i, k, c, d, lo, hi, zs, n_a, l_qp = qlen + XG_L, score; \
+	int16_t *mem, *qp, *t16, *H[3], *M[2], *E[2], *F[2], *h2, *h1, *h0, *t; \
+	uint8_t *z; \
+	xg_v zero = xg_set1(0), v_oe_del = xg_set1(o_del + e_del), v_e_del = xg_set1(e_del), v_oe_ins = xg_set1(o_ins + e_ins), v_e_ins = xg_set1(e_ins); \
+	n_a = tlen + XG_L + 2; \
+	mem = (int16_t*)malloc(((size_t)l_qp * m + (size_t)n_a * 10) * 2); \
+	qp = mem, t16 = qp + l_qp * m; \
+	for (i = 0; i < 3; ++i) H[i] = t16 + n_a * (i + 1); \
+	for (i = 0; i < 2; ++i) M[i] = H[2] + n_a * (i + 1), E[i] = H[2] + n_a * (i + 3), F[i] = H[2] + n_a * (i + 5); \
+	for (c = 0; c < m; ++c) /* the query reversed, so that a diagonal reads it forward */ \
+		for (k = 0; k < l_qp; ++k) qp[c * l_qp + k] = k < qlen? mat[c * m + query[qlen - 1 - k]] : 0; \
+	for (i = 0; i < n_a; ++i) t16[i] = i < tlen? target[i] : 0; \
+	zs = w + XG_L + 1; \
+	z = path? (uint8_t*)malloc((size_t)(qlen + tlen - 1) * zs) : 0; \
+	h2 = H[0], h1 = H[1], h0 = H[2]; \
+	h2[0] = 0; /* H(-1,-1) */ \
+	h1[0] = w >= 1 && qlen >= 1? -(o_ins + e_ins) : KSW_GLB_NEG, h1[1] = -(o_del + e_del), h1[2] = KSW_GLB_NEG; \
+	for (i = 0; i < 3; ++i) M[1][i] = E[1][i] = F[1][i] = KSW_GLB_NEG; \
+	for (d = 0; d < qlen + tlen - 1; ++d) { \
+		int16_t *m1 = M[(d&1)^1], *e1 = E[(d&1)^1], *f1 = F[(d&1)^1], *m0 = M[d&1], *e0 = E[d&1], *f0 = F[d&1]; \
+		uint8_t *zd = z? z + (size_t)d * zs : 0; \
+		lo = (d - w + 1) >> 1, hi = (d + w) >> 1; \
+		if (lo < d - qlen + 1) lo = d - qlen + 1; \
+		if (lo < 0) lo = 0; \
+		if (hi > d) hi = d; \
+		if (hi > tlen - 1) hi = tlen - 1; \
+		for (i = lo; i <= hi; i += XG_L) { /* cell (i,d-i) is in lane i; see ksw_global2_scalar() for the order */ \
+			xg_v tv = xg_load(&t16[i]), s = zero, mm, e, f, h; \
+			for (c = 0; c < m; ++c) \
+				s = xg_blend(s, xg_load(&qp[c * l_qp + qlen - 1 - d + i]), xg_eq(tv, xg_set1(c))); \
+			mm = xg_adds(xg_load(&h2[i]), s); /* M(i,j) = H(i-1,j-1) + S(i,j) */ \
+			e = xg_max(xg_subs(xg_load(&m1[i]), v_oe_del), xg_subs(xg_load(&e1[i]), v_e_del)); /* E(i,j), from (i-1,j) */ \
+			f = xg_max(xg_subs(xg_load(&m1[i+1]), v_oe_ins), xg_subs(xg_load(&f1[i+1]), v_e_ins)); /* F(i,j), from (i,j-1) */ \
+			h = xg_max(mm, e); \
+			xg_store(&h0[i+1], xg_max(h, f)); \
+			xg_store(&m0[i+1], mm), xg_store(&e0[i+1], e), xg_store(&f0[i+1], f); \
+			if (zd) { \
+				xg_v x = xg_blend(zero, xg_set1(1), xg_gt(e, mm)); \
+				x = xg_blend(x, xg_set1(2), xg_gt(f, h)); \
+				x = xg_or(x, xg_blend(zero, xg_set1(1<<2), xg_gt(xg_subs(e, v_e_del), xg_subs(mm, v_oe_del)))); \
+				x = xg_or(x, xg_blend(zero, xg_set1(2<<4), xg_gt(xg_subs(f, v_e_ins), xg_subs(mm, v_oe_ins)))); \
+				xg_store8(&zd[i - lo], x); \
+			} \
+		} \
+		h0[lo] = lo == 0 && d + 2 <= w && d + 2 <= qlen? -(o_ins + e_ins * (d + 2)) : KSW_GLB_NEG; /* H(-1,d+1) */ \
+		h0[hi+2] = hi == d && d + 1 <= w? -(o_del + e_del * (d + 2)) : KSW_GLB_NEG; /* H(d+1,-1) */ \
+		m0[lo] = e0[lo] = f0[lo] = m0[hi+2] = e0[hi+2] = f0[hi+2] = KSW_GLB_NEG; \
+		t = h2, h2 = h1, h1 = h0, h0 = t; \
+	} \
+	score = h1[tlen]; \
+	if (path) { /* the backtrack of ksw_global2_scalar(); ops are written from the last column */ \
+		int which = 0; \
+		uint8_t *p = (uint8_t*)malloc(qlen + tlen), *q = p + qlen + tlen; \
+		i = tlen - 1, k = qlen - 1; \
+		while (i >= 0 && k >= 0) { \
+			d = i + k; \
+			lo = (d - w + 1) >> 1; \
+			if (lo < d - qlen + 1) lo = d - qlen + 1; \
+			if (lo < 0) lo = 0; \
+			which = z[(size_t)d * zs + (i - lo)] >> (which<<1) & 3; \
+			if (which == 0)      *--q = 0, --i, --k; \
+			else if (which == 1) *--q = 2, --i; \
+			else                 *--q = 1, --k; \
+		} \
+		for (; i >= 0; --i) *--q = 2; \
+		for (; k >= 0; --k) *--q = 1; \
+		*n_path = p + qlen + tlen - q; \
+		memmove(p, q, *n_path); \
+		*path = p; \
+	} \
+	free(z); free(mem); \
+	return score; \
+}
+
+// SSE2: 8 lanes
+#define XG_L 8
+#define xg_v __m128i
+#define xg_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define xg_store(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define xg_store8(p, v) _mm_storel_epi64((__m128i*)(p), _mm_packus_epi16(v, v))
+#define xg_set1(x) _mm_set1_epi16(x)
+#define xg_adds(a, b) _mm_adds_epi16(a, b)
+#define xg_subs(a, b) _mm_subs_epi16(a, b)
+#define xg_max(a, b) _mm_max_epi16(a, b)
+#define xg_or(a, b) _mm_or_si128(a, b)
+#define xg_gt(a, b) _mm_cmpgt_epi16(a, b)
+#define xg_eq(a, b) _mm_cmpeq_epi16(a, b)
+#define xg_blend(a, b, x) _mm_or_si128(_mm_andnot_si128(x, a), _mm_and_si128(x, b))
+KSW_GLB_KERNEL(ksw_glb_sse2)
+#undef XG_L
+#undef xg_v
+#undef xg_load
+#undef xg_store
+#undef xg_store8
+#undef xg_set1
+#undef xg_adds
+#undef xg_subs
+#undef xg_max
+#undef xg_or
+#undef xg_gt
+#undef xg_eq
+#undef xg_blend
+
+static ksw_glb_f ksw_glb = ksw_glb_sse2;
+
+#ifdef __GNUC__
+// AVX2: 16 lanes
+#define XG_L 16
+#define xg_v __m256i
+#define xg_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define xg_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define xg_store8(p, v) _mm_storeu_si128((__m128i*)(p), _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)))
+#define xg_set1(x) _mm256_set1_epi16(x)
+#define xg_adds(a, b) _mm256_adds_epi16(a, b)
+#define xg_subs(a, b) _mm256_subs_epi16(a, b)
+#define xg_max(a, b) _mm256_max_epi16(a, b)
+#define xg_or(a, b) _mm256_or_si256(a, b)
+#define xg_gt(a, b) _mm256_cmpgt_epi16(a, b)
+#define xg_eq(a, b) _mm256_cmpeq_epi16(a, b)
+#define xg_blend(a, b, x) _mm256_blendv_epi8(a, b, x)
+__attribute__((target("avx2"))) KSW_GLB_KERNEL(ksw_glb_avx2)
+#undef XG_L
+#undef xg_v
+#undef xg_load
+#undef xg_store
+#undef xg_store8
+#undef xg_set1
+#undef xg_adds
+#undef xg_subs
+#undef xg_max
+#undef xg_or
+#undef xg_gt
+#undef xg_eq
+#undef xg_blend
+
+// AVX-512BW: 32 lanes, with mask registers
+#define XG_L 32
+#define xg_v __m512i
+#define xg_load(p) _mm512_loadu_si512((const void*)(p))
+#define xg_store(p, v) _mm512_storeu_si512((void*)(p), (v))
+#define xg_store8(p, v) _mm256_storeu_si256((__m256i*)(p), _mm512_cvtepi16_epi8(v))
+#define xg_set1(x) _mm512_set1_epi16(x)
+#define xg_adds(a, b) _mm512_adds_epi16(a, b)
+#define xg_subs(a, b) _mm512_subs_epi16(a, b)
+#define xg_max(a, b) _mm512_max_epi16(a, b)
+#define xg_or(a, b) _mm512_or_si512(a, b)
+#define xg_gt(a, b) _mm512_cmpgt_epi16_mask(a, b)
+#define xg_eq(a, b) _mm512_cmpeq_epi16_mask(a, b)
+#define xg_blend(a, b, x) _mm512_mask_blend_epi16(x, a, b)
+__attribute__((target("avx2,avx512f,avx512bw"))) KSW_GLB_KERNEL(ksw_glb_avx512)
+#undef XG_L
+#undef xg_v
+#undef xg_load
+#undef xg_store
+#undef xg_store8
+#undef xg_set1
+#undef xg_adds
+#undef xg_subs
+#undef xg_max
+#undef xg_or
+#undef xg_gt
+#undef xg_eq
+#undef xg_blend
+#endif
+
+/* whether the vectorized DP is exact: finite scores stay well above
+ * KSW_GLB_NEG and the last cell is in the band */
+static int ksw_glb_fits(int qlen, int tlen, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w)
+{
+	int i, max = 0, min = 0;
+	int64_t lim;
+	if (qlen <= 0 || tlen <= 0 || w < abs(tlen - qlen)) return 0;
+	for (i = 0; i < m * m; ++i) {
+		max = max > mat[i]? max : mat[i];
+		min = min < mat[i]? min : mat[i];
+	}
+	lim = (int64_t)qlen * max + (int64_t)(qlen + tlen) * (-min + (e_del > e_ins? e_del : e_ins)) + 2 * (o_del + e_del + o_ins + e_ins);
+	return lim < 0x3000;
+}
+
+int ksw_global2_path(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_path, uint8_t **path)
+{
+	int i, k, n_cigar = 0, score;
+	uint32_t *cigar = 0;
+	uint8_t *p;
+	if (w > qlen + tlen) w = qlen + tlen; // the same band
+	if (ksw_glb_fits(qlen, tlen, m, mat, o_del, e_del, o_ins, e_ins, w))
+		return ksw_glb(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, w, n_path, path);
+	score = ksw_global2_scalar(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, w, &n_cigar, &cigar);
+	p = (uint8_t*)malloc(qlen + tlen);
+	for (i = *n_path = 0; i < n_cigar; ++i)
+		for (k = 0; k < (int)(cigar[i]>>4); ++k)
+			p[(*n_path)++] = cigar[i]&0xf;
+	free(cigar);
+	*path = p;
+	return score;
+}
+
+int ksw_global2(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_cigar_, uint32_t **cigar_)
+{
+	int i, score, n_path, n_cigar = 0, m_cigar = 0;
+	uint32_t *cigar = 0;
+	uint8_t *path;
+	if (n_cigar_) *n_cigar_ = 0;
+	if (w > qlen + tlen) w = qlen + tlen;
+	if (!ksw_glb_fits(qlen, tlen, m, mat, o_del, e_del, o_ins, e_ins, w))
+		return ksw_global2_scalar(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, w, n_cigar_, cigar_);
+	if (n_cigar_ == 0 || cigar_ == 0)
+		return ksw_glb(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, w, 0, 0);
+	score = ksw_glb(qlen, query, tlen, target, m, mat, o_del, e_del, o_ins, e_ins, w, &n_path, &path);
+	for (i = 0; i < n_path; ++i)
+		cigar = push_cigar(&n_cigar, &m_cigar, cigar, path[i], 1);
+	free(path);
+	*n_cigar_ = n_cigar, *cigar_ = cigar;
+	return score;
+}
+
+#ifdef __GNUC__
+__attribute__((constructor)) static void ksw_dispatch_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		ksw_extb = ksw_extb_avx2;
+		ksw_sw[1][0] = ksw_u8_avx2, ksw_sw[1][1] = ksw_i16_avx2, ksw_vsize = 32;
+		ksw_glb = ksw_glb_avx2;
+	}
+	if (__builtin_cpu_supports("avx512bw")) {
+		ksw_extb = ksw_extb_avx512;
+		ksw_sw[2][0] = ksw_u8_avx512, ksw_sw[2][1] = ksw_i16_avx512, ksw_vsize = 64;
+		ksw_glb = ksw_glb_avx512;
+	}
+}
+#endif
+
 int ksw_global(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int gapo, int gape, int w, int *n_cigar_, uint32_t **cigar_)
 {
 	return ksw_global2(qlen, query, tlen, target, m, mat, gapo, gape, gapo, gape, w, n_cigar_, cigar_);
@@ -711,3 +1558,167 @@ int main(int argc, char *argv[])
 	return 0;
 }
 #endif
+
+/*********************************************************
+ * Check of the vector kernels (not compiled by default) *
+ *********************************************************/
+
+#ifdef _KSW_CHECK
+
+/* Runs every kernel this CPU dispatches to on random problems and compares
+ * its output with that of the reference: ksw_extend2() for the lanes of
+ * ksw_extend2_batch(), ksw_global2_scalar() for the banded global kernels,
+ * and the SSE2 ksw_u8()/ksw_i16() of klib for the wider striped ones.
+ *
+ *   make ksw_check, or: gcc -O2 -D_KSW_CHECK ksw.c -o ksw_check && ./ksw_check [n]
+ */
+
+#include <stdio.h>
+
+static int kc_rand(int n) { return rand() % n; }
+
+/* match a, mismatch -b and -1 for N; bis also takes a C in the target for a T */
+static void kc_mat(int8_t *mat, int a, int b, int bis)
+{
+	int i, j, k;
+	for (i = k = 0; i < 5; ++i)
+		for (j = 0; j < 5; ++j)
+			mat[k++] = i == 4 || j == 4? -1 : i == j || (bis && i == 1 && j == 3)? a : -b;
+}
+
+/* a random target, and a query read from it with errors if similar */
+static void kc_seq(int tl, uint8_t *ts, int ql, uint8_t *qs, int similar)
+{
+	int i, j;
+	for (i = 0; i < tl; ++i) ts[i] = kc_rand(50) == 0? 4 : kc_rand(4);
+	for (i = j = 0; i < ql; ++i) {
+		int r = kc_rand(30);
+		if (r == 0 && j < tl) j += 1 + kc_rand(3); // a deletion
+		qs[i] = !similar || r == 1 || j >= tl? kc_rand(5) : r == 2? kc_rand(4) : ts[j++];
+	}
+}
+
+typedef struct {
+	const char *name;
+	int n, bad;
+} kc_stat_t;
+
+static void kc_report(const kc_stat_t *s)
+{
+	printf("%-18s %8d problems, %d differ\n", s->name, s->n, s->bad);
+}
+
+#define KC_BATCH 64
+
+static void kc_extend(int n_round, ksw_extb_f f, kc_stat_t *s)
+{
+	static uint8_t qs[KC_BATCH][300], ts[KC_BATCH][500];
+	kswx_t ref[KC_BATCH], x[KC_BATCH];
+	int8_t mat[2][25];
+	int it, i;
+	for (it = 0; it < n_round; ++it) {
+		int o_del = kc_rand(8), e_del = 1 + kc_rand(3), o_ins = kc_rand(8), e_ins = 1 + kc_rand(3), zdrop = kc_rand(2)? 0 : 20 + kc_rand(80);
+		kc_mat(mat[0], 1, 4, 0); kc_mat(mat[1], 1 + kc_rand(2), 1 + kc_rand(5), 1);
+		for (i = 0; i < KC_BATCH; ++i) {
+			kswx_t *p = &ref[i];
+			p->qlen = 1 + kc_rand(i % 4 == 0? 20 : 300);
+			p->tlen = 1 + kc_rand(p->qlen + 100 < 500? p->qlen + 100 : 500);
+			kc_seq(p->tlen, ts[i], p->qlen, qs[i], kc_rand(4));
+			p->query = qs[i]; p->target = ts[i]; p->mat = mat[kc_rand(2)];
+			p->w = 1 + kc_rand(100); p->end_bonus = kc_rand(6); p->h0 = 1 + kc_rand(100);
+			p->score = ksw_extend2(p->qlen, p->query, p->tlen, p->target, 5, p->mat, o_del, e_del, o_ins, e_ins, p->w, p->end_bonus, zdrop, p->h0,
+								   &p->qle, &p->tle, &p->gtle, &p->gscore, &p->max_off);
+			x[i] = *p;
+			x[i].score = x[i].qle = x[i].tle = x[i].gtle = x[i].gscore = x[i].max_off = -1;
+		}
+		ksw_extb = f;
+		ksw_extend2_batch(KC_BATCH, x, 5, o_del, e_del, o_ins, e_ins, zdrop);
+		for (i = 0; i < KC_BATCH; ++i, ++s->n) {
+			const kswx_t *p = &ref[i], *q = &x[i];
+			if (p->score == q->score && p->qle == q->qle && p->tle == q->tle && p->gtle == q->gtle && p->gscore == q->gscore && p->max_off == q->max_off)
+				continue;
+			if (s->bad++ < 5)
+				fprintf(stderr, "[E::%s] %s qlen %d tlen %d w %d h0 %d: %d,%d,%d,%d,%d,%d vs %d,%d,%d,%d,%d,%d\n", __func__, s->name,
+						p->qlen, p->tlen, p->w, p->h0, p->score, p->qle, p->tle, p->gtle, p->gscore, p->max_off,
+						q->score, q->qle, q->tle, q->gtle, q->gscore, q->max_off);
+		}
+	}
+}
+
+static void kc_striped(int n_round, int vsize, kc_stat_t *s)
+{
+	uint8_t qs[600], ts[1200];
+	int8_t mat[25];
+	int it, k;
+	kc_mat(mat, 1, 4, 0);
+	for (it = 0; it < n_round; ++it) {
+		int ql = 1 + kc_rand(it % 3 == 0? 40 : 300), tl = 1 + kc_rand(900), xtra;
+		int o_del = 1 + kc_rand(8), e_del = 1 + kc_rand(3), o_ins = 1 + kc_rand(8), e_ins = 1 + kc_rand(3);
+		kswr_t r[2];
+		kc_seq(tl, ts, ql, qs, kc_rand(2));
+		xtra = KSW_XSTART | KSW_XSUBO | kc_rand(40);
+		if (kc_rand(2)) xtra |= KSW_XBYTE;
+		if (kc_rand(8) == 0) xtra = KSW_XSTOP | kc_rand(60) | (xtra & KSW_XBYTE);
+		for (k = 0; k < 2; ++k) {
+			ksw_vsize = k? vsize : 16;
+			r[k] = ksw_align2(ql, qs, tl, ts, 5, mat, o_del, e_del, o_ins, e_ins, xtra, 0);
+		}
+		++s->n;
+		if (memcmp(&r[0], &r[1], sizeof(kswr_t)) && s->bad++ < 5)
+			fprintf(stderr, "[E::%s] %s qlen %d tlen %d xtra %x: %d,%d,%d,%d,%d,%d,%d vs %d,%d,%d,%d,%d,%d,%d\n", __func__, s->name, ql, tl, xtra,
+					r[0].score, r[0].te, r[0].qe, r[0].score2, r[0].te2, r[0].tb, r[0].qb,
+					r[1].score, r[1].te, r[1].qe, r[1].score2, r[1].te2, r[1].tb, r[1].qb);
+	}
+}
+
+static void kc_global(int n_round, ksw_glb_f f, kc_stat_t *s)
+{
+	uint8_t qs[300], ts[320];
+	int8_t mat[25];
+	int it;
+	for (it = 0; it < n_round; ++it) {
+		int ql = 1 + kc_rand(it % 3 == 0? 30 : 250), tl = ql + kc_rand(21) - 10, w, s0, s1, s2, n0 = 0, n1 = 0;
+		int o_del = kc_rand(8), e_del = 1 + kc_rand(3), o_ins = kc_rand(8), e_ins = 1 + kc_rand(3);
+		uint32_t *c0 = 0, *c1 = 0;
+		if (tl < 1) tl = 1;
+		kc_mat(mat, 1 + kc_rand(2), 1 + kc_rand(5), it & 1);
+		kc_seq(tl, ts, ql, qs, 1);
+		w = abs(tl - ql) + kc_rand(40);
+		if (!ksw_glb_fits(ql, tl, 5, mat, o_del, e_del, o_ins, e_ins, w)) continue; // scalar anyway
+		s0 = ksw_global2_scalar(ql, qs, tl, ts, 5, mat, o_del, e_del, o_ins, e_ins, w, &n0, &c0);
+		ksw_glb = f;
+		s1 = ksw_global2(ql, qs, tl, ts, 5, mat, o_del, e_del, o_ins, e_ins, w, &n1, &c1);
+		s2 = ksw_global2(ql, qs, tl, ts, 5, mat, o_del, e_del, o_ins, e_ins, w, 0, 0);
+		++s->n;
+		if ((s0 != s1 || s1 != s2 || n0 != n1 || memcmp(c0, c1, n0 * sizeof(uint32_t))) && s->bad++ < 5)
+			fprintf(stderr, "[E::%s] %s qlen %d tlen %d w %d: score %d, %d, %d; %d vs %d CIGAR operations\n", __func__, s->name, ql, tl, w, s0, s1, s2, n0, n1);
+		free(c0); free(c1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int n = argc > 1? atoi(argv[1]) : 20000, i, bad = 0, vmax = ksw_vsize;
+	kc_stat_t s[8];
+	memset(s, 0, sizeof(s));
+	srand(11);
+	s[0].name = "ksw_extb_sse2"; kc_extend(n / KC_BATCH + 1, ksw_extb_sse2, &s[0]);
+	s[1].name = "ksw_glb_sse2"; kc_global(n, ksw_glb_sse2, &s[1]);
+#ifdef __GNUC__
+	if (__builtin_cpu_supports("avx2")) {
+		s[2].name = "ksw_extb_avx2"; kc_extend(n / KC_BATCH + 1, ksw_extb_avx2, &s[2]);
+		s[3].name = "ksw_glb_avx2"; kc_global(n, ksw_glb_avx2, &s[3]);
+		s[4].name = "ksw_u8/i16_avx2"; kc_striped(n, 32, &s[4]);
+	}
+	if (__builtin_cpu_supports("avx512bw")) {
+		s[5].name = "ksw_extb_avx512"; kc_extend(n / KC_BATCH + 1, ksw_extb_avx512, &s[5]);
+		s[6].name = "ksw_glb_avx512"; kc_global(n, ksw_glb_avx512, &s[6]);
+		s[7].name = "ksw_u8/i16_avx512"; kc_striped(n, 64, &s[7]);
+	}
+#endif
+	ksw_vsize = vmax;
+	for (i = 0; i < 8; ++i)
+		if (s[i].name) kc_report(&s[i]), bad += s[i].bad;
+	return bad != 0;
+}
+#endif
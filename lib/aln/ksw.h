@@ -11,6 +11,14 @@
 struct _kswq_t;
 typedef struct _kswq_t kswq_t;
 
+typedef struct {
+	int qlen, tlen;
+	const uint8_t *query, *target;
+	const int8_t *mat; // m*m scoring matrix of this problem
+	int w, end_bonus, h0;
+	int score, qle, tle, gtle, gscore, max_off; // output of ksw_extend2()
+} kswx_t;
+
 typedef struct {
 	int score; // best score
 	int te, qe; // target end and query end
@@ -85,6 +93,19 @@ extern "C" {
   int ksw_global(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int gapo, int gape, int w, int *n_cigar, uint32_t **cigar);
   int ksw_global2(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_cigar, uint32_t **cigar);
 
+  /**
+   * Banded global alignment, with the path spelled out
+   *
+   * Same as ksw_global2(), but gives one op per alignment column (0 for a
+   * match, 1 for an insertion, 2 for a deletion) instead of a CIGAR
+   *
+   * @param n_path  (out) number of columns
+   * @param path    (out) ops, first column first; caller need to deallocate with free()
+   *
+   * @return        score of the alignment
+   */
+  int ksw_global2_path(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int *n_path, uint8_t **path);
+
   /**
    * Extend alignment
    *
@@ -109,6 +130,19 @@ extern "C" {
   int ksw_extend(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int gapo, int gape, int w, int end_bonus, int zdrop, int h0, int *qle, int *tle, int *gtle, int *gscore, int *max_off);
   int ksw_extend2(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int m, const int8_t *mat, int o_del, int e_del, int o_ins, int e_ins, int w, int end_bonus, int zdrop, int h0, int *qle, int *tle, int *gtle, int *gscore, int *max_off);
 
+  /**
+   * Extend many alignments at once
+   *
+   * Each job is ksw_extend2() with its own query, target, matrix, band,
+   * end bonus and h0, and gets the same results. Jobs are run in the 16-bit
+   * lanes of SIMD vectors; those whose scores may not fit are handed to
+   * ksw_extend2().
+   *
+   * @param n       number of jobs
+   * @param jobs    input and (out) results, see kswx_t
+   */
+  void ksw_extend2_batch(int n, kswx_t *jobs, int m, int o_del, int e_del, int o_ins, int e_ins, int zdrop);
+
 #ifdef __cplusplus
 }
 #endif
@@ -405,7 +405,7 @@ static void mem_alnreg_matesw_core(const mem_opt_t *opt, const bntseq_t *bns, co
   /* make the mate read sequence opposite to the direction of the primary read */
   uint8_t *mate_seq, *rev = 0;
   //if (!mate_is_rev) {
-  rev = malloc(l_ms); // this is the reverse complement of ms
+  rev = arena_malloc(l_ms); // this is the reverse complement of ms
   for (i = 0; i < l_ms; ++i) rev[l_ms - 1 - i] = ms[i] < 4? 3 - ms[i] : 4;
   mate_seq = rev;
   //} else mate_seq = (uint8_t*) ms;
@@ -419,7 +419,7 @@ static void mem_alnreg_matesw_core(const mem_opt_t *opt, const bntseq_t *bns, co
   if (rb < re) ref = bns_fetch_seq(bns, pac, &rb, (rb+re)>>1, &re, &rid);
 
   /* no funny things happening */
-  if (reg->rid != rid || re - rb < opt->min_seed_len) { free(rev); free(ref); return; }
+  if (reg->rid != rid || re - rb < opt->min_seed_len) { arena_free(ref); arena_free(rev); return; }
 
   // mate alignment, very slow
   /* bss !rev parent
@@ -486,8 +486,7 @@ static void mem_alnreg_matesw_core(const mem_opt_t *opt, const bntseq_t *bns, co
     mem_sort_deduplicate(opt, 0, 0, 0, mregs);
   }
 
-  if (rev) free(rev);
-  free(ref);
+  arena_free(ref); arena_free(rev);
 }
 
 
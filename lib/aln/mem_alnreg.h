@@ -162,6 +162,8 @@ static inline void mem_print_regions(const bntseq_t *bns, mem_alnreg_v *regs) {
 }
 
 mem_pestat_t mem_pestat(const mem_opt_t *opt, const bntseq_t *bns, int n, const mem_alnreg_v *regs_pairs);
+/* add the insert sizes of the unique pairs among regs_pairs; returns how many */
+int64_t mem_isize_add(const mem_opt_t *opt, const bntseq_t *bns, int n, const mem_alnreg_v *regs_pairs, mem_isize_t *m);
 
 void mem_reg2ovlp(const mem_opt_t *opt, const bntseq_t *bns, bseq1_t *s, mem_alnreg_v *a);
 /* int mem_sam_pe(const mem_opt_t *opt, const bntseq_t *bns, const uint8_t *pac, const mem_pestat_t pes[4], uint64_t id, bseq1_t s[2], mem_alnreg_v a[2]); */
@@ -27,6 +27,9 @@
 
 #include <inttypes.h>
 #include <math.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include "mem_alnreg.h"
 #include "utils.h"
 #include "kvec.h"
@@ -56,56 +59,72 @@ static int cal_sub(const mem_opt_t *opt, mem_alnreg_v *regs) {
   return j < regs->n ? p->score : opt->min_seed_len * opt->a;
 }
 
-typedef struct { size_t n, m; int64_t *a; } int64_v;
-mem_pestat_t mem_pestat(const mem_opt_t *opt, const bntseq_t *bns, int n, const mem_alnreg_v *regs_pairs) {
+/* insert size of a pair whose best regions are unique enough to go into
+ * the insert-size model; 0 if it should stay out */
+static int pair_isize(const mem_opt_t *opt, const bntseq_t *bns, const mem_alnreg_v *regs_pair, int64_t *is) {
 
-  int64_v isize = {0,0,0};
+  // skip if no mapping
+  if (regs_pair[0].n == 0 || regs_pair[1].n == 0) return 0;
 
-  /* infer isize distribution based on the first reg from the two reads */
-  int i;
-  for (i = 0; i < n>>1; ++i) {
-    int64_t is; // insert size
-    mem_alnreg_v *regs_pair[2];
-    regs_pair[0] = (mem_alnreg_v*)&regs_pairs[i<<1|0];
-    regs_pair[1] = (mem_alnreg_v*)&regs_pairs[i<<1|1];
-
-    // skip if no mapping
-    if (regs_pair[0]->n == 0 || regs_pair[1]->n == 0) continue;
-
-    mem_alnreg_t *best0 = &regs_pair[0]->a[0];
-    mem_alnreg_t *best1 = &regs_pair[1]->a[0];
-
-    // skip if sub-optimal is too close to optimal
-    if (cal_sub(opt, regs_pair[0]) > MIN_RATIO * best0->score) continue;
-    if (cal_sub(opt, regs_pair[1]) > MIN_RATIO * best1->score) continue;
-
-    // skip if on different chromosome
-    if (best0->rid != best1->rid) continue;
-    
-    // skip if on different bisulfite converted strands
-    if (best0->bss != best1->bss) continue;
-
-    if (mem_alnreg_isize(bns, best0, best1, &is))
-      if (is <= opt->max_ins && is >= -opt->max_ins)
-        kv_push(int64_t, isize, is);
-  }
+  mem_alnreg_t *best0 = &regs_pair[0].a[0];
+  mem_alnreg_t *best1 = &regs_pair[1].a[0];
+
+  // skip if sub-optimal is too close to optimal
+  if (cal_sub(opt, (mem_alnreg_v*)&regs_pair[0]) > MIN_RATIO * best0->score) return 0;
+  if (cal_sub(opt, (mem_alnreg_v*)&regs_pair[1]) > MIN_RATIO * best1->score) return 0;
+
+  // skip if on different chromosome
+  if (best0->rid != best1->rid) return 0;
+
+  // skip if on different bisulfite converted strands
+  if (best0->bss != best1->bss) return 0;
+
+  return mem_alnreg_isize(bns, best0, best1, is);
+}
+
+mem_isize_t *mem_isize_init(int max_ins) {
+  mem_isize_t *m = calloc(1, sizeof(mem_isize_t));
+  m->max_ins = max_ins;
+  m->cnt = calloc(2 * max_ins + 1, sizeof(uint64_t));
+  return m;
+}
+
+void mem_isize_destroy(mem_isize_t *m) {
+  if (m == 0) return;
+  free(m->cnt); free(m);
+}
+
+int64_t mem_isize_add(const mem_opt_t *opt, const bntseq_t *bns, int n, const mem_alnreg_v *regs_pairs, mem_isize_t *m) {
+
+  int i; int64_t is, n_added = 0;
+  for (i = 0; i < n>>1; ++i)
+    if (pair_isize(opt, bns, &regs_pairs[i<<1], &is))
+      if (is <= m->max_ins && is >= -m->max_ins)
+        ++m->cnt[is + m->max_ins], ++n_added;
+  m->n += n_added;
+  return n_added;
+}
 
-  if (bwa_verbose >= 3) fprintf(stderr, "[M::%s] # candidate unique pairs: %ld\n", __func__, isize.n);
+/* the k-th smallest insert size in the model */
+static int isize_at(const mem_isize_t *m, int64_t k) {
+  int i; uint64_t c = 0;
+  for (i = 0; i < 2 * m->max_ins; ++i)
+    if ((c += m->cnt[i]) > (uint64_t) k) break;
+  return i - m->max_ins;
+}
+
+mem_pestat_t mem_isize_pestat(const mem_isize_t *m) {
 
   mem_pestat_t pes; memset(&pes, 0, sizeof(mem_pestat_t));
-  if (isize.n < MIN_DIR_CNT) {
+  if (m->n < MIN_DIR_CNT) {
     fprintf(stderr, "[M:%s] There are not enough pairs for insert size inference\n", __func__);
-    free(isize.a);
     pes.failed = 1;
     return pes;
   }
 
-  // sort
-  ks_introsort_64s(isize.n, isize.a);
-
-  int p25 = isize.a[(int)(.25 * isize.n + .499)];
-  int p50 = isize.a[(int)(.50 * isize.n + .499)];
-  int p75 = isize.a[(int)(.75 * isize.n + .499)];
+  int p25 = isize_at(m, (int64_t)(.25 * m->n + .499));
+  int p50 = isize_at(m, (int64_t)(.50 * m->n + .499));
+  int p75 = isize_at(m, (int64_t)(.75 * m->n + .499));
 
   pes.low  = (int)(p25 - OUTLIER_BOUND * (p75 - p25) + .499);
   pes.high = (int)(p75 + OUTLIER_BOUND * (p75 - p25) + .499);
@@ -114,16 +133,16 @@ mem_pestat_t mem_pestat(const mem_opt_t *opt, const bntseq_t *bns, int n, const
   fprintf(stderr, "[M::%s] low and high boundaries for computing mean and std.dev: (%d, %d)\n", __func__, pes.low, pes.high);
 
   // average
-  int x;
-  for (i = x = 0, pes.avg = 0; (unsigned) i < isize.n; ++i)
-    if (isize.a[i] >= pes.low && isize.a[i] <= pes.high)
-      pes.avg += isize.a[i], ++x;
+  int is; uint64_t x = 0;
+  int lo = pes.low > -m->max_ins ? pes.low : -m->max_ins;
+  int hi = pes.high < m->max_ins ? pes.high : m->max_ins;
+  for (is = lo, pes.avg = 0; is <= hi; ++is)
+    pes.avg += (double) is * m->cnt[is + m->max_ins], x += m->cnt[is + m->max_ins];
   pes.avg /= x;
 
   // std
-  for (i = 0, pes.std = 0; (unsigned) i < isize.n; ++i)
-    if (isize.a[i] >= pes.low && isize.a[i] <= pes.high)
-      pes.std += (isize.a[i] - pes.avg) * (isize.a[i] - pes.avg);
+  for (is = lo, pes.std = 0; is <= hi; ++is)
+    pes.std += (is - pes.avg) * (is - pes.avg) * m->cnt[is + m->max_ins];
   pes.std = sqrt(pes.std / x);
 
   fprintf(stderr, "[M::%s] mean and std.dev: (%.2f, %.2f)\n", __func__, pes.avg, pes.std);
@@ -138,11 +157,57 @@ mem_pestat_t mem_pestat(const mem_opt_t *opt, const bntseq_t *bns, int n, const
   // if (pes.low < 1) pes.low = 1;
 
   fprintf(stderr, "[M::%s] low and high boundaries for proper pairs: (%d, %d)\n", __func__, pes.low, pes.high);
-  free(isize.a);
 
+  pes.set = 1;
+  return pes;
+}
+
+mem_pestat_t mem_pestat(const mem_opt_t *opt, const bntseq_t *bns, int n, const mem_alnreg_v *regs_pairs) {
+
+  mem_isize_t *m = mem_isize_init(opt->max_ins);
+  mem_isize_add(opt, bns, n, regs_pairs, m);
+  if (bwa_verbose >= 3) fprintf(stderr, "[M::%s] # candidate unique pairs: %ld\n", __func__, (long) m->n);
+  mem_pestat_t pes = mem_isize_pestat(m);
+  mem_isize_destroy(m);
   return pes;
 }
 
+/* one "<insert size>\t<count>" line per size seen */
+void mem_isize_save(const mem_isize_t *m, const char *fn) {
+  int i;
+  FILE *fp = xopen(fn, "w");
+  err_fprintf(fp, "#max_ins\t%d\n", m->max_ins);
+  for (i = 0; i <= 2 * m->max_ins; ++i)
+    if (m->cnt[i]) err_fprintf(fp, "%d\t%" PRIu64 "\n", i - m->max_ins, m->cnt[i]);
+  err_fclose(fp);
+}
+
+mem_isize_t *mem_isize_load(const char *fn, int max_ins) {
+  char line[256]; int is, saved_max = -1; uint64_t c;
+  if (access(fn, F_OK) != 0) return 0; // no model yet, the caller infers one
+  FILE *fp = fopen(fn, "r");
+  if (fp == 0) err_fatal(__func__, "Failed to open %s: %s\n", fn, strerror(errno));
+  mem_isize_t *m = mem_isize_init(max_ins);
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == '#') {
+      /* a wider model shrinks to ours by dropping the sizes beyond max_ins,
+       * as mem_isize_add would have; a narrower one lacks the counts */
+      if (sscanf(line, "#max_ins\t%d", &saved_max) == 1 && saved_max < max_ins)
+        err_fatal(__func__, "%s was saved with a maximum insert size of %d, below %d. Remove it to infer the model again\n", fn, saved_max, max_ins);
+      continue;
+    }
+    if (saved_max < 0)
+      err_fatal(__func__, "%s has no #max_ins header\n", fn);
+    if (sscanf(line, "%d\t%" SCNu64, &is, &c) != 2)
+      err_fatal(__func__, "Parse error reading %s\n", fn);
+    if (is <= max_ins && is >= -max_ins)
+      m->cnt[is + max_ins] += c, m->n += c;
+  }
+  if (ferror(fp)) err_fatal(__func__, "Failed to read %s: %s\n", fn, strerror(errno));
+  err_fclose(fp);
+  return m;
+}
+
 // z - index of the best pair cross regs_pair[0] and regs_pair[1]
 void mem_pair(const mem_opt_t *opt, const bntseq_t *bns, const mem_pestat_t pes, mem_alnreg_v regs_pair[2], int id, int *score, int *sub, int *n_sub, int z[2]) {
 
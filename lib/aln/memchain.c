@@ -47,12 +47,33 @@
 #define intv_lt(a, b) ((a).info < (b).info)
 KSORT_INIT(mem_intv, bwtintv_t, intv_lt)
 
+// second pass: find MEMs inside a long SMEM
+static void mem_collect_reseed(const mem_opt_t *opt, const bwt_t *bwt, const bwt_t *bwtc, int len, const uint8_t *seq, bwtintv_cache_t *intv_cache) {
+
+  int k, old_n;
+  uint32_t i;
+  int split_len = (int)(opt->min_seed_len * opt->split_factor + .499);
+
+  bwtintv_v *_mem = &intv_cache->_mem;
+  bwtintv_v *mem = &intv_cache->mem;
+
+  old_n = mem->n;
+  for (k = 0; k < old_n; ++k) {
+    bwtintv_t *p = &mem->a[k];
+    int start = p->info>>32, end = (int32_t)p->info;
+    if (end - start < split_len || p->x[2] > (unsigned) opt->split_width) continue;
+    bwt_smem1(bwt, bwtc, len, seq, (start + end)>>1, p->x[2]+1, _mem, intv_cache->tmpv);
+    for (i = 0; i < _mem->n; ++i)
+      if ((uint32_t)_mem->a[i].info - (_mem->a[i].info>>32) >= (unsigned) opt->min_seed_len)
+        kv_push(bwtintv_t, *mem, _mem->a[i]);
+  }
+}
+
 static void mem_collect_intv(const mem_opt_t *opt, const bwt_t *bwt, const bwt_t *bwtc, int len, const uint8_t *seq, bwtintv_cache_t *intv_cache) {
 
-  int k, x = 0, old_n;
+  int x = 0;
   uint32_t i;
   int start_width = (opt->flag & MEM_F_SELF_OVLP)? 2 : 1;
-  int split_len = (int)(opt->min_seed_len * opt->split_factor + .499);
 
   bwtintv_v *_mem = &intv_cache->_mem;
   bwtintv_v *mem = &intv_cache->mem;
@@ -73,16 +94,7 @@ static void mem_collect_intv(const mem_opt_t *opt, const bwt_t *bwt, const bwt_t
   }
 
   // second pass: find MEMs inside a long SMEM
-  old_n = mem->n;
-  for (k = 0; k < old_n; ++k) {
-    bwtintv_t *p = &mem->a[k];
-    int start = p->info>>32, end = (int32_t)p->info;
-    if (end - start < split_len || p->x[2] > (unsigned) opt->split_width) continue;
-    bwt_smem1(bwt, bwtc, len, seq, (start + end)>>1, p->x[2]+1, _mem, tmpv);
-    for (i = 0; i < _mem->n; ++i)
-      if ((uint32_t)_mem->a[i].info - (_mem->a[i].info>>32) >= (unsigned) opt->min_seed_len)
-        kv_push(bwtintv_t, *mem, _mem->a[i]);
-  }
+  mem_collect_reseed(opt, bwt, bwtc, len, seq, intv_cache);
 
   // third pass: LAST-like
   if (opt->max_mem_intv > 0) {
@@ -105,6 +117,261 @@ static void mem_collect_intv(const mem_opt_t *opt, const bwt_t *bwt, const bwt_t
   ks_introsort(mem_intv, mem->n, mem->a);
 }
 
+/*******************
+ * Batched seeding *
+ *******************/
+
+/* Every bwt_extend() in the SMEM search depends on the interval returned by
+ * the previous one and almost always misses the cache on a large genome.
+ * Here the first and the third pass of mem_collect_intv are written as
+ * state machines that do one extension per turn. The jobs of a batch (reads
+ * times strands) take turns and each job prefetches the occurrence blocks of
+ * its next extension before yielding, so the memory latency of one job is
+ * hidden behind the work of the others. Seeds are pushed in the same order as
+ * mem_collect_intv, hence the result is identical. */
+
+enum { SEED_FWD, SEED_BWD, SEED_DONE };
+
+typedef struct {
+  mem_seed_job_t *job;
+  int state;
+  int x;         // start of the current search on the read
+  int i;         // next position to extend to
+  int ret;       // end of the longest match from x, next x of the first pass
+  size_t j;      // next interval of prev in the backward search
+  bwtint_t u;    // k-mer table node of seq[x..i], the target of the next forward step
+  bwtintv_t ik;
+  bwtintv_v *prev, *curr;
+} seed_state_t;
+
+/* k-mer table node of seq[x..x+1] at the start of a forward search */
+static inline bwtint_t seed_kmer_node(const seed_state_t *s) {
+  const mem_seed_job_t *t = s->job;
+  if (s->i >= t->len) return BWT_KMER_NONE;
+  return bwt_kmer_child(t->bwt, bwt_kmer_child(t->bwt, 0, 0, t->seq[s->x]), 1, t->seq[s->i]);
+}
+
+/* begin the SMEM search (bwt_smem1) at the next unambiguous base */
+static void smem_begin(seed_state_t *s) {
+  const mem_seed_job_t *t = s->job;
+  while (s->x < t->len && t->seq[s->x] > 3) ++s->x;
+  if (s->x >= t->len) { s->state = SEED_DONE; return; }
+  bwt_set_intv(t->bwt, t->bwtc, t->seq[s->x], s->ik);
+  s->ik.info = s->x + 1;
+  s->prev = t->intv_cache->tmpv[0];
+  s->curr = t->intv_cache->tmpv[1];
+  s->curr->n = 0;
+  t->intv_cache->_mem.n = 0;
+  s->i = s->x + 1;
+  s->u = seed_kmer_node(s);
+  s->state = SEED_FWD;
+}
+
+static void smem_forward_done(seed_state_t *s) {
+  bwtintv_v *swap;
+  bwt_reverse_intvs(s->curr);
+  s->ret = s->curr->a[0].info;
+  swap = s->curr; s->curr = s->prev; s->prev = swap;
+  s->curr->n = 0;
+  s->i = s->x - 1; s->j = 0;
+  s->state = SEED_BWD;
+}
+
+static void smem_backward_done(const mem_opt_t *opt, seed_state_t *s) {
+  bwtintv_v *_mem = &s->job->intv_cache->_mem;
+  size_t i;
+  bwt_reverse_intvs(_mem);
+  for (i = 0; i < _mem->n; ++i)
+    if ((uint32_t)_mem->a[i].info - (_mem->a[i].info>>32) >= (unsigned) opt->min_seed_len)
+      kv_push(bwtintv_t, s->job->intv_cache->mem, _mem->a[i]);
+  s->x = s->ret;
+  smem_begin(s);
+}
+
+/* one turn of the first pass, mirrors bwt_smem1a() with max_intv == 0 */
+static void smem_step(const mem_opt_t *opt, seed_state_t *s, int min_intv) {
+  const mem_seed_job_t *t = s->job;
+  bwtintv_t ok[4];
+  int c;
+
+  if (s->state == SEED_FWD) {
+    if (s->i == t->len || t->seq[s->i] > 3) { // read end or ambiguous base
+      kv_push(bwtintv_t, *s->curr, s->ik);
+      smem_forward_done(s);
+      return;
+    }
+    bwt_extend_fwd(t->bwt, t->bwtc, s->u, &s->ik, t->seq[s->i], &ok[0]);
+    if (ok[0].x[2] != s->ik.x[2]) {
+      kv_push(bwtintv_t, *s->curr, s->ik);
+      if (ok[0].x[2] < (unsigned) min_intv) {
+        smem_forward_done(s);
+        return;
+      }
+    }
+    s->ik = ok[0]; s->ik.info = ++s->i;
+    if (s->i < t->len) s->u = bwt_kmer_child(t->bwt, s->u, s->i - s->x, t->seq[s->i]);
+    return;
+  }
+
+  // backward; without a base to extend with, the whole of prev is done at once
+  c = s->i < 0? -1 : t->seq[s->i] < 4? t->seq[s->i] : -1;
+  do {
+    bwtintv_t *p = &s->prev->a[s->j];
+    bwtintv_v *_mem = &t->intv_cache->_mem;
+    if (c >= 0) bwt_extend(t->bwt, p, ok, 1);
+    if (c < 0 || ok[c].x[2] < (unsigned) min_intv) {
+      if (s->curr->n == 0) {
+        if (_mem->n == 0 || (unsigned) s->i + 1 < _mem->a[_mem->n-1].info>>32) {
+          bwtintv_t ik = *p;
+          ik.info |= (uint64_t)(s->i + 1)<<32;
+          kv_push(bwtintv_t, *_mem, ik);
+        }
+      }
+    } else if (s->curr->n == 0 || ok[c].x[2] != s->curr->a[s->curr->n-1].x[2]) {
+      ok[c].info = p->info;
+      kv_push(bwtintv_t, *s->curr, ok[c]);
+    }
+    if (++s->j == s->prev->n) {
+      bwtintv_v *swap;
+      if (s->curr->n == 0) {
+        smem_backward_done(opt, s);
+        return;
+      }
+      swap = s->curr; s->curr = s->prev; s->prev = swap;
+      s->curr->n = 0; s->j = 0; --s->i;
+      return;
+    }
+  } while (c < 0);
+}
+
+static void smem_prefetch(const seed_state_t *s) {
+  const mem_seed_job_t *t = s->job;
+  const bwtintv_t *p;
+  if (s->state == SEED_FWD) {
+    if (s->u != BWT_KMER_NONE) __builtin_prefetch(bwt_kmer_intv(t->bwt, s->u));
+    else if (s->i < t->len && t->seq[s->i] < 4) {
+      bwt_prefetch_occ(t->bwtc, s->ik.x[1] - 1);
+      bwt_prefetch_occ(t->bwtc, s->ik.x[1] - 1 + s->ik.x[2]);
+    }
+  } else if (s->state == SEED_BWD && s->i >= 0 && t->seq[s->i] < 4) {
+    p = &s->prev->a[s->j];
+    bwt_prefetch_occ(t->bwt, p->x[0] - 1);
+    bwt_prefetch_occ(t->bwt, p->x[0] - 1 + p->x[2]);
+  }
+}
+
+/* begin the forward-only search of bwt_seed_strategy1 */
+static void last_begin(seed_state_t *s) {
+  const mem_seed_job_t *t = s->job;
+  while (s->x < t->len && t->seq[s->x] > 3) ++s->x;
+  if (s->x >= t->len) { s->state = SEED_DONE; return; }
+  bwt_set_intv(t->bwt, t->bwtc, t->seq[s->x], s->ik);
+  s->i = s->x + 1;
+  s->u = seed_kmer_node(s);
+  s->state = SEED_FWD;
+}
+
+/* one turn of the third pass, mirrors bwt_seed_strategy1() */
+static void last_step(const mem_opt_t *opt, seed_state_t *s, int unused) {
+  const mem_seed_job_t *t = s->job;
+  bwtintv_t ok;
+  (void) unused;
+
+  if (s->i >= t->len) { s->state = SEED_DONE; return; }
+  if (t->seq[s->i] > 3) {
+    s->x = s->i + 1;
+    last_begin(s);
+    return;
+  }
+  bwt_extend_fwd(t->bwt, t->bwtc, s->u, &s->ik, t->seq[s->i], &ok);
+  if (ok.x[2] < (unsigned) opt->max_mem_intv && s->i - s->x >= opt->min_seed_len) {
+    bwtintv_t m = ok;
+    m.info = (uint64_t)s->x<<32 | (s->i + 1);
+    if (m.x[2] > 0) kv_push(bwtintv_t, t->intv_cache->mem, m);
+    s->x = s->i + 1;
+    last_begin(s);
+    return;
+  }
+  s->ik = ok; ++s->i;
+  if (s->i < t->len) s->u = bwt_kmer_child(t->bwt, s->u, s->i - s->x, t->seq[s->i]);
+}
+
+static void last_prefetch(const seed_state_t *s) {
+  const mem_seed_job_t *t = s->job;
+  if (s->u != BWT_KMER_NONE) __builtin_prefetch(bwt_kmer_intv(t->bwt, s->u));
+  else if (s->i < t->len && t->seq[s->i] < 4) {
+    bwt_prefetch_occ(t->bwtc, s->ik.x[1] - 1);
+    bwt_prefetch_occ(t->bwtc, s->ik.x[1] - 1 + s->ik.x[2]);
+  }
+}
+
+/* round-robin over the unfinished jobs until all of them are done */
+static void seed_run(
+   const mem_opt_t *opt, int n, seed_state_t *st, int min_intv,
+   void (*begin)(seed_state_t*),
+   void (*step)(const mem_opt_t*, seed_state_t*, int),
+   void (*prefetch)(const seed_state_t*)) {
+
+  int k, n_active = 0;
+  seed_state_t **active = arena_malloc(n * sizeof(seed_state_t*));
+
+  for (k = 0; k < n; ++k) {
+    st[k].x = 0;
+    begin(&st[k]);
+    if (st[k].state != SEED_DONE) {
+      prefetch(&st[k]);
+      active[n_active++] = &st[k];
+    }
+  }
+  while (n_active > 0) {
+    for (k = 0; k < n_active;) {
+      step(opt, active[k], min_intv);
+      if (active[k]->state == SEED_DONE) active[k] = active[--n_active];
+      else prefetch(active[k++]);
+    }
+  }
+  arena_free(active);
+}
+
+/**
+ * Batched mem_collect_intv
+ * @param n     number of jobs; jobs are usually all the reads of a batch against
+ *              both bisulfite strands
+ * @param jobs  on return jobs[i].intv_cache->mem holds the sorted intervals
+ *              and jobs[i].intv_cache->ready is set
+ */
+void mem_collect_intv_batch(const mem_opt_t *opt, int n, mem_seed_job_t *jobs) {
+
+  int k;
+  int start_width = (opt->flag & MEM_F_SELF_OVLP)? 2 : 1;
+  seed_state_t *st;
+
+  if (n <= 0) return;
+  st = arena_calloc(n, sizeof(seed_state_t));
+  for (k = 0; k < n; ++k) {
+    st[k].job = &jobs[k];
+    jobs[k].intv_cache->mem.n = 0;
+  }
+
+  // first pass: SMEMs of all jobs in lockstep
+  seed_run(opt, n, st, start_width, smem_begin, smem_step, smem_prefetch);
+
+  // second pass: re-seeding is rare, done per job
+  for (k = 0; k < n; ++k)
+    mem_collect_reseed(opt, jobs[k].bwt, jobs[k].bwtc, jobs[k].len, jobs[k].seq, jobs[k].intv_cache);
+
+  // third pass: LAST-like, in lockstep
+  if (opt->max_mem_intv > 0)
+    seed_run(opt, n, st, 0, last_begin, last_step, last_prefetch);
+
+  for (k = 0; k < n; ++k) {
+    bwtintv_v *mem = &jobs[k].intv_cache->mem;
+    ks_introsort(mem_intv, mem->n, mem->a);
+    jobs[k].intv_cache->ready = 1;
+  }
+  arena_free(st);
+}
+
 
 /**************
  * mem_seed_t *
@@ -262,12 +529,26 @@ static int merge_seed_to_chain(
  *********************************************************/
 
 #include "kbtree.h"
+#define MEM_SA_TAIL 16
 #define mem_getbss(parent, bns, rb) ((rb>bns->l_pac)==(parent)?1:0)
 #define chain_cmp(a, b) (((b).pos < (a).pos) - ((a).pos < (b).pos))
 KBTREE_INIT(chn, mem_chain_t, chain_cmp)
+
+/* SA value of a hit of len bases in bwt, whose text is l forward bases at
+ * ref_off of the reference and their reverse complement, to reference
+ * coordinates; the reverse half of the reference lists the contigs in the
+ * opposite order. A hit running from the forward half of the text into the
+ * reverse half is not contiguous in the reference, -1, as bns_get_seq()
+ * refuses it. */
+static inline int64_t mem_sa2ref(const bwt_t *bwt, int64_t l_pac, int64_t ref_off, bwtint_t sa, int len) {
+   int64_t l = bwt->seq_len>>1;
+   if ((int64_t)sa < l && (int64_t)sa + len > l) return -1;
+   return (int64_t)sa < l? (int64_t)sa + ref_off : (int64_t)sa + (l_pac<<1) - ref_off - (l<<1);
+}
+
 mem_chain_v mem_chain(
-   const mem_opt_t *opt, const bwt_t *bwt, const bntseq_t *bns,
-   bseq1_t *bseq, void *intv_cache, uint8_t parent) {
+   const mem_opt_t *opt, const bwt_t *bwt, const mem_hash_t *hash, const bntseq_t *bns,
+   bseq1_t *bseq, void *intv_cache, uint8_t parent, int64_t ref_off) {
 
    /* aux->mem -> kbtree_t(chn) *tree -> mem_chain_v chain */
    uint32_t i;
@@ -287,8 +568,12 @@ mem_chain_v mem_chain(
    /* if cache is not given, create a temporary one */
    _intv_cache = intv_cache ? (bwtintv_cache_t*) intv_cache : bwtintv_cache_init();
 
-   /* generate bwtintv_v (seeds) in _intv_cache->mem */
-   mem_collect_intv(opt, &bwt[parent], &bwt[!parent], bseq->l_seq, bseq->bisseq[parent], _intv_cache);
+   /* generate bwtintv_v (seeds) in _intv_cache->mem, unless mem_collect_intv_batch did */
+   if (hash)
+      mem_hash_collect(hash, opt, parent, bseq->l_seq, bseq->bisseq[parent], _intv_cache);
+   else if (!_intv_cache->ready)
+      mem_collect_intv(opt, &bwt[parent], &bwt[!parent], bseq->l_seq, bseq->bisseq[parent], _intv_cache);
+   _intv_cache->ready = 0;
 
    /* loop over mem and compute l_rep - number of repetitive seeds */
    for (i = 0, b = e = l_rep = 0; i < _intv_cache->mem.n; ++i) {
@@ -300,15 +585,34 @@ mem_chain_v mem_chain(
    }
    l_rep += e - b; // length of reads covered by repetitive seeds
 
+   /* the loop below always visits the first min(x[2], max_occ) positions of
+    * an interval, resolve all of them for the read in one batch; the hash
+    * has given all positions already */
+   if (!hash) {
+      _intv_cache->sa.n = 0;
+      for (i = 0; i < _intv_cache->mem.n; ++i) {
+         bwtintv_t *intv = &_intv_cache->mem.a[i];
+         uint64_t k, n_pre = intv->x[2] < (unsigned) opt->max_occ ? intv->x[2] : (unsigned) opt->max_occ;
+         kv_resize(bwtint_t, _intv_cache->sa, _intv_cache->sa.n + n_pre);
+         for (k = 0; k < n_pre; ++k)
+            _intv_cache->sa.a[_intv_cache->sa.n++] = intv->x[0] + k;
+      }
+      bwt_sa_batch(&bwt[parent], _intv_cache->sa.n, _intv_cache->sa.a, _intv_cache->sa.a);
+   }
+
    /* cluster seeds into chains
     * find the closest chain from the lower side in kbtree_t(chn) *tree
     * if closest chain is nonexistent, then add the new seed as a new chain in the tree.
     * Note _intv_cache->mem is sorted by position. so this would work. */
+   const bwtint_t *pre = _intv_cache->sa.a;
    for (i = 0; i < _intv_cache->mem.n; ++i) {
       /* change bwtintv_t into mem_seed_t s */
       bwtintv_t *intv = &_intv_cache->mem.a[i];
       int slen = (uint32_t)intv->info - (intv->info>>32); /* seed length */
       uint32_t count; uint64_t k;
+      uint64_t n_pre = hash || intv->x[2] < (unsigned) opt->max_occ ? intv->x[2] : (unsigned) opt->max_occ;
+      bwtint_t tail[MEM_SA_TAIL];
+      uint64_t tail_k = 0, tail_n = 0; // tail[] holds positions [tail_k, tail_k+tail_n)
       // if (slen < opt->min_seed_len) continue;
       // ignore if too short or too repetitive
 
@@ -331,7 +635,20 @@ mem_chain_v mem_chain(
 
          /* this is the base coordinate in the forward-reverse reference */
          mem_seed_t s;
-         s.rbeg = tmp.pos = bwt_sa(&bwt[parent], intv->x[0] + k);
+         bwtint_t sa;
+         if (k < n_pre) sa = pre[k];
+         else { // few distinct chains so far, keep resolving in small batches
+            if (k >= tail_k + tail_n) {
+               uint64_t j;
+               tail_k = k;
+               tail_n = intv->x[2] - k < MEM_SA_TAIL ? intv->x[2] - k : MEM_SA_TAIL;
+               for (j = 0; j < tail_n; ++j) tail[j] = intv->x[0] + k + j;
+               bwt_sa_batch(&bwt[parent], tail_n, tail, tail);
+            }
+            sa = tail[k - tail_k];
+         }
+         if ((s.rbeg = mem_sa2ref(&bwt[parent], l_pac, ref_off, sa, slen)) < 0) continue;
+         tmp.pos = s.rbeg;
          s.qbeg = intv->info>>32;
          s.score = s.len = slen;
 
@@ -368,11 +685,13 @@ mem_chain_v mem_chain(
             kb_putp(chn, tree, &tmp);
          }
       }
+      pre += n_pre;
    }
    if (intv_cache == 0) bwtintv_cache_destroy(_intv_cache);
 
    /* kbtree_t(chn) *tree to mem_chain_v *chain */
-   kv_resize(mem_chain_t, chains, kb_size(tree));
+   chains.m = kb_size(tree);
+   if (chains.m) chains.a = arena_malloc(chains.m * sizeof(mem_chain_t));
 
    /* traverse tree and build mem_chain_v *chain */
 #define traverse_func(p_) (chains.a[chains.n++] = *(p_))
@@ -527,7 +846,7 @@ static int mem_seed_sw(const mem_opt_t *opt, const bntseq_t *bns, const uint8_t
       qe - qb, (uint8_t*) query + qb, 
       re - rb, rseq, 
       5, parent?opt->ctmat:opt->gamat, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, KSW_XSTART, 0);
-  free(rseq);
+  arena_free(rseq);
 
   return x.score;
 }
@@ -616,6 +935,7 @@ static void left_extend_seed_set_align_beg(
     int64_t rmax[],       // start and end coordinate of reference sequence
     int *aw,              // bandwidth (output)
     int parent,           // parent or daughter strand?
+    const kswx_t *pre,    // done by mem_chain_ext_batch with band opt->w, or NULL
     mem_alnreg_t *ar) {
 
   if (s->qbeg == 0) {
@@ -624,14 +944,14 @@ static void left_extend_seed_set_align_beg(
   }
 
   // query sequence
-  uint8_t *qs = malloc(s->qbeg);
+  uint8_t *qs = arena_malloc(s->qbeg);
   int i;
   for (i = 0; i < s->qbeg; ++i)
     qs[i] = query[s->qbeg - 1 - i];
 
   // reference sequence
   int64_t tmp = s->rbeg - rmax[0];
-  uint8_t *rs = malloc(tmp);
+  uint8_t *rs = arena_malloc(tmp);
   for (i = 0; i < tmp; ++i)
     rs[i] = rseq[tmp - 1 - i];
 
@@ -649,7 +969,10 @@ static void left_extend_seed_set_align_beg(
     }
 
     int max_off; // max off diagonal distance
-    ar->score = ksw_extend2(s->qbeg, qs, tmp, rs, 5, parent?opt->ctmat:opt->gamat, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, *aw, opt->pen_clip5, opt->zdrop, s->len * opt->a, &qle, &tle, &gtle, &gscore, &max_off);
+    if (i == 0 && pre && pre->h0) {
+      ar->score = pre->score, qle = pre->qle, tle = pre->tle;
+      gtle = pre->gtle, gscore = pre->gscore, max_off = pre->max_off;
+    } else ar->score = ksw_extend2(s->qbeg, qs, tmp, rs, 5, parent?opt->ctmat:opt->gamat, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, *aw, opt->pen_clip5, opt->zdrop, s->len * opt->a, &qle, &tle, &gtle, &gscore, &max_off);
 
     if (bwa_verbose >= 4) { printf("*** [%s] Left extension: prev_score=%d; score=%d; bandwidth=%d; max_off_diagonal_dist=%d\n", __func__, prev, ar->score, *aw, max_off); fflush(stdout); }
 
@@ -666,7 +989,7 @@ static void left_extend_seed_set_align_beg(
     ar->rb = s->rbeg - gtle;
     ar->truesc = gscore;
   }
-  free(qs); free(rs);
+  arena_free(rs); arena_free(qs);
 }
 
 /************************
@@ -681,6 +1004,7 @@ static void right_extend_seed_set_align_end(
     int64_t rmax[],        // start and end coordinate of reference sequence
     int *aw,               // bandwidth (output)
     int parent,            // parent or daughter strand
+    const kswx_t *pre,     // done by mem_chain_ext_batch with band opt->w, or NULL
     mem_alnreg_t *ar) {
 
   if (s->qbeg + s->len == l_query) {
@@ -708,7 +1032,10 @@ static void right_extend_seed_set_align_end(
     }
 
     int max_off;  // max off-diagonal distance
-    ar->score = ksw_extend2(l_query - qe, query + qe, rmax[1] - rmax[0] - re, rseq + re, 5, parent?opt->ctmat:opt->gamat, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, *aw, opt->pen_clip3, opt->zdrop, sc0, &qle, &tle, &gtle, &gscore, &max_off);
+    if (i == 0 && pre && pre->h0 == sc0) { // from the same left score
+      ar->score = pre->score, qle = pre->qle, tle = pre->tle;
+      gtle = pre->gtle, gscore = pre->gscore, max_off = pre->max_off;
+    } else ar->score = ksw_extend2(l_query - qe, query + qe, rmax[1] - rmax[0] - re, rseq + re, 5, parent?opt->ctmat:opt->gamat, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, *aw, opt->pen_clip3, opt->zdrop, sc0, &qle, &tle, &gtle, &gscore, &max_off);
 
     if (bwa_verbose >= 4) { printf("*** [%s] Right extension: prev_score=%d; score=%d; bandwidth=%d; max_off_diagonal_dist=%d\n", __func__, prev, ar->score, *aw, max_off); fflush(stdout); }
 
@@ -736,14 +1063,15 @@ static void right_extend_seed_set_align_end(
  * @param bns reference meta
  * @param pac reference
  * @param l_query length of query
- * @param query query sequence, raw WITHOUT bisulfite conversion */
+ * @param query query sequence, raw WITHOUT bisulfite conversion
+ * @param pre extension of the best seed done by mem_chain_ext_batch, or NULL */
 void mem_chain2region1(
    const mem_opt_t *opt, const bntseq_t *bns, uint8_t *rseq, int64_t rmax[], int rid,
    int l_query, const uint8_t *query, mem_seed_v *seeds, mem_alnreg_v *regs,
-   uint8_t parent, uint32_t reg0, float frac_rep) {
+   uint8_t parent, uint32_t reg0, float frac_rep, const mem_ext_t *pre) {
 
    // sort seeds by score
-   uint64_t *srt = calloc(seeds->n, sizeof(uint64_t));
+   uint64_t *srt = arena_calloc(seeds->n, sizeof(uint64_t));
    unsigned i;
    for (i = 0; i < seeds->n; ++i)
       srt[i] = (uint64_t)seeds->a[i].score<<32 | i;
@@ -834,8 +1162,10 @@ void mem_chain2region1(
             __func__, k, (long)s->len, (long)s->qbeg, (long)s->rbeg,
             bns->anns[rid].name);
 
-      left_extend_seed_set_align_beg(opt, s, query, rseq, rmax, &aw[0], parent, reg);
-      right_extend_seed_set_align_end(opt, s, query, l_query, rseq, rmax, &aw[1], parent, reg);
+      if (pre && pre->s != s) pre = 0;
+      left_extend_seed_set_align_beg(opt, s, query, rseq, rmax, &aw[0], parent, pre? &pre->x[0] : 0, reg);
+      right_extend_seed_set_align_end(opt, s, query, l_query, rseq, rmax, &aw[1], parent, pre? &pre->x[1] : 0, reg);
+      pre = 0;
 
       reg->bss = mem_getbss(parent, bns, reg->rb); /* set bisulfite strand */
       reg->parent = parent;
@@ -865,12 +1195,12 @@ void mem_chain2region1(
       reg->seedlen0 = s->len; // length of best scored seed
       reg->frac_rep = frac_rep;
    }
-   free(srt);
+   arena_free(srt);
 }
 
 void mem_chain2region(
    const mem_opt_t *opt, const bntseq_t *bns, const uint8_t *pac,
-   bseq1_t *bseq, uint8_t parent, mem_chain_v *chns, mem_alnreg_v *regs) {
+   bseq1_t *bseq, uint8_t parent, mem_chain_v *chns, const mem_ext_v *ext, mem_alnreg_v *regs) {
 
    uint32_t reg0 = regs->n;
    uint32_t i;
@@ -891,12 +1221,102 @@ void mem_chain2region(
       
       /* convert chain to region */
       uint32_t n0 = regs->n;
-      mem_chain2region1(opt, bns, rseq, rmax, rid, bseq->l_seq, bseq->seq, &c->seeds, regs, parent, reg0, c->frac_rep);
+      mem_chain2region1(opt, bns, rseq, rmax, rid, bseq->l_seq, bseq->seq, &c->seeds, regs, parent, reg0, c->frac_rep, ext && i < ext->n? &ext->a[i] : 0);
 
       // no region is generated, try the backup seeds
       if (regs->n == n0 && c->seeds_extra.n > 0) {
-         mem_chain2region1(opt, bns, rseq, rmax, rid, bseq->l_seq, bseq->seq, &c->seeds_extra, regs, parent, reg0, c->frac_rep);
+         mem_chain2region1(opt, bns, rseq, rmax, rid, bseq->l_seq, bseq->seq, &c->seeds_extra, regs, parent, reg0, c->frac_rep, 0);
       }
-      free(rseq);
+      arena_free(rseq);
    }
 }
+
+/* The first seed mem_chain2region1 extends in a chain is its best one that
+ * passes asymmetric_flt_seed; only the regions of earlier chains can make
+ * it skip that seed, so its extension can be done before those regions
+ * exist. This is done here for every chain of a batch of reads, left
+ * extensions first, then right extensions from their scores, each in one
+ * ksw_extend2_batch. Results are looked up by mem_chain2region; later
+ * seeds, the wider band of a second try and extensions of skipped seeds
+ * are computed there as before. */
+void mem_chain_ext_batch(const mem_opt_t *opt, const bntseq_t *bns, const uint8_t *pac, int n, mem_ext_job_t *jobs) {
+
+  kvec_t(kswx_t) xs = {0,0,0};
+  kvec_t(kswx_t*) dst = {0,0,0};
+  kvec_t(uint8_t*) buf = {0,0,0}; // reference of each chain, then reversed left query and reference
+  arena_mark_t m = arena_mark();
+  int k, r;
+  unsigned i, j;
+
+  for (k = 0; k < n; ++k) {
+    mem_ext_job_t *b = &jobs[k];
+    const bseq1_t *bseq = b->bseq;
+    b->ext->n = 0;
+    kv_resize(mem_ext_t, *b->ext, b->chns->n);
+    for (i = 0; i < b->chns->n; ++i) {
+      const mem_chain_t *c = b->chns->a + i;
+      mem_ext_t *e = &b->ext->a[b->ext->n++];
+      const mem_seed_t *s = 0;
+      uint64_t best = 0;
+      int64_t rmax[2], tmp;
+      uint8_t *rseq, *qs;
+      int rid;
+
+      memset(e, 0, sizeof(mem_ext_t));
+      if (c->seeds.n == 0) continue;
+      mem_chain_reference_span(opt, bseq->l_seq, bns->l_pac, c, rmax);
+      rseq = bns_fetch_seq(bns, pac, &rmax[0], c->seeds.a[0].rbeg, &rmax[1], &rid);
+      kv_push(uint8_t*, buf, rseq);
+      for (j = 0; j < c->seeds.n; ++j) { // the top of mem_chain2region1's sorted seeds
+        uint64_t key = (uint64_t)c->seeds.a[j].score<<32 | j;
+        if ((s == 0 || key > best) && !asymmetric_flt_seed(rseq, bseq->seq, &c->seeds.a[j], rmax[0]))
+          s = &c->seeds.a[j], best = key;
+      }
+      if (s == 0) continue;
+      e->s = s;
+      e->x[0].w = e->x[1].w = opt->w;
+      e->x[0].mat = e->x[1].mat = b->parent? opt->ctmat : opt->gamat;
+      e->x[0].end_bonus = opt->pen_clip5;
+      e->x[1].end_bonus = opt->pen_clip3;
+      // right: query and reference after the seed, as in right_extend_seed_set_align_end
+      e->x[1].qlen = bseq->l_seq - (s->qbeg + s->len);
+      e->x[1].query = bseq->seq + s->qbeg + s->len;
+      e->x[1].tlen = rmax[1] - rmax[0] - (s->rbeg + s->len - rmax[0]);
+      e->x[1].target = rseq + (s->rbeg + s->len - rmax[0]);
+      if (s->qbeg == 0) continue;
+      // left: reversed query and reference before the seed
+      tmp = s->rbeg - rmax[0];
+      qs = arena_malloc(s->qbeg + tmp);
+      for (r = 0; r < s->qbeg; ++r) qs[r] = bseq->seq[s->qbeg - 1 - r];
+      for (r = 0; r < tmp; ++r) qs[s->qbeg + r] = rseq[tmp - 1 - r];
+      kv_push(uint8_t*, buf, qs);
+      e->x[0].qlen = s->qbeg, e->x[0].query = qs;
+      e->x[0].tlen = tmp, e->x[0].target = qs + s->qbeg;
+      e->x[0].h0 = s->len * opt->a;
+      kv_push(kswx_t, xs, e->x[0]);
+      kv_push(kswx_t*, dst, &e->x[0]);
+    }
+  }
+  ksw_extend2_batch(xs.n, xs.a, 5, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, opt->zdrop);
+  for (i = 0; i < xs.n; ++i) *dst.a[i] = xs.a[i];
+
+  xs.n = dst.n = 0;
+  for (k = 0; k < n; ++k) {
+    mem_ext_job_t *b = &jobs[k];
+    for (i = 0; i < b->ext->n; ++i) {
+      mem_ext_t *e = &b->ext->a[i];
+      if (e->s == 0 || e->x[1].qlen == 0) continue;
+      if (e->s->qbeg == 0) e->x[1].h0 = e->s->len * opt->a;
+      else if (e->x[0].max_off < (opt->w>>1) + (opt->w>>2)) e->x[1].h0 = e->x[0].score;
+      else continue; // the left extension is tried with a wider band first
+      kv_push(kswx_t, xs, e->x[1]);
+      kv_push(kswx_t*, dst, &e->x[1]);
+    }
+  }
+  ksw_extend2_batch(xs.n, xs.a, 5, opt->o_del, opt->e_del, opt->o_ins, opt->e_ins, opt->zdrop);
+  for (i = 0; i < xs.n; ++i) *dst.a[i] = xs.a[i];
+
+  for (i = buf.n; i > 0; --i) arena_free(buf.a[i-1]);
+  arena_release(m);
+  free(buf.a); free(xs.a); free(dst.a);
+}
@@ -25,6 +25,8 @@
 
 #include "bwamem.h"
 #include "mem_alnreg.h"
+#include "ksw.h"
+#include "utils.h"
 
 /*******************
  * bwtintv_cache_t *
@@ -36,6 +38,10 @@
  * mem is the output from mem_collect_intv
  * _mem and tmpv are for internal use in mem_collect_intv
  * _mem is raw from bwt_smem1, before filtering by min_seed_len
+ * ready is set when mem was filled ahead of time by mem_collect_intv_batch,
+ * mem_chain then uses mem as is and clears the flag
+ * sa holds the reference positions of the seeds resolved by mem_chain
+ * hash_buf is the scratch of mem_hash_collect, allocated on first use
  *
  * Previously called smem_aux_t in BWA code. */
 
@@ -43,8 +49,13 @@ typedef struct {
   bwtintv_v mem;
   bwtintv_v _mem;
   bwtintv_v *tmpv[2];
+  int ready;
+  struct { size_t n, m; bwtint_t *a; } sa;
+  void *hash_buf;
 } bwtintv_cache_t;
 
+void mem_hash_buf_destroy(void *hash_buf);
+
 static inline bwtintv_cache_t *bwtintv_cache_init() {
   bwtintv_cache_t *a;
   a = calloc(1, sizeof(bwtintv_cache_t));
@@ -56,10 +67,26 @@ static inline bwtintv_cache_t *bwtintv_cache_init() {
 static inline void bwtintv_cache_destroy(bwtintv_cache_t *a) {
   free(a->tmpv[0]->a); free(a->tmpv[0]);
   free(a->tmpv[1]->a); free(a->tmpv[1]);
-  free(a->mem.a); free(a->_mem.a);
+  free(a->mem.a); free(a->_mem.a); free(a->sa.a);
+  mem_hash_buf_destroy(a->hash_buf);
   free(a);
 }
 
+/* One read against one bisulfite strand for mem_collect_intv_batch,
+ * bwt and bwtc are &bwt[parent] and &bwt[!parent] as in mem_chain */
+typedef struct {
+  const bwt_t *bwt, *bwtc;
+  const uint8_t *seq;
+  int len;
+  bwtintv_cache_t *intv_cache;
+} mem_seed_job_t;
+
+// collect the SA intervals of n jobs at once, interleaving their FM-index walks
+void mem_collect_intv_batch(const mem_opt_t *opt, int n, mem_seed_job_t *jobs);
+
+// the seeds of mem_collect_intv from a k-mer hash, with all their positions in sa
+void mem_hash_collect(const mem_hash_t *h, const mem_opt_t *opt, int parent, int len, const uint8_t *seq, bwtintv_cache_t *intv_cache);
+
 /**************
  * mem_seed_t *
  **************
@@ -97,10 +124,13 @@ typedef struct { size_t n, m; mem_chain_t *a;  } mem_chain_v;
 /********************************************
  * Cluster seeds into a chain (mem_chain_v).
  * Each chain contains one or more seeds
+ * ref_off is where the forward text of bwt starts in the reference of bns,
+ * 0 but for an add-on index (bwa_addon_t)
+ * hash, if not NULL, is seeded from instead of bwt
  ********************************************/
 mem_chain_v mem_chain(
-   const mem_opt_t *opt, const bwt_t *bwt, const bntseq_t *bns,
-   bseq1_t *bseq, void *intv_cache, uint8_t parent);
+   const mem_opt_t *opt, const bwt_t *bwt, const mem_hash_t *hash, const bntseq_t *bns,
+   bseq1_t *bseq, void *intv_cache, uint8_t parent, int64_t ref_off);
 
 // filter whole chain by chain weight and overlap with existing chains
 void mem_chain_flt(const mem_opt_t *opt, mem_chain_v *chns);
@@ -110,9 +140,31 @@ void mem_flt_chained_seeds(const mem_opt_t *opt, const bntseq_t *bns, const uint
 
 void mem_print_chain(const bntseq_t *bns, mem_chain_v *chns);
 
+/* The left (x[0]) and right (x[1]) extension of the best seed s of a
+ * chain, done ahead by mem_chain_ext_batch; x[].h0 is 0 if not done */
+typedef struct {
+  const mem_seed_t *s;
+  kswx_t x[2];
+} mem_ext_t;
+
+typedef struct { size_t n, m; mem_ext_t *a; } mem_ext_v;
+
+/* One read against one strand for mem_chain_ext_batch, with its chains
+ * as they go to mem_chain2region; ext gets one mem_ext_t per chain */
+typedef struct {
+  const bseq1_t *bseq;
+  uint8_t parent;
+  const mem_chain_v *chns;
+  mem_ext_v *ext;
+} mem_ext_job_t;
+
+// extend the best seed of every chain of n jobs at once, see ksw_extend2_batch
+void mem_chain_ext_batch(const mem_opt_t *opt, const bntseq_t *bns, const uint8_t *pac, int n, mem_ext_job_t *jobs);
+
+// ext, if not NULL, holds the extensions mem_chain_ext_batch did for chns
 void mem_chain2region(
    const mem_opt_t *opt, const bntseq_t *bns, const uint8_t *pac,
-   bseq1_t *bseq, uint8_t parent, mem_chain_v *chns, mem_alnreg_v *regs);
+   bseq1_t *bseq, uint8_t parent, mem_chain_v *chns, const mem_ext_v *ext, mem_alnreg_v *regs);
 
 static inline void free_mem_chain_v(mem_chain_v chns) {
    unsigned i;
@@ -121,5 +173,5 @@ static inline void free_mem_chain_v(mem_chain_v chns) {
       free(c->seeds.a);
       free(c->seeds_extra.a);
    }
-   free(chns.a);
+   arena_free(chns.a); // from mem_chain()
 }
@@ -0,0 +1,348 @@
+/* Seeding from a k-mer hash of a small reference
+ *
+ * Copyright (c) 2023 Jacob.Morrison@vai.org
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* On an amplicon panel, a plasmid or a spike-in the FM-index walks and SA
+ * lookups of mem_collect_intv() cost more than anything else per read.
+ * mem_hash_t keeps the converted text of both strands, one base per byte,
+ * and the positions of all its k-mers bucketed by k-mer; three letters per
+ * strand make the k-mer a base-3 number.
+ *
+ * mem_hash_collect() gives the seeds of the FM-index with their positions:
+ *
+ *   1. the MEMs of at least min_seed_len are extended from k-mer hits and
+ *      the super-maximal ones are the SMEMs, their loci the SA interval
+ *   2. re-seeding a long SMEM takes the intervals over its middle that are
+ *      maximal among the matches occurring more often than the SMEM
+ *   3. LAST-like seeds filter the hits of the k-mer at x base by base
+ *
+ * The only seeds missed are those all of whose k-mers occur more than
+ * max_occ times, and more than MEM_HASH_MAX_HIT; the FM-index keeps such a
+ * seed and samples max_occ of its hits. The hits of a seed are in text
+ * order rather than SA order, so the hits sampled from a repeat and the
+ * ties among equal alignments can differ from the FM-index; hashing is
+ * therefore only done on request (align -u). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memchain.h"
+#include "khash.h"
+#include "ksort.h"
+#include "kvec.h"
+#include "utils.h"
+
+#ifdef USE_MALLOC_WRAPPERS
+#  include "malloc_wrap.h"
+#endif
+
+#define _get_pac(pac, l) ((pac)[(l)>>2]>>((~(l)&3)<<1)&3)
+#define bsC2T(x) ((x)==1?3:(x))
+#define bsG2A(x) ((x)==2?0:(x))
+
+struct mem_hash_s {
+  int k;
+  uint32_t n_kmer;   // 3^k
+  int64_t l;         // length of a strand text, 2 * l_pac
+  uint8_t *text[2];  // daughter and parent text, as the bwt[] of the index
+  uint32_t *beg[2];  // hits of k-mer x are pos[beg[x]] .. pos[beg[x+1]-1]
+  uint32_t *pos[2];
+};
+
+/* base-3 digit of a base of a strand text or of a read converted for the
+ * strand; -1 for N and for the converted letter */
+static const int8_t hash_digit[2][5] = {
+  { 0, 1, -1, 2, -1 }, // daughter: A C T
+  { 0, -1, 1, 2, -1 }  // parent:   A G T
+};
+
+/**
+ * Hash the k-mers of both converted strands of the reference
+ * @param bns, pac  main index
+ * @return          0 if the reference is too long for 32-bit positions
+ */
+mem_hash_t *mem_hash_init(const bntseq_t *bns, const uint8_t *pac) {
+  mem_hash_t *h;
+  int64_t i, l_pac = bns->l_pac;
+  uint32_t x, mod, j;
+  int s, n, pass;
+
+  if (l_pac<<1 >= UINT32_MAX) return 0;
+  h = calloc(1, sizeof(mem_hash_t));
+  h->k = MEM_HASH_K; h->l = l_pac<<1;
+  for (n = 0, h->n_kmer = 1; n < h->k; ++n) h->n_kmer *= 3;
+  mod = h->n_kmer / 3;
+  for (s = 0; s < 2; ++s) {
+    uint8_t *t = h->text[s] = malloc(h->l);
+    uint32_t *beg = h->beg[s] = calloc(h->n_kmer + 1, sizeof(uint32_t));
+    h->pos[s] = malloc((h->l > h->k? h->l - h->k + 1 : 1) * sizeof(uint32_t));
+    for (i = 0; i < l_pac; ++i) { // forward, then reverse complement, as bis_pac_strand()
+      uint8_t c = _get_pac(pac, i);
+      t[i] = s? bsC2T(c) : bsG2A(c);
+      t[h->l - 1 - i] = s? bsC2T(3 - c) : bsG2A(3 - c);
+    }
+    // count the hits of each k-mer, then place them; the text has no N
+    for (pass = 0; pass < 2; ++pass) {
+      for (i = 0, x = 0, n = 0; i < h->l; ++i) {
+        x = x % mod * 3 + hash_digit[s][t[i]];
+        if (++n < h->k) continue;
+        if (pass == 0) ++beg[x+1];
+        else h->pos[s][beg[x]++] = i - h->k + 1;
+      }
+      if (pass == 0)
+        for (j = 0; j < h->n_kmer; ++j) beg[j+1] += beg[j];
+    }
+    memmove(beg + 1, beg, h->n_kmer * sizeof(uint32_t)); // beg[x] was moved to the end of bucket x
+    beg[0] = 0;
+  }
+  if (bwa_verbose >= 3)
+    fprintf(stderr, "[M::%s] seed from a %d-mer hash of the %ld bp reference (%.1f MB)\n", __func__,
+            h->k, (long)l_pac, (2. * (h->l * 5 + (h->n_kmer + 1) * 4)) / 1048576.);
+  return h;
+}
+
+void mem_hash_destroy(mem_hash_t *h) {
+  int s;
+  if (h == 0) return;
+  for (s = 0; s < 2; ++s) {
+    free(h->text[s]); free(h->beg[s]); free(h->pos[s]);
+  }
+  free(h);
+}
+
+/*******************
+ * Seed collection *
+ *******************/
+
+typedef struct {
+  int qb, qe;
+  int64_t rb;
+} hash_mem_t;
+
+#define hash_mem_lt(a, b) ((a).qb < (b).qb || ((a).qb == (b).qb && ((a).qe > (b).qe || ((a).qe == (b).qe && (a).rb < (b).rb))))
+KSORT_INIT(hash_mem, hash_mem_t, hash_mem_lt)
+
+typedef struct {
+  uint64_t info;  // qb<<32 | qe, as bwtintv_t
+  size_t n, off;  // number of loci and the first of them in pos
+} hash_seed_t;
+
+#define hash_seed_lt(a, b) ((a).info < (b).info)
+KSORT_INIT(hash_seed, hash_seed_t, hash_seed_lt)
+
+KHASH_MAP_INIT_INT64(diag, int)
+
+typedef struct {
+  kvec_t(hash_mem_t) mem;
+  kvec_t(hash_seed_t) seed;
+  kvec_t(bwtint_t) pos;
+  kvec_t(uint32_t) cand;
+  kvec_t(int) end;
+  khash_t(diag) *diag;  // diagonal -> end of the last match extended on it
+} hash_buf_t;
+
+static hash_seed_t *hash_seed_push(hash_buf_t *b, int qb, int qe) {
+  hash_seed_t *s;
+  s = kv_pushp(hash_seed_t, b->seed);
+  s->info = (uint64_t)qb<<32 | qe;
+  s->n = 0; s->off = b->pos.n;
+  return s;
+}
+
+/* all MEMs of at least min_seed_len, each extended from its first k-mer hit;
+ * such a MEM has a k-mer at every step-th query position */
+static void hash_mems(const mem_hash_t *h, const mem_opt_t *opt, int parent, int len, const uint8_t *seq, hash_buf_t *b) {
+  const uint8_t *t = h->text[parent];
+  const uint32_t *beg = h->beg[parent], *pos = h->pos[parent];
+  uint32_t x = 0, mod = h->n_kmer / 3, j;
+  uint32_t max_hit = opt->max_occ > MEM_HASH_MAX_HIT? (uint32_t)opt->max_occ : MEM_HASH_MAX_HIT;
+  int i, n = 0, absent, step = opt->min_seed_len - h->k + 1;
+
+  for (i = 0; i < len; ++i) {
+    int d = hash_digit[parent][seq[i]], q;
+    if (d < 0) { n = 0; continue; }
+    x = x % mod * 3 + d;
+    if (++n < h->k) continue;
+    q = i - h->k + 1;
+    if (q % step != 0 || beg[x+1] - beg[x] > max_hit) continue;
+    for (j = beg[x]; j < beg[x+1]; ++j) {
+      int64_t p = pos[j], rb = p;
+      int qb = q, qe = q + h->k;
+      khint_t k = kh_put(diag, b->diag, p - q, &absent);
+      if (!absent && kh_val(b->diag, k) >= qe) continue; // inside a match already extended
+      while (qb > 0 && rb > 0 && seq[qb-1] == t[rb-1]) --qb, --rb;
+      while (qe < len && p + qe - q < h->l && seq[qe] == t[p + qe - q]) ++qe;
+      kh_val(b->diag, k) = qe;
+      if (qe - qb >= opt->min_seed_len) {
+        hash_mem_t *m;
+        m = kv_pushp(hash_mem_t, b->mem);
+        m->qb = qb; m->qe = qe; m->rb = rb;
+      }
+    }
+  }
+  ks_introsort(hash_mem, b->mem.n, b->mem.a);
+}
+
+/* first pass: the MEMs not contained in another, grouped by interval */
+static void hash_smems(hash_buf_t *b) {
+  size_t i, j;
+  int max_qe = -1;
+  for (i = 0; i < b->mem.n; i = j) {
+    const hash_mem_t *m = &b->mem.a[i];
+    for (j = i + 1; j < b->mem.n && b->mem.a[j].qb == m->qb && b->mem.a[j].qe == m->qe; ++j);
+    if (m->qe > max_qe) { // sorted by qb, then longest first
+      hash_seed_t *s = hash_seed_push(b, m->qb, m->qe);
+      for (; i < j; ++i) kv_push(bwtint_t, b->pos, b->mem.a[i].rb);
+      s->n = b->pos.n - s->off;
+      max_qe = m->qe;
+    }
+  }
+}
+
+/* second pass, as bwt_smem1() from the middle of a long SMEM with min_intv
+ * one more than its occurrences: for the loci covering the middle in order
+ * of their start a, the interval ending at the min_intv-th largest end is
+ * maximal unless an earlier a reached the same end */
+static void hash_reseed(const mem_opt_t *opt, hash_buf_t *b) {
+  int split_len = (int)(opt->min_seed_len * opt->split_factor + .499);
+  size_t k, old_n = b->seed.n, i, j, l;
+
+  for (k = 0; k < old_n; ++k) {
+    int qb = b->seed.a[k].info>>32, qe = (uint32_t)b->seed.a[k].info;
+    int mid = (qb + qe)>>1, last = -1;
+    size_t min_intv = b->seed.a[k].n + 1;
+    if (qe - qb < split_len || b->seed.a[k].n > (size_t) opt->split_width) continue;
+    b->end.n = 0;
+    for (i = 0; i < b->mem.n && b->mem.a[i].qb <= mid; i = j) {
+      int a = b->mem.a[i].qb, e;
+      for (j = i; j < b->mem.n && b->mem.a[j].qb == a; ++j) {
+        if (b->mem.a[j].qe <= mid) continue;
+        kv_push(int, b->end, b->mem.a[j].qe); // kept in decreasing order
+        for (l = b->end.n - 1; l > 0 && b->end.a[l-1] < b->end.a[l]; --l) {
+          int tmp = b->end.a[l]; b->end.a[l] = b->end.a[l-1]; b->end.a[l-1] = tmp;
+        }
+      }
+      if (b->end.n < min_intv || (e = b->end.a[min_intv-1]) == last) continue;
+      last = e;
+      if (e - a >= opt->min_seed_len) {
+        hash_seed_t *s = hash_seed_push(b, a, e);
+        for (l = 0; l < j; ++l)
+          if (b->mem.a[l].qe >= e) kv_push(bwtint_t, b->pos, b->mem.a[l].rb + a - b->mem.a[l].qb);
+        s->n = b->pos.n - s->off;
+        ks_introsort_64(s->n, b->pos.a + s->off);
+      }
+    }
+  }
+}
+
+/* third pass, as bwt_seed_strategy1(): the shortest match from x longer than
+ * min_seed_len occurring less than max_mem_intv times
+ * @return  where the next search starts */
+static int hash_seed_last(const mem_hash_t *h, const mem_opt_t *opt, int parent, int len, const uint8_t *seq, int x, hash_buf_t *b) {
+  const uint8_t *t = h->text[parent];
+  uint32_t y = 0, j;
+  int i, absent = 0;
+
+  for (i = x; i < x + h->k; ++i) {
+    if (i == len) return len;
+    if (seq[i] > 3) return i + 1;
+    if (hash_digit[parent][seq[i]] < 0) absent = 1;
+    else y = y * 3 + hash_digit[parent][seq[i]];
+  }
+  b->cand.n = 0;
+  if (!absent) {
+    kv_resize(uint32_t, b->cand, h->beg[parent][y+1] - h->beg[parent][y]);
+    for (j = h->beg[parent][y]; j < h->beg[parent][y+1]; ++j) b->cand.a[b->cand.n++] = h->pos[parent][j];
+  }
+  for (; i < len; ++i) {
+    size_t n = 0;
+    if (seq[i] > 3) return i + 1;
+    for (j = 0; j < b->cand.n; ++j) {
+      uint32_t p = b->cand.a[j];
+      if (p + (i - x) < h->l && t[p + (i - x)] == seq[i]) b->cand.a[n++] = p;
+    }
+    b->cand.n = n;
+    if (n < opt->max_mem_intv && i - x >= opt->min_seed_len) {
+      if (n > 0) {
+        hash_seed_t *s = hash_seed_push(b, x, i + 1);
+        for (j = 0; j < n; ++j) kv_push(bwtint_t, b->pos, b->cand.a[j]);
+        s->n = n;
+      }
+      return i + 1;
+    }
+  }
+  return len;
+}
+
+/**
+ * mem_collect_intv() on the hash
+ * @param parent      strand, seq is converted for it
+ * @param intv_cache  on return mem holds the seeds sorted by info with x[2]
+ *                    their occurrences, and sa all their text positions,
+ *                    x[2] per seed in the order of mem
+ */
+void mem_hash_collect(const mem_hash_t *h, const mem_opt_t *opt, int parent, int len, const uint8_t *seq, bwtintv_cache_t *intv_cache) {
+  hash_buf_t *b;
+  size_t i, j;
+  int x = 0;
+
+  if (intv_cache->hash_buf == 0) { // kept with the cache, for the reads of its thread
+    b = intv_cache->hash_buf = calloc(1, sizeof(hash_buf_t));
+    b->diag = kh_init(diag);
+  }
+  b = (hash_buf_t*)intv_cache->hash_buf;
+  b->mem.n = b->seed.n = b->pos.n = 0;
+  kh_clear(diag, b->diag);
+  hash_mems(h, opt, parent, len, seq, b);
+  hash_smems(b);
+  hash_reseed(opt, b);
+  if (opt->max_mem_intv > 0) {
+    while (x < len) {
+      if (seq[x] < 4) x = hash_seed_last(h, opt, parent, len, seq, x, b);
+      else ++x;
+    }
+  }
+  ks_introsort(hash_seed, b->seed.n, b->seed.a);
+
+  intv_cache->mem.n = 0; intv_cache->sa.n = 0;
+  kv_resize(bwtint_t, intv_cache->sa, b->pos.n);
+  for (i = 0; i < b->seed.n; ++i) {
+    bwtintv_t v;
+    v.x[0] = v.x[1] = 0; v.x[2] = b->seed.a[i].n;
+    v.info = b->seed.a[i].info;
+    kv_push(bwtintv_t, intv_cache->mem, v);
+    for (j = 0; j < b->seed.a[i].n; ++j)
+      intv_cache->sa.a[intv_cache->sa.n++] = b->pos.a[b->seed.a[i].off + j];
+  }
+}
+
+void mem_hash_buf_destroy(void *hash_buf) {
+  hash_buf_t *b = (hash_buf_t*)hash_buf;
+  if (b == 0) return;
+  kh_destroy(diag, b->diag);
+  free(b->mem.a); free(b->seed.a); free(b->pos.a); free(b->cand.a); free(b->end.a);
+  free(b);
+}
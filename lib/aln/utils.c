@@ -40,6 +40,7 @@
 #endif
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include "utils.h"
 
 #include "ksort.h"
@@ -296,3 +297,179 @@ double realtime()
 	gettimeofday(&tp, &tzp);
 	return tp.tv_sec + tp.tv_usec * 1e-6;
 }
+
+/**************
+ * Huge pages *
+ **************/
+
+/* ask for transparent huge pages on [p, p+len); p must be page aligned */
+int huge_advise(void *p, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+	if (len >= HUGE_PAGE_SIZE) return madvise(p, len, MADV_HUGEPAGE);
+#else
+	(void)p; (void)len;
+#endif
+	return -1;
+}
+
+/* malloc() for large random-access arrays: aligned to and hinted for huge
+ * pages so that lookups take fewer TLB misses; release with free() */
+void *huge_malloc(size_t size)
+{
+	void *p;
+	if (size < HUGE_PAGE_SIZE) return malloc(size);
+	if (posix_memalign(&p, HUGE_PAGE_SIZE, size) != 0) return 0;
+	huge_advise(p, size);
+	return p;
+}
+
+/* bytes of this process mapped with huge pages, or -1 if unknown */
+int64_t huge_page_bytes(void)
+{
+	static const char *keys[] = { "AnonHugePages:", "ShmemPmdMapped:", "FilePmdMapped:", "Shared_Hugetlb:", "Private_Hugetlb:" };
+	char line[256];
+	int64_t n = -1;
+	long x;
+	unsigned i;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/smaps_rollup", "r")) == 0) return -1;
+	while (fgets(line, sizeof(line), fp))
+		for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+			if (strncmp(line, keys[i], strlen(keys[i])) == 0 && sscanf(line + strlen(keys[i]), "%ld", &x) == 1)
+				n = (n < 0? 0 : n) + x * 1024;
+	fclose(fp);
+	return n;
+}
+
+/* the selected transparent huge page mode, e.g. "madvise", or "n/a" */
+const char *huge_page_mode(int shmem)
+{
+	static char mode[32];
+	char line[256], *p, *q;
+	FILE *fp;
+
+	strcpy(mode, "n/a");
+	fp = fopen(shmem? "/sys/kernel/mm/transparent_hugepage/shmem_enabled" : "/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (fp == 0) return mode;
+	if (fgets(line, sizeof(line), fp) && (p = strchr(line, '[')) != 0 && (q = strchr(p, ']')) != 0 && q - p - 1 < (int)sizeof(mode)) {
+		memcpy(mode, p + 1, q - p - 1);
+		mode[q - p - 1] = 0;
+	}
+	fclose(fp);
+	return mode;
+}
+
+/**********
+ * Arenas *
+ **********/
+
+#define ARENA_BLK_SIZE (1UL<<16)
+#define ARENA_ALIGN 16
+
+typedef struct arena_blk_s {
+	struct arena_blk_s *prev;
+	size_t n, m; // bytes used and available in a[]
+	uint8_t *a;
+} arena_blk_t;
+
+struct arena_s {
+	arena_blk_t *top;
+	uint8_t *last; // the most recent arena_malloc(), which arena_free() gives back
+};
+
+static __thread arena_t *arena_cur; // bound by each worker thread
+
+static arena_blk_t *arena_blk_init(arena_blk_t *prev, size_t m)
+{
+	arena_blk_t *b = malloc(sizeof(arena_blk_t) + m + ARENA_ALIGN);
+	b->prev = prev; b->n = 0; b->m = m;
+	b->a = (uint8_t*)(((uintptr_t)(b + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+	return b;
+}
+
+arena_t *arena_init(void)
+{
+	arena_t *a = calloc(1, sizeof(arena_t));
+	a->top = arena_blk_init(0, ARENA_BLK_SIZE);
+	return a;
+}
+
+void arena_destroy(arena_t *a)
+{
+	arena_blk_t *b, *p;
+	if (a == 0) return;
+	for (b = a->top; b; b = p) p = b->prev, free(b);
+	free(a);
+}
+
+void arena_bind(arena_t *a)
+{
+	arena_cur = a;
+}
+
+void *arena_malloc(size_t size)
+{
+	arena_t *a = arena_cur;
+	arena_blk_t *b;
+	if (a == 0) return malloc(size);
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	b = a->top;
+	if (b->n + size > b->m) // chain a larger block; arena_release() merges them later
+		b = a->top = arena_blk_init(b, size > b->m<<1? size : b->m<<1);
+	a->last = b->a + b->n;
+	b->n += size;
+	return a->last;
+}
+
+void *arena_calloc(size_t n, size_t size)
+{
+	void *p = arena_malloc(n * size);
+	if (p) memset(p, 0, n * size);
+	return p;
+}
+
+void arena_free(void *p)
+{
+	arena_t *a = arena_cur;
+	arena_blk_t *b;
+	if (p == 0) return;
+	if (a) {
+		if (p == a->last) { // undo the latest allocation
+			a->top->n = a->last - a->top->a;
+			a->last = 0;
+			return;
+		}
+		for (b = a->top; b; b = b->prev)
+			if ((uint8_t*)p >= b->a && (uint8_t*)p < b->a + b->m) return; // given back by arena_release()
+	}
+	free(p);
+}
+
+arena_mark_t arena_mark(void)
+{
+	arena_mark_t m = {0, 0};
+	if (arena_cur) m.b = arena_cur->top, m.n = arena_cur->top->n;
+	return m;
+}
+
+void arena_release(arena_mark_t m)
+{
+	arena_t *a = arena_cur;
+	arena_blk_t *b;
+	size_t spill = 0;
+	if (a == 0 || m.b == 0) return;
+	while (a->top != m.b) {
+		b = a->top, a->top = b->prev;
+		spill += b->m;
+		free(b);
+	}
+	a->top->n = m.n;
+	a->last = 0;
+	if (spill && m.n == 0 && a->top->prev == 0) { // emptied; grow the first block to the peak so that it suffices next time
+		b = a->top;
+		a->top = arena_blk_init(0, b->m + spill);
+		free(b);
+	}
+}
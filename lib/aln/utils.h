@@ -49,6 +49,8 @@
 
 #define xassert(cond, msg) if ((cond) == 0) _err_fatal_simple_core(__func__, msg)
 
+#define HUGE_PAGE_SIZE (2UL<<20) // transparent huge page on x86-64 and most arm64
+
 typedef struct {
   uint64_t x, y;
 } pair64_t;
@@ -62,6 +64,11 @@ typedef struct {
 
 typedef struct { size_t n, m; trio64_t *a; } trio64_v;
 
+/* bump allocator for the temporaries of a read or a batch of reads, bound
+ * to the calling thread with arena_bind() */
+typedef struct arena_s arena_t;
+typedef struct { void *b; size_t n; } arena_mark_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -95,6 +102,23 @@ extern "C" {
   double cputime();
   double realtime();
 
+  int huge_advise(void *p, size_t len);
+  void *huge_malloc(size_t size);
+  int64_t huge_page_bytes(void);
+  const char *huge_page_mode(int shmem);
+
+  /* arena_malloc() carves from the bound arena, or calls malloc() if none
+   * is bound; arena_free() accepts either and only frees the latter.
+   * arena_release() drops everything carved since the arena_mark() */
+  arena_t *arena_init(void);
+  void arena_destroy(arena_t *a);
+  void arena_bind(arena_t *a);
+  void *arena_malloc(size_t size);
+  void *arena_calloc(size_t n, size_t size);
+  void arena_free(void *p);
+  arena_mark_t arena_mark(void);
+  void arena_release(arena_mark_t m);
+
   void ks_introsort_64s(size_t n, int64_t *a);
   void ks_introsort_64 (size_t n, uint64_t *a);
   void ks_introsort_128(size_t n, pair64_t *a);
@@ -47,6 +47,7 @@ static double realtime() {
 
 int main_biscuit_index(int argc, char *argv[]);
 int main_align(int argc, char *argv[]);
+int main_shm(int argc, char *argv[]);
 int main_pileup(int argc, char *argv[]);
 /* int main_ndr(int argc, char *argv[]); */
 int main_vcf2bed(int argc, char *argv[]);
@@ -74,6 +75,7 @@ static int usage()
   fprintf(stderr, "    index        Index reference genome sequences in the FASTA format\n");
   fprintf(stderr, "    align        Align bisulfite treated short reads using adapted BWA-mem\n");
   fprintf(stderr, "                     algorithm\n");
+  fprintf(stderr, "    shm          Stage/list/drop an index in shared memory for align\n");
   fprintf(stderr, "\n");
   fprintf(stderr, " -- BAM operation\n");
   fprintf(stderr, "    tview        Text alignment viewer with bisulfite coloring\n");
@@ -112,6 +114,7 @@ int main(int argc, char *argv[]) {
   if (argc < 2) return usage();
   if (strcmp(argv[1], "index") == 0) ret = main_biscuit_index(argc-1, argv+1);
   else if (strcmp(argv[1], "align") == 0) ret = main_align(argc-1, argv+1);
+  else if (strcmp(argv[1], "shm") == 0) ret = main_shm(argc-1, argv+1);
   else if (strcmp(argv[1], "pileup") == 0) ret = main_pileup(argc-1, argv+1);
   /* else if (strcmp(argv[1], "ndr") == 0) ret = main_ndr(argc-1, argv+1); */
   else if (strcmp(argv[1], "vcf2bed") == 0) ret = main_vcf2bed(argc-1, argv+1);